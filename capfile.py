@@ -0,0 +1,133 @@
+import struct
+import sys
+import numpy as np
+
+# Layout of the header written by main.cpp (CaptureFileHeader), little endian, 88 bytes
+HEADER_FORMAT = '<8s10I2dQ2q'
+HEADER_FIELDS = ['magic', 'version', 'headerSize', 'constellationId', 'vcxoType', 'card', 'channel',
+                 'burstSize', 'blockSize', 'sampleFormat', 'reserved', 'referenceFreq', 'sampleRate',
+                 'nbrBursts', 'startTime', 'stopTime']
+CHANNEL_NAMES = ['ADC0', 'ADC1', 'DAC0', 'DAC1', 'ADC0/ADC1']
+FORMAT_INT16_PAIRS = 1
+FORMAT_DELTA = 2
+FORMAT_DELTA_PAIRS = 3
+FORMAT_PACKED14 = 4
+FORMAT_PACKED14_PAIRS = 5
+CHUNK_FORMAT = '<4I'  # CaptureChunkHeader: nbrBursts, payloadBytes, chunkBytes, reserved
+CODEC_BLOCK_SAMPLES = 128
+CODEC_BLOCK_SHIFTED = 0x80
+
+
+# Decode `count` samples coded by DeltaCodec_Encode() starting at data[pos].
+# Returns the samples as int16 and the position following them.
+def decode_delta(data, pos, count):
+    out = np.empty(count, dtype=np.uint16)
+    for start in range(0, count, CODEC_BLOCK_SAMPLES):
+        n = min(CODEC_BLOCK_SAMPLES, count - start)
+        width = int(data[pos]) & 0x1f
+        shift = 2 if data[pos] & CODEC_BLOCK_SHIFTED else 0
+        first = int(data[pos + 1]) | int(data[pos + 2]) << 8
+        pos += 3
+        nbytes = ((n - 1) * width + 7) // 8
+        if width:
+            bits = np.unpackbits(data[pos:pos + nbytes], bitorder='little')[:(n - 1) * width]
+            codes = bits.reshape(n - 1, width).astype(np.uint32) @ (np.uint32(1) << np.arange(width, dtype=np.uint32))
+        else:
+            codes = np.zeros(n - 1, dtype=np.uint32)
+        pos += nbytes
+        # zig-zag, then a running sum wrapping around on 16 bits
+        deltas = (codes >> 1) ^ (-(codes & 1).astype(np.int64) & 0xffff)
+        values = (first + np.concatenate(([0], np.cumsum(deltas)))) & 0xffff
+        out[start:start + n] = (values << shift) & 0xffff
+    return out.view('<i2'), pos
+
+
+# Decode the chunks of a delta coded capture file into an array shaped like the uncoded samples
+def read_delta_chunks(filename, header):
+    channels = 2 if header['sampleFormat'] == FORMAT_DELTA_PAIRS else 1
+    count, burst_size = header['nbrBursts'], header['burstSize']
+    samples = np.empty((count, burst_size, channels), dtype='<i2')
+    data = np.fromfile(filename, dtype=np.uint8, offset=header['headerSize'])
+    burst = pos = 0
+    while burst < count:
+        nbr_bursts, payload, chunk_bytes, _ = struct.unpack_from(CHUNK_FORMAT, data, pos)
+        p = pos + struct.calcsize(CHUNK_FORMAT)
+        for b in range(burst, min(burst + nbr_bursts, count)):
+            for ch in range(channels):
+                samples[b, :, ch], p = decode_delta(data, p, burst_size)
+        burst += nbr_bursts
+        pos += chunk_bytes
+    return samples if channels == 2 else samples[:, :, 0]
+
+
+# Unpack the 14 bit samples stored by Packed14_Pack(): 4 samples in every 7 bytes, the first one in the low bits,
+# a last group of fewer than 4 samples in (7 * count + 3) // 4 bytes in all. blocks holds one packed burst per row,
+# the samples come back left justified like the int16 files, as dtype.
+def unpack14(blocks, count, dtype=np.int16):
+    nbr_groups, nbytes = (count + 3) // 4, (7 * count + 3) // 4
+    groups = np.zeros(blocks.shape[:-1] + (nbr_groups, 8), dtype=np.uint8)
+    if nbytes == nbr_groups * 7:
+        groups[..., :7] = blocks[..., :nbytes].reshape(blocks.shape[:-1] + (nbr_groups, 7))
+    else:
+        padded = np.zeros(blocks.shape[:-1] + (nbr_groups * 7,), dtype=np.uint8)
+        padded[..., :nbytes] = blocks[..., :nbytes]
+        groups[..., :7] = padded.reshape(blocks.shape[:-1] + (nbr_groups, 7))
+    codes = (groups.view('<u8') >> np.array([0, 14, 28, 42], dtype=np.uint64)) & 0x3fff
+    # sign extend the 14 bit codes while converting, without an int16 intermediate for float outputs
+    codes = codes.astype(np.int32)
+    codes -= (codes & 0x2000) << 1
+    return (codes << 2).astype(dtype).reshape(blocks.shape[:-1] + (nbr_groups * 4,))[..., :count]
+
+
+# Read the header of a .cap file and map its samples without copying them ( delta coded and packed files are decoded ).
+# Returns the header as a dict and an int16 array of shape (nbrBursts, burstSize), or
+# (nbrBursts, burstSize, 2) for ADC0/ADC1 sample pairs captured on the same trigger. Packed files can be unpacked
+# straight to another dtype, float32 for instance.
+def read_capture(filename, dtype=np.int16):
+    with open(filename, 'rb') as f:
+        raw = f.read(struct.calcsize(HEADER_FORMAT))
+    header = dict(zip(HEADER_FIELDS, struct.unpack(HEADER_FORMAT, raw)))
+    if header['magic'] != b'FMC15XCP':
+        raise ValueError(f"{filename} is not a capture file")
+    # vcxoType, card and channel are signed in the C header
+    for key in ('vcxoType', 'card', 'channel'):
+        header[key] = struct.unpack('<i', struct.pack('<I', header[key]))[0]
+
+    if header['sampleFormat'] in (FORMAT_DELTA, FORMAT_DELTA_PAIRS):
+        samples = read_delta_chunks(filename, header)
+        return header, samples if np.dtype(dtype) == np.int16 else samples.astype(dtype)
+    if header['sampleFormat'] in (FORMAT_PACKED14, FORMAT_PACKED14_PAIRS):
+        channels = 2 if header['sampleFormat'] == FORMAT_PACKED14_PAIRS else 1
+        blocks = np.memmap(filename, dtype=np.uint8, mode='r', offset=header['headerSize'],
+                           shape=(header['nbrBursts'], header['blockSize']))
+        samples = unpack14(blocks, channels * header['burstSize'], dtype)
+        return header, samples.reshape(header['nbrBursts'], header['burstSize'], 2) if channels == 2 else samples
+
+    blocks = np.memmap(filename, dtype='<i2', mode='r', offset=header['headerSize'],
+                       shape=(header['nbrBursts'], header['blockSize'] // 2))
+    if header['sampleFormat'] == FORMAT_INT16_PAIRS:
+        samples = blocks[:, :2 * header['burstSize']].reshape(header['nbrBursts'], header['burstSize'], 2)
+    else:
+        samples = blocks[:, :header['burstSize']]
+    return header, samples if np.dtype(dtype) == np.int16 else samples.astype(dtype)
+
+
+if __name__ == '__main__':
+    import matplotlib.pyplot as plt
+
+    header, samples = read_capture(sys.argv[1] if len(sys.argv) > 1 else 'adc0.cap')
+    for key in HEADER_FIELDS[1:]:
+        print(f"{key:16}: {header[key]}")
+    print(f"{'duration':16}: {(header['stopTime'] - header['startTime']) / 1e9:.6f} s")
+
+    plt.title(f"{CHANNEL_NAMES[header['channel']]} card {header['card']}, burst 0")
+    t = np.arange(header['burstSize']) / header['sampleRate'] * 1e6
+    if samples.ndim == 3:
+        plt.plot(t, samples[0, :, 0], label='ADC0')
+        plt.plot(t, samples[0, :, 1], label='ADC1')
+        plt.legend()
+    else:
+        plt.plot(t, samples[0])
+    plt.xlabel('Time, us')
+    plt.ylabel('ADC code')
+    plt.show()
@@ -0,0 +1,644 @@
+/**
+@file fmc15x_sim.cpp
+@brief Software model of a FMC150/FMC151 constellation behind the sipif/cid/sxdx/memfifo/fmc15x API
+
+Build main.cpp against this file instead of the 4DSP libraries to run the reference application without a board:
+
+	g++ -O2 -pthread -DFMC15X_SIM -I<4DSP include directories> main.cpp fmc15x_sim.cpp -o fmc15x_sim
+
+Defining FMC15X_SIM lets main.cpp send its register transactions through the batch entry points of the model.
+
+The model keeps the DAC waveform memories, the ADC FIFOs ( normal and ramp pattern mode ), the router settings and
+the sip registers of every card, and charges every access to a simulated host link so that the acquisition pipeline
+can be timed on an ordinary machine. It is configured with environment variables:
+
+	FMC15X_SIM_CONSTELLATION	constellation to report: ml605, kc705, vc707, zc706, zc706_ddr3 or pc720_both ( default kc705 )
+	FMC15X_SIM_FPGA				FPGA device type returned by sipif_init() ( default XC7K325T-2FFG900C )
+	FMC15X_SIM_LATENCY_US		round trip time of a register access or a DMA transfer in us ( default 100 )
+	FMC15X_SIM_BANDWIDTH_MBPS	DMA bandwidth of the link in MB/s, 0 for an unlimited link ( default 100 )
+	FMC15X_SIM_VCXO_MHZ			VCXO frequency in MHz ( default 491.52 )
+	FMC15X_SIM_NOISE_LSB		peak noise added to the ADC samples in LSB ( default 2 )
+	FMC15X_SIM_TAP_ERRORS		mask of the ADC data lines failing when a card is initialised without auto training ( default 0 )
+	FMC15X_SIM_VERBOSE			print the link statistics when sipif_free() is called
+*************************************************************************/
+
+// system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// project includes
+#include "sipif.h"
+#include "cid.h"
+#include "sxdxrouter.h"
+#include "i2cmaster.h"
+#include "fmc15x.h"
+#include "ctgen.h"
+#include "memfifo.h"
+
+#define SIM_STAR_SIZE			0x1000			/*!< address space given to every star */
+#define SIM_FMC150_SEC_ID		0xC6			/*!< FMC150 secondary star ID, as in main.cpp */
+#define SIM_FMC151_SEC_ID		0xF2			/*!< FMC151 secondary star ID, as in main.cpp */
+#define SIM_MAX_CARDS			2				/*!< number of FMC cards of a PC720 */
+#define SIM_INIT_ACCESSES		256				/*!< register accesses made by fmc15x_init() */
+#define SIM_TRAINING_ACCESSES	(2*32*14)		/*!< extra register accesses made by the IODELAY auto training */
+#define SIM_NBR_FREQ			7				/*!< number of frequency counters */
+
+/**
+*  State of one simulated FMC card.
+*/
+typedef struct {
+	bool initialised;						/*!< fmc15x_init() succeeded */
+	bool autoTraining;						/*!< card initialised with the IODELAY auto training */
+	bool patternMode;						/*!< ADC outputs the ramp test pattern */
+	uint32_t nbrBurst;						/*!< number of bursts per trigger, 0 for unlimited */
+	uint32_t burstSize;						/*!< burst size in samples */
+	bool adcEnabled[2];						/*!< ADC channels enabled by fmc15x_ctrl_enable_channel() */
+	bool dacEnabled[2];						/*!< DAC channels enabled by fmc15x_ctrl_enable_channel() */
+	bool dacArmed;							/*!< fmc15x_ctrl_arm_dac() was called */
+	int32_t wfmTarget;						/*!< DAC waiting for a waveform upload, -1 when none */
+	std::vector<int16_t> wfm[2];			/*!< DAC waveform memories */
+	uint64_t fifoSamples[2];				/*!< samples left in the ADC FIFOs since the last trigger */
+	uint64_t adcClock[2];					/*!< ADC sample counter, drives the ramp pattern and the DAC loopback */
+	uint64_t sampleClock;					/*!< sample clock count of the next trigger */
+} SimCard;
+
+/**
+*  State of the simulated constellation.
+*/
+typedef struct {
+	bool open;								/*!< sipif_init() succeeded */
+	uint16_t constellationId;				/*!< constellation reported by cid_getconstellationid() */
+	const char *fpga;						/*!< FPGA device type */
+	int32_t nbrCards;						/*!< number of FMC cards */
+	double latency;							/*!< round trip time of an access in seconds */
+	double bandwidth;						/*!< DMA bandwidth in bytes/s, 0 for unlimited */
+	double vcxo;							/*!< VCXO frequency in MHz */
+	int32_t noise;							/*!< peak ADC noise in LSB */
+	uint16_t tapErrors;						/*!< ADC data lines failing without auto training */
+	bool verbose;							/*!< print the link statistics on sipif_free() */
+	uint64_t routerS1D3;					/*!< last S1D3 router setting */
+	uint64_t routerS3D1;					/*!< last S3D1 router setting */
+	bool fifoArmed;							/*!< DDR3 memory FIFO armed */
+	std::map<uint32_t, uint32_t> regs;		/*!< sip registers written with sipif_writesipreg() */
+	SimCard card[SIM_MAX_CARDS];
+	uint32_t random;						/*!< noise generator state */
+	// link statistics
+	uint64_t accesses;						/*!< register accesses */
+	uint64_t batches;						/*!< batches of register accesses sent in one round trip */
+	uint64_t bytesWritten;					/*!< bytes sent with sipif_writedata() */
+	uint64_t bytesRead;						/*!< bytes received with sipif_readdata() */
+	double linkBusy;						/*!< total time the link carried payload in seconds */
+} SimDevice;
+
+static std::mutex g_simLock;				/*!< protects g_sim */
+static std::mutex g_simLinkLock;			/*!< protects g_simLinkFree and the link statistics */
+static SimDevice g_sim;
+static std::chrono::steady_clock::time_point g_simLinkFree;
+static thread_local bool g_simBatch;		/*!< register accesses of this thread are part of a batch, see sipif_sim_batch_begin() */
+
+static const struct {
+	const char *name;
+	uint16_t id;
+	int32_t nbrCards;
+} g_simConstellations[] = {
+	{ "ml605",			CONSTELLATION_ID_ML605,			1 },
+	{ "kc705",			CONSTELLATION_ID_KC705,			1 },
+	{ "vc707",			CONSTELLATION_ID_VC707,			1 },
+	{ "zc706",			CONSTELLATION_ID_ZC706,			1 },
+	{ "zc706_ddr3",		CONSTELLATION_ID_FMC151_ZC706_DDR3,	1 },
+	{ "pc720_both",		CONSTELLATION_ID_PC720_BOTH,	2 },
+};
+
+static double SimEnv(const char *name, double def)
+{
+	const char *value = getenv(name);
+	return (value && *value) ? atof(value) : def;
+}
+
+/**
+*  Hold the caller for the time the simulated link needs to carry a transfer. Payloads are serialized on the link at
+*  the configured bandwidth, so concurrent callers queue behind each other, while the round trip latency of the
+*  requests in flight overlaps.
+*
+*  @param bytes	payload size, 0 for a register access
+*/
+static void SimLinkTransfer(uint64_t bytes)
+{
+	double occupancy = g_sim.bandwidth > 0 ? bytes / g_sim.bandwidth : 0;
+	std::chrono::steady_clock::time_point done;
+	{
+		std::lock_guard<std::mutex> guard(g_simLinkLock);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(g_simLinkFree < now)
+			g_simLinkFree = now;
+		g_simLinkFree += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(occupancy));
+		done = g_simLinkFree + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(g_sim.latency));
+		g_sim.linkBusy += occupancy;
+	}
+	std::this_thread::sleep_until(done);
+}
+
+/**
+*  Register access on the simulated link, used by every control function.
+*
+*  @param count	number of register accesses
+*/
+static void SimAccess(uint32_t count)
+{
+	{
+		std::lock_guard<std::mutex> guard(g_simLinkLock);
+		g_sim.accesses += count;
+	}
+	if(g_simBatch)
+		return;
+	for(uint32_t i = 0; i < count; i++)
+		SimLinkTransfer(0);
+}
+
+/**
+*  Start a batch of register accesses, as sent by SipTransaction_Commit() in main.cpp. The accesses of the calling
+*  thread are queued until sipif_sim_batch_end(), which sends them in one packet and waits for a single round trip.
+*/
+void sipif_sim_batch_begin(void)
+{
+	g_simBatch = true;
+}
+
+void sipif_sim_batch_end(void)
+{
+	if(!g_simBatch)
+		return;
+	g_simBatch = false;
+	{
+		std::lock_guard<std::mutex> guard(g_simLinkLock);
+		g_sim.batches++;
+	}
+	SimLinkTransfer(0);
+}
+
+/**
+*  Find the card owning a FMC150/FMC151 peripheral address.
+*
+*  @return card index or -1 when the device is not open or the card is not present
+*/
+static int32_t SimCardFromAddr(uint32_t addr)
+{
+	if(!g_sim.open)
+		return -1;
+	uint32_t star = addr / SIM_STAR_SIZE;
+	int32_t card = (star == SIM_FMC150_SEC_ID || star == SIM_FMC151_SEC_ID) ? 1 : 0;
+	return card < g_sim.nbrCards ? card : -1;
+}
+
+static uint32_t SimRandom(void)
+{
+	// xorshift32, good enough for ADC noise
+	uint32_t x = g_sim.random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g_sim.random = x;
+	return x;
+}
+
+/**
+*  Produce ADC samples: the ramp test pattern in pattern mode, otherwise the DAC with the same index looped back
+*  at -6dB plus noise. Samples are 14 bit, 16 bit aligned like the real ADC data.
+*/
+static void SimFillAdc(SimCard *card, int32_t adc, uint16_t *out, uint32_t count)
+{
+	const std::vector<int16_t> &wfm = card->wfm[adc];
+	bool loopback = card->dacArmed && card->dacEnabled[adc] && !wfm.empty();
+	uint16_t flip = (card->initialised && !card->autoTraining) ? (uint16_t)(g_sim.tapErrors << 2) : 0;
+	uint64_t n = card->adcClock[adc];
+
+	for(uint32_t i = 0; i < count; i++, n++) {
+		uint16_t sample;
+		if(card->patternMode) {
+			sample = (uint16_t)((n & 0x3fff) << 2);
+		}
+		else {
+			int32_t v = loopback ? wfm[n % wfm.size()] / 2 : 0;
+			if(g_sim.noise)
+				v += (int32_t)(SimRandom() % (8 * g_sim.noise + 4)) - 4 * g_sim.noise;
+			if(v > 32767) v = 32767;
+			if(v < -32768) v = -32768;
+			sample = (uint16_t)v & 0xfffc;
+		}
+		// failing data lines toggle on every other sample
+		if(n & 1)
+			sample ^= flip;
+		out[i] = sample;
+	}
+	card->adcClock[adc] = n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// sipif
+
+int32_t sipif_getdeviceenumeration(int32_t display)
+{
+	if(display)
+		printf(" {0} Simulated FMC15x constellation\n");
+	return SIPIF_ERR_OK;
+}
+
+int32_t sipif_init(int32_t ifType, const char *devType, int32_t devIdx, int32_t timeout, int32_t m, int32_t n, char *fpga)
+{
+	// the constellation comes from FMC15X_SIM_CONSTELLATION, the interface arguments select nothing
+	(void)ifType;
+	(void)devType;
+	(void)devIdx;
+	(void)timeout;
+	(void)m;
+	(void)n;
+	std::lock_guard<std::mutex> guard(g_simLock);
+
+	const char *name = getenv("FMC15X_SIM_CONSTELLATION");
+	if(!name || !*name)
+		name = "kc705";
+	int32_t found = -1;
+	for(size_t i = 0; i < sizeof(g_simConstellations) / sizeof(g_simConstellations[0]); i++) {
+		if(!strcmp(name, g_simConstellations[i].name))
+			found = (int32_t)i;
+	}
+	if(found < 0) {
+		printf("sipif_init() -> Unknown simulated constellation '%s'\n", name);
+		return -1;
+	}
+
+	g_sim.open = true;
+	g_sim.constellationId = g_simConstellations[found].id;
+	g_sim.nbrCards = g_simConstellations[found].nbrCards;
+	g_sim.fpga = getenv("FMC15X_SIM_FPGA");
+	if(!g_sim.fpga || !*g_sim.fpga)
+		g_sim.fpga = "XC7K325T-2FFG900C";
+	g_sim.latency = SimEnv("FMC15X_SIM_LATENCY_US", 100) * 1e-6;
+	g_sim.bandwidth = SimEnv("FMC15X_SIM_BANDWIDTH_MBPS", 100) * 1e6;
+	g_sim.vcxo = SimEnv("FMC15X_SIM_VCXO_MHZ", 491.52);
+	g_sim.noise = (int32_t)SimEnv("FMC15X_SIM_NOISE_LSB", 2);
+	g_sim.tapErrors = (uint16_t)strtoul(getenv("FMC15X_SIM_TAP_ERRORS") ? getenv("FMC15X_SIM_TAP_ERRORS") : "0", NULL, 0) & 0x3fff;
+	g_sim.verbose = getenv("FMC15X_SIM_VERBOSE") != NULL;
+	g_sim.routerS1D3 = g_sim.routerS3D1 = ~(uint64_t)0;
+	g_sim.fifoArmed = false;
+	g_sim.regs.clear();
+	for(int32_t i = 0; i < SIM_MAX_CARDS; i++) {
+		SimCard &card = g_sim.card[i];
+		card.initialised = card.autoTraining = card.patternMode = card.dacArmed = false;
+		card.nbrBurst = 1;
+		card.burstSize = 0;
+		card.adcEnabled[0] = card.adcEnabled[1] = card.dacEnabled[0] = card.dacEnabled[1] = false;
+		card.wfmTarget = -1;
+		card.wfm[0].clear();
+		card.wfm[1].clear();
+		card.fifoSamples[0] = card.fifoSamples[1] = 0;
+		card.adcClock[0] = card.adcClock[1] = 0;
+		card.sampleClock = 0;
+	}
+	g_sim.random = 0x2545F491;
+	g_sim.accesses = g_sim.batches = g_sim.bytesWritten = g_sim.bytesRead = 0;
+	g_sim.linkBusy = 0;
+	g_simLinkFree = std::chrono::steady_clock::now();
+
+	strcpy(fpga, g_sim.fpga);
+	SimAccess(1);
+	return SIPIF_ERR_OK;
+}
+
+int32_t sipif_free(void)
+{
+	std::lock_guard<std::mutex> guard(g_simLock);
+	if(g_sim.open && g_sim.verbose) {
+		printf("Simulated link: %llu register accesses ( %llu batches ), %llu bytes written, %llu bytes read, busy %.3f s\n",
+			(unsigned long long)g_sim.accesses, (unsigned long long)g_sim.batches, (unsigned long long)g_sim.bytesWritten,
+			(unsigned long long)g_sim.bytesRead, g_sim.linkBusy);
+	}
+	g_sim.open = false;
+	for(int32_t i = 0; i < SIM_MAX_CARDS; i++) {
+		g_sim.card[i].wfm[0].clear();
+		g_sim.card[i].wfm[1].clear();
+	}
+	return SIPIF_ERR_OK;
+}
+
+int32_t sipif_getsipcmdfreq(float *freq)
+{
+	if(!g_sim.open)
+		return -1;
+	SimAccess(1);
+	*freq = 125.0f;
+	return SIPIF_ERR_OK;
+}
+
+int32_t sipif_writesipreg(uint32_t addr, uint32_t value)
+{
+	if(!g_sim.open)
+		return -1;
+	SimAccess(1);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.regs[addr] = value;
+	return SIPIF_ERR_OK;
+}
+
+int32_t sipif_readsipreg(uint32_t addr, uint32_t *value)
+{
+	if(!g_sim.open)
+		return -1;
+	SimAccess(1);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	std::map<uint32_t, uint32_t>::iterator it = g_sim.regs.find(addr);
+	*value = (it == g_sim.regs.end()) ? 0 : it->second;
+	return SIPIF_ERR_OK;
+}
+
+/**
+*  Waveform upload: the data goes to the DAC memory prepared by fmc15x_ctrl_prepare_wfm_load() when the S1D3 router
+*  points to it ( byte 2*card + dac of the setting cleared ).
+*/
+int32_t sipif_writedata(void *buf, uint32_t size)
+{
+	if(!g_sim.open)
+		return -1;
+	SimLinkTransfer(size);
+
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.bytesWritten += size;
+	for(int32_t i = 0; i < g_sim.nbrCards; i++) {
+		SimCard &card = g_sim.card[i];
+		if(card.wfmTarget < 0 || ((g_sim.routerS1D3 >> (16 * i + 8 * card.wfmTarget)) & 0xff) != 0)
+			continue;
+		card.wfm[card.wfmTarget].assign((const int16_t *)buf, (const int16_t *)buf + size / 2);
+		card.wfmTarget = -1;
+		return SIPIF_ERR_OK;
+	}
+	printf("sipif_writedata() -> No waveform memory is waiting for data\n");
+	return -1;
+}
+
+/**
+*  ADC read: the data comes from the ADC selected by the low byte of the S3D1 router setting ( 2*card + adc ).
+*/
+int32_t sipif_readdata(void *buf, uint32_t size)
+{
+	if(!g_sim.open)
+		return -1;
+	{
+		std::lock_guard<std::mutex> guard(g_simLock);
+		uint32_t sel = (uint32_t)(g_sim.routerS3D1 & 0xff);
+		int32_t cardIdx = sel / 2, adc = sel % 2;
+		if(cardIdx >= g_sim.nbrCards) {
+			printf("sipif_readdata() -> S3D1 router does not select an ADC\n");
+			return -1;
+		}
+		SimCard &card = g_sim.card[cardIdx];
+		uint32_t count = size / 2;
+		if(!card.adcEnabled[adc] || card.fifoSamples[adc] < count) {
+			printf("sipif_readdata() -> Timeout, ADC%d of card %d holds %llu samples\n", adc, cardIdx,
+				(unsigned long long)(card.adcEnabled[adc] ? card.fifoSamples[adc] : 0));
+			return -1;
+		}
+		SimFillAdc(&card, adc, (uint16_t *)buf, count);
+		card.fifoSamples[adc] -= count;
+		g_sim.bytesRead += size;
+	}
+	SimLinkTransfer(size);
+	return SIPIF_ERR_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// cid
+
+/**
+*  @return number of stars in the constellation table, or -1 when the device is not open
+*/
+int32_t cid_init(int32_t)
+{
+	if(!g_sim.open)
+		return -1;
+	SimAccess(4);
+	return cid_getnbrstar();
+}
+
+uint16_t cid_getconstellationid(void)
+{
+	return g_sim.constellationId;
+}
+
+int32_t cid_getnbrstar(void)
+{
+	return 16;
+}
+
+uint32_t cid_getswbuildcode(void)
+{
+	return 0x51400000;
+}
+
+uint32_t cid_getfwbuildcode(void)
+{
+	return 0x51400000;
+}
+
+uint32_t cid_getfirmwareversion(void)
+{
+	return 0x00010000;
+}
+
+/**
+*  Every star gets a SIM_STAR_SIZE window at star ID * SIM_STAR_SIZE, which lets the peripherals find their card
+*  from their address.
+*/
+int32_t cid_getstaroffset(uint32_t id, uint32_t *addr, uint32_t *size)
+{
+	if(!g_sim.open)
+		return -1;
+	*addr = id * SIM_STAR_SIZE;
+	*size = SIM_STAR_SIZE;
+	return SIP_CID_ERR_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// sxdx / ctgen / memfifo
+
+/**
+*  Routers are told apart by the star ID of their address: S1D3/S1D5 carry the DAC data, S3D1/S5D1 the ADC data.
+*/
+int32_t sxdx_configurerouter(uint32_t addr, uint64_t setting)
+{
+	if(!g_sim.open)
+		return -1;
+	SimAccess(2);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	uint32_t star = addr / SIM_STAR_SIZE;
+	if(star == 0x12 || star == 0x13)
+		g_sim.routerS1D3 = setting;
+	else
+		g_sim.routerS3D1 = setting;
+	return SXDXROUTER_ERR_OK;
+}
+
+int32_t ctgen_configure(uint32_t, int32_t)
+{
+	if(!g_sim.open)
+		return -1;
+	SimAccess(2);
+	return CTGEN_ERR_OK;
+}
+
+int32_t memfifo_configure(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t arm)
+{
+	if(!g_sim.open)
+		return -1;
+	SimAccess(4);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.fifoArmed = (arm == FIFO_ARMED);
+	return MEMFIFO_ERR_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// fmc15x
+
+int32_t fmc15x_ctrl_probefmc(uint32_t addr)
+{
+	SimAccess(1);
+	return SimCardFromAddr(addr) < 0 ? -1 : FMC15x_ERR_OK;
+}
+
+int32_t fmc15x_monitor_getdiags(uint32_t addr)
+{
+	if(SimCardFromAddr(addr) < 0)
+		return -1;
+	SimAccess(8);
+	printf("Temperature     : 41.00 C\n");
+	printf("3.3V            : 3.30 V\n");
+	printf("2.5V            : 2.50 V\n");
+	printf("1.8V            : 1.80 V\n");
+	return FMC15x_MON_ERR_OK;
+}
+
+int32_t fmc15x_freqcnt_getfrequency(uint32_t addr, int32_t id, float *freq, int32_t display, int32_t, float)
+{
+	static const char *names[SIM_NBR_FREQ] = { "ADC0 clock", "ADC1 clock", "DAC clock", "DAC data", "External trigger",
+		"Reference clock", "DAC reference clock" };
+
+	if(SimCardFromAddr(addr) < 0 || id < 0 || id >= SIM_NBR_FREQ)
+		return -1;
+	SimAccess(2);
+	double f[SIM_NBR_FREQ] = { g_sim.vcxo / 2, g_sim.vcxo / 2, g_sim.vcxo / 2, g_sim.vcxo / 4, 0, 100, g_sim.vcxo / 2 };
+	if(freq)
+		*freq = (float)f[id];
+	if(display == FMC15x_FREQCNT_DISPLAY_CONSOLE)
+		printf("Frequency id%d (%-20s): %7.2f MHz\n", id, names[id], f[id]);
+	return FMC15x_FREQCNT_ERR_OK;
+}
+
+int32_t fmc15x_init(uint32_t, uint32_t, uint32_t, uint32_t adcSpi, uint32_t, uint32_t, int32_t, int32_t, uint8_t, uint8_t, uint32_t, uint16_t,
+					int32_t auto_training)
+{
+	int32_t idx = SimCardFromAddr(adcSpi);
+	if(idx < 0)
+		return -1;
+	SimAccess(SIM_INIT_ACCESSES + (auto_training ? SIM_TRAINING_ACCESSES : 0));
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.card[idx].initialised = true;
+	g_sim.card[idx].autoTraining = auto_training != 0;
+	return FMC15x_ERR_OK;
+}
+
+int32_t fmc15x_ctrl_configure_burst(uint32_t addr, uint32_t nbr, uint32_t size)
+{
+	int32_t idx = SimCardFromAddr(addr);
+	if(idx < 0)
+		return -1;
+	SimAccess(2);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.card[idx].nbrBurst = nbr;
+	g_sim.card[idx].burstSize = size;
+	return FMC15x_CTRL_ERR_OK;
+}
+
+int32_t fmc151_configure_dc_offset(uint32_t addr, uint16_t, uint16_t, uint16_t, uint16_t, int32_t)
+{
+	if(SimCardFromAddr(addr) < 0)
+		return -1;
+	SimAccess(4);
+	return FMC15x_ERR_OK;
+}
+
+int32_t fmc15x_ctrl_prepare_wfm_load(uint32_t addr, int32_t dac)
+{
+	int32_t idx = SimCardFromAddr(addr);
+	if(idx < 0 || (dac != DAC0 && dac != DAC1))
+		return -1;
+	SimAccess(1);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.card[idx].wfmTarget = (dac == DAC0) ? 0 : 1;
+	return FMC15x_CTRL_ERR_OK;
+}
+
+int32_t fmc15x_adc_pattern_check(uint32_t addr, bool enable)
+{
+	int32_t idx = SimCardFromAddr(addr);
+	if(idx < 0)
+		return -1;
+	SimAccess(2);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.card[idx].patternMode = enable;
+	return FMC15x_ADC_ERR_OK;
+}
+
+int32_t fmc15x_ctrl_enable_channel(uint32_t addr, int32_t adc0, int32_t adc1, int32_t dac0, int32_t dac1)
+{
+	int32_t idx = SimCardFromAddr(addr);
+	if(idx < 0)
+		return -1;
+	SimAccess(1);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	SimCard &card = g_sim.card[idx];
+	card.adcEnabled[0] = adc0 == ENABLED;
+	card.adcEnabled[1] = adc1 == ENABLED;
+	card.dacEnabled[0] = dac0 == ENABLED;
+	card.dacEnabled[1] = dac1 == ENABLED;
+	return FMC15x_CTRL_ERR_OK;
+}
+
+int32_t fmc15x_ctrl_arm_dac(uint32_t addr)
+{
+	int32_t idx = SimCardFromAddr(addr);
+	if(idx < 0)
+		return -1;
+	SimAccess(1);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	g_sim.card[idx].dacArmed = true;
+	return FMC15x_CTRL_ERR_OK;
+}
+
+/**
+*  Software trigger: every enabled ADC fills its FIFO with nbrBurst bursts, unlimited when nbrBurst is 0. The ADCs
+*  enabled together sample the same instants.
+*/
+int32_t fmc15x_ctrl_sw_trigger(uint32_t addr)
+{
+	int32_t idx = SimCardFromAddr(addr);
+	if(idx < 0)
+		return -1;
+	SimAccess(1);
+	std::lock_guard<std::mutex> guard(g_simLock);
+	SimCard &card = g_sim.card[idx];
+	uint64_t length = card.nbrBurst ? (uint64_t)card.nbrBurst * card.burstSize : ~(uint64_t)0;
+	for(int32_t adc = 0; adc < 2; adc++) {
+		if(card.adcEnabled[adc]) {
+			card.fifoSamples[adc] = length;
+			card.adcClock[adc] = card.sampleClock;
+		}
+	}
+	card.sampleClock += card.nbrBurst ? length : 0;
+	return FMC15x_CTRL_ERR_OK;
+}
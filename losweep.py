@@ -0,0 +1,207 @@
+import argparse
+import os
+import socket
+import sys
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+import serial
+
+from capfile import read_capture
+
+
+# QuickSyn FSL-0010 on its serial port, same commands as Control_QuickSyn.py
+class QuickSyn:
+    def __init__(self, port, timeout=0.2):
+        self.ser = serial.Serial(port, baudrate=115200, timeout=timeout)
+
+    def set_frequency(self, frequency):
+        self.ser.write(f":FREQ {frequency:.0f}Hz\n".encode())
+
+    # One :FREQ? readback in Hz, None when the synthesizer did not answer in time
+    def get_frequency(self):
+        self.ser.write(b":FREQ?\n")
+        response = self.ser.readline().decode().strip()
+        try:
+            return float(response)
+        except ValueError:
+            return None
+
+    # Poll :FREQ? until `stable` consecutive readbacks are within tolerance of the target, instead of sleeping
+    # a fixed time after every write. Returns the last readback and the time it took to settle.
+    def wait_settled(self, frequency, tolerance, timeout, stable=2):
+        start = time.monotonic()
+        hits = 0
+        readback = None
+        while time.monotonic() - start < timeout:
+            readback = self.get_frequency()
+            if readback is not None and abs(readback - frequency) <= tolerance:
+                hits += 1
+                if hits >= stable:
+                    return readback, time.monotonic() - start
+            else:
+                hits = 0
+        raise TimeoutError(f"QuickSyn did not settle on {frequency:.0f} Hz, last readback {readback}")
+
+    def set_output(self, enable):
+        self.ser.write(f":OUTP:STAT {1 if enable else 0}\n".encode())
+
+    def close(self):
+        self.ser.close()
+
+
+# Pseudo-terminal standing in for the QuickSyn, so that sweeps can be run without the synthesizer.
+# It answers :FREQ, :FREQ? and :OUTP:STAT, and the readback only reaches a new frequency after settle_time.
+class QuickSynStandIn:
+    def __init__(self, frequency=9.0e9, settle_time=0.05):
+        import tty  # POSIX only, like the service mode of main.cpp
+        self.master, self.slave = os.openpty()
+        tty.setraw(self.slave)
+        self.port = os.ttyname(self.slave)
+        self.settle_time = settle_time
+        self.previous = self.target = frequency
+        self.changed = 0.0
+        self.output = False
+        threading.Thread(target=self._serve, daemon=True).start()
+
+    def _readback(self):
+        elapsed = time.monotonic() - self.changed
+        if elapsed >= self.settle_time:
+            return self.target
+        # still pulling in, report a frequency part way to the target
+        return self.previous + (self.target - self.previous) * elapsed / self.settle_time
+
+    def _serve(self):
+        pending = b''
+        while True:
+            try:
+                data = os.read(self.master, 256)
+            except OSError:
+                return
+            if not data:
+                return
+            pending += data
+            while b'\n' in pending:
+                line, pending = pending.split(b'\n', 1)
+                command = line.decode().strip()
+                if command == ':FREQ?':
+                    os.write(self.master, f"{self._readback():.3f}\n".encode())
+                elif command.startswith(':FREQ '):
+                    value = command[6:].strip()
+                    if value.lower().endswith('hz'):
+                        value = value[:-2]
+                    self.previous = self._readback()
+                    self.target = float(value)
+                    self.changed = time.monotonic()
+                elif command.startswith(':OUTP:STAT'):
+                    self.output = command.split()[-1] == '1'
+
+    def close(self):
+        os.close(self.master)
+        os.close(self.slave)
+
+
+# Client of the main.cpp service mode (--serve), one reply line per command
+class CaptureService:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.stream = self.sock.makefile('rw')
+
+    # Send a command and return the words of the OK reply, the file names for capture and trigger
+    def command(self, line):
+        self.stream.write(line + '\n')
+        self.stream.flush()
+        reply = self.stream.readline().strip()
+        if not reply.startswith('OK'):
+            raise RuntimeError(f"'{line}' -> {reply}")
+        return reply.split()[1:]
+
+    def close(self):
+        self.sock.close()
+
+
+# Strongest tone of the first burst of an ADC capture file, frequency in Hz (interpolated between FFT bins)
+# and level in dBFS. ADC0 is used for ADC0/ADC1 pair files.
+def analyse_capture(filename):
+    header, samples = read_capture(filename)
+    burst = samples[0, :, 0] if samples.ndim == 3 else samples[0]
+    burst = burst.astype(np.float64)
+    burst -= burst.mean()
+    window = np.hanning(len(burst))
+    magnitude = np.abs(np.fft.rfft(burst * window)) * 2 / window.sum()
+    k = int(np.argmax(magnitude[1:-1])) + 1
+    # parabolic interpolation of the peak on the log magnitude
+    a, b, c = np.log(magnitude[k - 1:k + 2] + 1e-12)
+    offset = 0.5 * (a - c) / (a - 2 * b + c) if a - 2 * b + c != 0 else 0.0
+    level = 20 * np.log10(np.exp(b - 0.25 * (a - c) * offset) / 32768)
+    return (k + offset) * header['sampleRate'] / len(burst), level
+
+
+# Step the synthesizer through the frequency list and capture at every step. While the service writes the files
+# of a step, the synthesizer is already moving to the next frequency, and the files are analysed in a worker
+# thread while the next step settles and captures.
+def run_sweep(synth, service, frequencies, prefix, tolerance, settle_timeout, directory):
+    def analyse(lo, readback, settle, names):
+        peak, level = analyse_capture(os.path.join(directory, names[0] + '.cap'))
+        return lo, readback, settle, peak, level
+
+    pending = []
+    with ThreadPoolExecutor(max_workers=1) as pool:
+        synth.set_frequency(frequencies[0])
+        for i, lo in enumerate(frequencies):
+            readback, settle = synth.wait_settled(lo, tolerance, settle_timeout)
+            names = service.command(f"trigger {prefix}{i:04d}_")
+            if i + 1 < len(frequencies):
+                synth.set_frequency(frequencies[i + 1])
+            service.command("flush")
+            pending.append(pool.submit(analyse, lo, readback, settle, names))
+        return [p.result() for p in pending]
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Sweep the QuickSyn LO and capture with main.cpp running with --serve')
+    parser.add_argument('--port', default='/dev/ttyUSB0', help='QuickSyn serial port')
+    parser.add_argument('--simulate', action='store_true', help='use a pseudo-terminal stand-in instead of the QuickSyn')
+    parser.add_argument('--socket', default='fmc15x.sock', help='socket of the main.cpp service mode')
+    parser.add_argument('--dir', default='.', help='working directory of the service, where the captures are written')
+    parser.add_argument('--start', type=float, default=8.0e9, help='first LO frequency in Hz')
+    parser.add_argument('--stop', type=float, default=9.0e9, help='last LO frequency in Hz')
+    parser.add_argument('--step', type=float, default=100e6, help='LO frequency step in Hz')
+    parser.add_argument('--list', help='file with one LO frequency in Hz per line, replaces --start/--stop/--step')
+    parser.add_argument('--tolerance', type=float, default=1e3, help='readback tolerance in Hz')
+    parser.add_argument('--settle-timeout', type=float, default=2.0, help='time allowed for a step to settle in s')
+    parser.add_argument('--prefix', default='lo', help='file name prefix of the captures')
+    parser.add_argument('--out', default='losweep.csv', help='results: LO, readback, settle time, peak frequency, peak dBFS')
+    args = parser.parse_args()
+
+    if args.list:
+        with open(args.list) as f:
+            frequencies = [float(line) for line in f if line.strip()]
+    else:
+        frequencies = list(np.arange(args.start, args.stop + args.step / 2, args.step))
+    if not frequencies:
+        sys.exit("Empty frequency list")
+
+    standin = QuickSynStandIn() if args.simulate else None
+    synth = QuickSyn(standin.port if standin else args.port)
+    service = CaptureService(args.socket)
+    synth.set_output(True)
+    start = time.monotonic()
+    try:
+        results = run_sweep(synth, service, frequencies, args.prefix, args.tolerance, args.settle_timeout, args.dir)
+    finally:
+        synth.set_output(False)
+        synth.close()
+        service.close()
+        if standin:
+            standin.close()
+    elapsed = time.monotonic() - start
+
+    with open(args.out, 'w') as f:
+        for lo, readback, settle, peak, level in results:
+            f.write(f"{lo:.0f},{readback:.3f},{settle:.4f},{peak:.1f},{level:.2f}\n")
+            print(f"LO {lo / 1e9:.6f} GHz settled in {settle * 1e3:6.1f} ms, peak {peak / 1e6:10.4f} MHz at {level:7.2f} dBFS")
+    print(f"{len(results)} steps in {elapsed:.2f} s, results in {args.out}")
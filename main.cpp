@@ -11,11 +11,32 @@
 #include <math.h>
 #include <stdint.h>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FMC_HAVE_AVX2
+#define FMC_HAVE_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FMC_HAVE_SSE2
+#endif
 
 #if defined WIN32
 
 // Include declarations for _aligned_malloc and _aligned_free 
 #include <malloc.h>
+// keep windows.h from defining the min and max macros, they break std::min and std::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <windows.h>
 #else
 #include <unistd.h>
@@ -47,6 +68,27 @@ static void DeleteFile(const char *filename)
 
 #define Sleep(x)	(usleep((unsigned long long)(5 * x * 1000)))
 
+// locked huge page buffer pool
+#include <sys/mman.h>
+
+// direct I/O capture writer
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define FMC_HAVE_IO_URING
+#endif
+#endif
+
+// service mode socket
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #endif
 
 // project includes
@@ -79,16 +121,397 @@ static void DeleteFile(const char *filename)
 #define DC_WAVE		2						/*!< GenerateWaveform() generates dc wave */
 #define PULSES		3						/*!< GenerateWaveform() generates  pulses */
 #define SQUARE_WAVE 4
+#define CHIRP_LINEAR		5				/*!< GenerateChirp16() generates a linear frequency sweep */
+#define CHIRP_EXPONENTIAL	6				/*!< GenerateChirp16() generates an exponential frequency sweep */
 
 #define SYNTH_M			250					/*!< Reference value for M on the synthesizer frequency (f = M/N) */
 #define SYNTH_N			2					/*!< Reference value for N on the synthesizer frequency (f = M/N) */
 #define ASCII			0					/*!< Save16BitArrayToFile() saves the samples as ASCII */
 #define BINARY			1					/*!< Save16BitArrayToFile() saves the samples as binary */
+#define MAX_ASCII_SAMPLE_SIZE	7			/*!< longest ASCII sample rendering: "-32768\n" */
 #define TIMEOUTDMA		2000				/*!< DMA tiemout is 2 seconds (2000 ms) */
 
 #define FPGATYPE_160T	0					/*!< FPGA type when 160t is 0 */
 #define FPGATYPE_410T	1					/*!< FPGA type when 410t is 1 */
 
+#define DDS_LUT_BITS			12			/*!< log2 of the number of entries in the waveform engine sine table */
+#define DDS_LUT_SIZE			(1u << DDS_LUT_BITS)	/*!< number of entries in the waveform engine sine table */
+#define WFM_MAX_THREADS			16			/*!< maximum number of threads used to generate a waveform */
+#define WFM_PARALLEL_MIN_SAMPLES	(256 * 1024)	/*!< waveforms shorter than this are generated by a single thread */
+#define WFM_MAX_TONES			16			/*!< maximum number of tones in a multi-tone waveform */
+#define WFM_BLOCK_SIZE			1024		/*!< samples accumulated at once by the multi-tone generator */
+#define PLAN_SEARCH_SPAN		4			/*!< period counts tried on each side of the nearest one by the waveform planner */
+#define PLAN_CACHE_FILE			"wfmplan.cache"	/*!< waveform plans kept across runs */
+#define PLAN_CACHE_RATE_STEP	10e3		/*!< sample rate granularity (Hz) of the waveform plan cache */
+#define PLAN_CACHE_VERSION		1			/*!< format and planner version of PLAN_CACHE_FILE, bump when PlanCoherentFrequency() changes */
+#define PLAN_CACHE_MAX_ENTRIES	1024		/*!< plans kept in PLAN_CACHE_FILE, the oldest ones are dropped first */
+
+#define ADC_DATA_BITS			14			/*!< ADC resolution, samples are 16 bit aligned ( left justified ) */
+#define ADC_DATA_MASK			0x3fff		/*!< mask of the ADC data once shifted right by two */
+#define SAMPLE_RATE				245e6		/*!< nominal ADC/DAC sample rate (Hz), used when the DAC clock cannot be measured */
+#define ADC_FULL_SCALE_DBM		10.0		/*!< default power (dBm) of a full scale sine at the ADC input, 2 Vpp into 50 ohm */
+#define MAX_REPORTED_PEAKS		16			/*!< maximum number of spectrum peaks reported per burst */
+#define PEAK_DEFAULT_PROMINENCE	10.0f		/*!< default minimum peak prominence (dB), as used with find_peaks() by the analysis scripts */
+#define PEAK_LOG_FILE			"peaks.csv"	/*!< burst name, channel, rank, frequency (Hz), dBm and prominence (dB) of every reported peak */
+#define WELCH_DEFAULT_OVERLAP	50			/*!< default overlap (%) of the segments of an averaged spectrum */
+#define NBR_RING_SLOTS_MAX		16			/*!< maximum number of buffers in a SampleRing */
+#define BUFFER_POOL_DEFAULT_MB	64			/*!< default size (MiB) of the sample buffer pool, see --buffer-pool */
+#define HUGE_PAGE_SIZE			(2u << 20)	/*!< size of the huge pages backing the sample buffer pool */
+#define NBR_STREAM_SLOTS		8			/*!< number of buffers in flight between sipif_readdata() and the disk in streaming mode */
+#define STREAM_BURSTS_PER_SLOT	64			/*!< number of bursts transferred by a single sipif_readdata() call in streaming mode */
+#define TRAINING_CACHE_FILE		"training.cache"	/*!< cards that pass the ramp pattern check without IODELAY auto training, kept across runs */
+#define NBR_SAVE_SLOTS			3			/*!< number of burst buffers shared between the acquisition loop and the file writer */
+#define BURST_SET_FIRST			0x01		/*!< first burst of an averaged set, the averages restart */
+#define BURST_SET_LAST			0x02		/*!< last burst of an averaged set, the files are written and the averages saved */
+#define SIP_TRANSACTION_MAX_OPS	16			/*!< maximum number of register operations queued in a SipTransaction */
+#define SERVE_SOCKET_PATH		"fmc15x.sock"	/*!< default Unix domain socket of the service mode */
+#define SERVE_LINE_MAX			1024		/*!< longest command accepted by the service mode */
+#define SERVE_PREFIX_MAX		32			/*!< longest file name prefix accepted by the service mode */
+#define SERVE_SWEEP_MAX_STEPS	10000		/*!< maximum number of steps of a service mode sweep */
+
+#define CAPTURE_FILE_MAGIC		"FMC15XCP"	/*!< first 8 bytes of a capture file */
+#define CAPTURE_FILE_VERSION	1			/*!< version of the capture file layout */
+#define CAPTURE_PAGE_SIZE		4096		/*!< capture file header size and burst block alignment */
+#define CAPTURE_FORMAT_INT16	0			/*!< capture file samples are int16 */
+#define CAPTURE_FORMAT_INT16_PAIRS	1		/*!< capture file samples are int16 ADC0/ADC1 pairs taken on the same trigger */
+#define CAPTURE_FORMAT_DELTA	2			/*!< capture file holds chunks of delta coded int16 samples, see DeltaCodec_Encode() */
+#define CAPTURE_FORMAT_DELTA_PAIRS	3		/*!< same as CAPTURE_FORMAT_DELTA for ADC0/ADC1 pairs, ADC0 then ADC1 in every burst */
+#define CAPTURE_FORMAT_PACKED14	4			/*!< capture file samples are packed on 14 bits, 8 samples in 14 bytes, see Packed14_Pack() */
+#define CAPTURE_FORMAT_PACKED14_PAIRS	5	/*!< same as CAPTURE_FORMAT_PACKED14 for ADC0/ADC1 pairs */
+#define CODEC_BLOCK_SAMPLES		128			/*!< samples per block of the delta codec */
+#define CODEC_BLOCK_SHIFTED		0x80		/*!< block header flag: the two unused low bits of the samples are not stored */
+#define CAPTURE_CHANNEL_ADC0	0			/*!< capture file holds ADC0 samples */
+#define CAPTURE_CHANNEL_ADC1	1			/*!< capture file holds ADC1 samples */
+#define CAPTURE_CHANNEL_DAC0	2			/*!< capture file holds the DAC0 waveform */
+#define CAPTURE_CHANNEL_DAC1	3			/*!< capture file holds the DAC1 waveform */
+#define CAPTURE_CHANNEL_ADC01	4			/*!< capture file holds interleaved ADC0/ADC1 samples */
+#define WRITE_QUEUE_DEFAULT_DEPTH	4		/*!< default number of streaming writes in flight, see --write-queue */
+
+#define DUAL_ADC_OFF			0			/*!< ADC0 and ADC1 are captured on separate triggers */
+#define DUAL_ADC_PLANAR			1			/*!< ADC0 and ADC1 are captured on one trigger and saved as two files */
+#define DUAL_ADC_INTERLEAVED	2			/*!< ADC0 and ADC1 are captured on one trigger and saved as sample pairs */
+
+/**
+*  Sine lookup table used by the phase accumulator waveform engine. Entry DDS_LUT_SIZE duplicates entry 0 so linear
+*  interpolation never needs to wrap. Built on first use.
+*
+*  @return pointer to DDS_LUT_SIZE+1 samples of one sine period
+*/
+static const float *GetDdsSineTable(void)
+{
+	static float table[DDS_LUT_SIZE + 1];
+	static std::once_flag built;
+
+	std::call_once(built, [] {
+		for(uint32_t i = 0; i <= DDS_LUT_SIZE; i++)
+			table[i] = (float)sin(2.0 * 3.14159265358979323846 * i / DDS_LUT_SIZE);
+	});
+	return table;
+}
+
+/**
+*  Phase increment per sample for a phase accumulator running at SAMPLE_RATE. The top 32 bits of the 64 bit
+*  accumulator are the phase, one full turn being 2^64.
+*
+*  @param cycles	number of signal periods per numbersamples samples ( may be fractional )
+*  @param numbersamples	number of samples cycles periods span
+*  @return phase increment
+*/
+static uint64_t DdsTuningWord(double cycles, uint32_t numbersamples)
+{
+	double turns = cycles / numbersamples;
+	turns -= floor(turns);
+	// 2^64 does not fit a uint64_t, scale in two steps to keep the full precision
+	double hi = floor(turns * 4294967296.0);
+	double lo = (turns * 4294967296.0 - hi) * 4294967296.0;
+	return ((uint64_t)hi << 32) + (uint64_t)lo;
+}
+
+/**
+*  Interpolated sine of a 64 bit phase ( one full turn is 2^64 ).
+*
+*  @param table	table returned by GetDdsSineTable()
+*  @param phase	phase
+*  @return sine value between -1 and 1
+*/
+static inline float DdsSineAt(const float *table, uint64_t phase)
+{
+	const float scale = 1.0f / (float)(1u << (32 - DDS_LUT_BITS));
+	uint32_t index = (uint32_t)(phase >> (64 - DDS_LUT_BITS));
+	float frac = (float)((uint32_t)(phase >> 32) & ((1u << (32 - DDS_LUT_BITS)) - 1)) * scale;
+	return table[index] + frac * (table[index + 1] - table[index]);
+}
+
+/**
+*  Convert a phase expressed in turns to the 64 bit phase used by DdsSineAt().
+*/
+static inline uint64_t DdsPhaseFromTurns(double turns)
+{
+	turns -= floor(turns);
+	return (uint64_t)(turns * 4294967296.0) << 32;
+}
+
+/**
+*  Split the generation of a buffer across the available processors. Small buffers are generated by the
+*  calling thread.
+*
+*  @param numbersamples	number of samples to generate
+*  @param generate	function generating count samples starting at sample start
+*/
+template <typename Generator>
+static void ParallelGenerate(uint32_t numbersamples, Generator generate)
+{
+	uint32_t nbrThreads = std::thread::hardware_concurrency();
+	if(nbrThreads > WFM_MAX_THREADS)
+		nbrThreads = WFM_MAX_THREADS;
+	if(numbersamples < WFM_PARALLEL_MIN_SAMPLES || nbrThreads < 2) {
+		generate((uint32_t)0, numbersamples);
+		return;
+	}
+
+	// segments are kept a multiple of 64 samples so two threads never share a cache line
+	uint32_t segment = ((numbersamples + nbrThreads - 1) / nbrThreads + 63) & ~63u;
+	std::vector<std::thread> workers;
+	for(uint32_t start = segment; start < numbersamples; start += segment) {
+		uint32_t count = (numbersamples - start < segment) ? numbersamples - start : segment;
+		workers.push_back(std::thread(generate, start, count));
+	}
+	generate((uint32_t)0, segment < numbersamples ? segment : numbersamples);
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+/**
+*  Generate a sine wave with a phase accumulator and an interpolated lookup table.
+*
+*  @param buffer	destination buffer of numbersamples samples
+*  @param numbersamples	number of samples to generate
+*  @param phase	phase of the first sample ( one full turn is 2^64 )
+*  @param tuningWord	phase increment per sample, see DdsTuningWord()
+*  @param ampl	peak amplitude in DAC codes
+*/
+static void GenerateSine16(uint16_t *buffer, uint32_t numbersamples, uint64_t phase, uint64_t tuningWord, int32_t ampl)
+{
+	const float *table = GetDdsSineTable();
+
+	ParallelGenerate(numbersamples, [=](uint32_t start, uint32_t count) {
+		uint64_t p = phase + tuningWord * start;
+		for(uint32_t i = start; i < start + count; i++) {
+			// truncate toward zero like the former sin() based implementation
+			buffer[i] = (uint16_t)(int32_t)(DdsSineAt(table, p) * ampl);
+			p += tuningWord;
+		}
+	});
+}
+
+/**
+*  Coherent waveform plan: a buffer length and a whole number of signal periods in that buffer, so that the
+*  waveform memory can be replayed without a phase discontinuity.
+*/
+typedef struct {
+	double targetFreq;						/*!< requested frequency in Hz */
+	double sampleRate;						/*!< DAC sample rate the plan was computed for, in Hz */
+	uint32_t numbersamples;					/*!< selected buffer length in samples */
+	uint32_t cycles;						/*!< number of signal periods in the buffer */
+	double actualFreq;						/*!< generated frequency, cycles*sampleRate/numbersamples */
+	uint32_t distinctPhases;				/*!< number of distinct sample phases, numbersamples/gcd(cycles, numbersamples) */
+} WaveformPlan;
+
+static uint32_t Gcd32(uint32_t a, uint32_t b)
+{
+	while(b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/**
+*  Choose the buffer length and number of periods best matching a target frequency.
+*
+*  For every allowed buffer length the period counts closest to the target are considered. Counts sharing no
+*  factor with the buffer length are preferred: every sample then falls on a different phase, which spreads the
+*  DAC quantization error over the whole spectrum instead of concentrating it in harmonic spurs. Among those,
+*  the smallest frequency error wins, then the longest buffer.
+*
+*  @param targetFreq	requested frequency in Hz
+*  @param sampleRate	DAC sample rate in Hz ( as measured by fmc15x_freqcnt_getfrequency() )
+*  @param sizes	allowed buffer lengths in samples
+*  @param nbrSizes	number of entries in sizes
+*  @param plan	receives the selected plan
+*  @return
+*						- -1 ( invalid argument or no buffer length can hold the frequency )
+*						- 0 ( Success )
+*/
+static int32_t PlanCoherentFrequency(double targetFreq, double sampleRate, const uint32_t *sizes, uint32_t nbrSizes, WaveformPlan *plan)
+{
+	bool found = false;
+	bool foundCoprime = false;
+	double bestError = 0;
+
+	if(!sizes || !plan || targetFreq <= 0 || sampleRate <= 0) {
+		printf("PlanCoherentFrequency() -> invalid argument\n");
+		return -1;
+	}
+
+	for(uint32_t s = 0; s < nbrSizes; s++) {
+		uint32_t n = sizes[s];
+		int64_t nearest = (int64_t)floor(targetFreq * n / sampleRate + 0.5);
+
+		for(int64_t c = nearest - PLAN_SEARCH_SPAN; c <= nearest + PLAN_SEARCH_SPAN; c++) {
+			if(c < 1 || 2 * c >= n)			// keep below Nyquist
+				continue;
+			uint32_t cycles = (uint32_t)c;
+			bool coprime = Gcd32(cycles, n) == 1;
+			double error = fabs(cycles * sampleRate / n - targetFreq);
+
+			bool better;
+			if(!found)
+				better = true;
+			else if(coprime != foundCoprime)
+				better = coprime;
+			else if(error != bestError)
+				better = error < bestError;
+			else
+				better = n > plan->numbersamples;
+
+			if(better) {
+				found = true;
+				foundCoprime = coprime;
+				bestError = error;
+				plan->numbersamples = n;
+				plan->cycles = cycles;
+			}
+		}
+	}
+
+	if(!found) {
+		printf("PlanCoherentFrequency() -> %.0f Hz cannot be generated at %.0f Hz\n", targetFreq, sampleRate);
+		return -1;
+	}
+	plan->targetFreq = targetFreq;
+	plan->sampleRate = sampleRate;
+	plan->actualFreq = plan->cycles * sampleRate / plan->numbersamples;
+	plan->distinctPhases = plan->numbersamples / Gcd32(plan->cycles, plan->numbersamples);
+	return 0;
+}
+
+/**
+*  PlanCoherentFrequency() with a cache kept in memory and in PLAN_CACHE_FILE, so frequency sweeps and
+*  later runs reuse plans instead of recomputing them. The sample rate is matched to PLAN_CACHE_RATE_STEP
+*  to absorb the frequency counter jitter between runs, the plan is then re-evaluated at the exact rate.
+*  The file starts with PLAN_CACHE_VERSION, a file of another version is ignored. It is rewritten whenever a
+*  plan is added, one line per plan and at most PLAN_CACHE_MAX_ENTRIES lines.
+*
+*  @param targetFreq	requested frequency in Hz
+*  @param sampleRate	DAC sample rate in Hz
+*  @param sizes	allowed buffer lengths in samples
+*  @param nbrSizes	number of entries in sizes
+*  @param plan	receives the selected plan
+*  @return
+*						- -1 ( no plan found )
+*						- 0 ( Success )
+*/
+static int32_t GetWaveformPlan(double targetFreq, double sampleRate, const uint32_t *sizes, uint32_t nbrSizes, WaveformPlan *plan)
+{
+	typedef struct {
+		double targetFreq;
+		double rateKey;
+		uint32_t sizesKey;
+		uint32_t numbersamples;
+		uint32_t cycles;
+	} PlanCacheEntry;
+	static std::vector<PlanCacheEntry> cache;
+	static std::mutex cacheLock;
+	static bool loaded = false;
+
+	if(!sizes || !plan)
+		return -1;
+
+	// FNV-1a over the allowed sizes
+	uint32_t sizesKey = 2166136261u;
+	for(uint32_t s = 0; s < nbrSizes; s++) {
+		for(uint32_t b = 0; b < 32; b += 8)
+			sizesKey = (sizesKey ^ ((sizes[s] >> b) & 0xff)) * 16777619u;
+	}
+	double rateKey = floor(sampleRate / PLAN_CACHE_RATE_STEP + 0.5) * PLAN_CACHE_RATE_STEP;
+
+	std::lock_guard<std::mutex> guard(cacheLock);
+	if(!loaded) {
+		FILE *fCache = fopen(PLAN_CACHE_FILE, "r");
+		if(fCache != NULL) {
+			PlanCacheEntry e;
+			uint32_t version = 0;
+			if(fscanf(fCache, "wfmplan %u", &version) == 1 && version == PLAN_CACHE_VERSION) {
+				while(fscanf(fCache, "%lf %lf %x %u %u", &e.targetFreq, &e.rateKey, &e.sizesKey, &e.numbersamples, &e.cycles) == 5 &&
+					cache.size() < PLAN_CACHE_MAX_ENTRIES)
+					cache.push_back(e);
+			}
+			fclose(fCache);
+		}
+		loaded = true;
+	}
+
+	for(size_t i = 0; i < cache.size(); i++) {
+		const PlanCacheEntry &e = cache[i];
+		if(e.targetFreq == targetFreq && e.rateKey == rateKey && e.sizesKey == sizesKey && e.numbersamples > 0) {
+			plan->targetFreq = targetFreq;
+			plan->sampleRate = sampleRate;
+			plan->numbersamples = e.numbersamples;
+			plan->cycles = e.cycles;
+			plan->actualFreq = e.cycles * sampleRate / e.numbersamples;
+			plan->distinctPhases = e.numbersamples / Gcd32(e.cycles, e.numbersamples);
+			return 0;
+		}
+	}
+
+	if(PlanCoherentFrequency(targetFreq, rateKey, sizes, nbrSizes, plan) != 0)
+		return -1;
+	plan->sampleRate = sampleRate;
+	plan->actualFreq = plan->cycles * sampleRate / plan->numbersamples;
+
+	// the lookup above failed, so the new plan is unique
+	PlanCacheEntry e = { targetFreq, rateKey, sizesKey, plan->numbersamples, plan->cycles };
+	if(cache.size() >= PLAN_CACHE_MAX_ENTRIES)
+		cache.erase(cache.begin(), cache.begin() + (cache.size() - PLAN_CACHE_MAX_ENTRIES + 1));
+	cache.push_back(e);
+	FILE *fCache = fopen(PLAN_CACHE_FILE, "w");
+	if(fCache != NULL) {
+		fprintf(fCache, "wfmplan %u\n", PLAN_CACHE_VERSION);
+		for(size_t i = 0; i < cache.size(); i++)
+			fprintf(fCache, "%.17g %.17g %08x %u %u\n", cache[i].targetFreq, cache[i].rateKey, cache[i].sizesKey, cache[i].numbersamples,
+				cache[i].cycles);
+		fclose(fCache);
+	}
+	return 0;
+}
+
+/**
+*  Generate a coherent sine wave filling a whole buffer.
+*
+*  @param buffer	destination buffer of numbersamples samples
+*  @param numbersamples	buffer length in samples
+*  @param frequency	requested frequency in Hz
+*  @param sampleRate	DAC sample rate in Hz
+*  @param amplitude	amplitude of the signal to generate ( peak to peak in DAC codes )
+*  @param plan	receives the plan used, may be NULL
+*  @return
+*						- -1 ( frequency cannot be generated )
+*						- 0 ( Success )
+*/
+static int32_t GenerateSineWaveform16(uint16_t *buffer, uint32_t numbersamples, double frequency, double sampleRate, uint32_t amplitude,
+									  WaveformPlan *plan)
+{
+	WaveformPlan localPlan;
+	if(!plan)
+		plan = &localPlan;
+	if(GetWaveformPlan(frequency, sampleRate, &numbersamples, 1, plan) != 0)
+		return -1;
+	GenerateSine16(buffer, numbersamples, 0, DdsTuningWord(plan->cycles, numbersamples), amplitude / 2 - 1);
+	return 0;
+}
+
 /**
 *  Generate a 16 bit waveform into a previously allocated memory buffer. This function can generate several data types and both
 *  signal period as well as amplitude are configurable.
@@ -97,6 +520,7 @@ static void DeleteFile(const char *filename)
 *					numbersamples*2 ( byte size ) or numbersamples*1 ( sample size ).
 *  @param numbersamples	number of samples to be written on the buffer where one sample is as big as 2 bytes.
 *  @param period	period of the signal to generate.
+*  @param frequency	frequency of the sine wave in Hz, adjusted to a whole number of periods per buffer ( see GetWaveformPlan() ).
 *  @param amplitude	amplitude of the signal to generate.
 *  @param datatype	decide what kind of data the function generates :
 *						- SINE_WAVE
@@ -110,13 +534,8 @@ static void DeleteFile(const char *filename)
 int32_t GenerateWaveform16(uint16_t *buffer, uint32_t numbersamples, uint32_t period, uint32_t frequency, uint32_t amplitude, uint8_t datatype)
 {
 	int32_t ampl				= 0;
-	double pi				= 3.1415926535;
 	int32_t tmp2				= 0x0;
-	double x, y;
 
-	
-	
-	
 	// set our buffer with known value ( 0 ). Note the MUL(2) because memset takes a byte size
 	memset(buffer,0, numbersamples*2);
 
@@ -130,31 +549,9 @@ int32_t GenerateWaveform16(uint16_t *buffer, uint32_t numbersamples, uint32_t pe
 	switch(datatype)
 	{
 	case SINE_WAVE:
-		for (uint32_t i = 0; i < numbersamples / 2; i++)
-		{
-			ampl = amplitude / 2 - 1;
-			// calculate Mcycles based on the frequency and numbersamples
-			double freqof1cycle =245e6/numbersamples;
-			//int Mcycle = (frequency/freqof1cycle);
-			// 100 = 6687, 70 = 4681, 50 = 3344, 60 = 4012
-			double Mcycle_50 = 6687;
-			double cwfreq50 = 245e6 / (numbersamples/Mcycle_50);
-			double Mcycle_70 = 4681;
-			double cwfreq70 = 245e6 / (numbersamples / Mcycle_70);
-			double Mcycle_3 = 4012;
-			double cwfreq3 = 245e6 / (numbersamples / Mcycle_3);
-			double freq_start = 50e6;
-			double freq_stop = 70e6;
-			double freq_step = (freq_stop - freq_start) / (numbersamples / 2);
-            //frequency = freq_start + (i  * freq_step);
-			frequency = cwfreq50;
-			x = (2 * pi * frequency) * (i * 2 + 0) / 245e6;
-			y = sin(x);
-			buffer[2 * i + 0] = ((uint16_t)(y * ampl));
-			x = (2 * pi * frequency) * (i * 2 + 1) / 245e6;
-			y = sin(x);
-			buffer[2 * i + 1] = ((uint16_t)(y * ampl));
-		}
+		// whole number of periods in the buffer so the waveform wraps cleanly when the waveform memory is replayed
+		if(GenerateSineWaveform16(buffer, numbersamples, frequency, SAMPLE_RATE, amplitude, NULL) != 0)
+			return -1;
 		break;
 	case SAW_WAVE:
 		for(uint32_t i=0; i < numbersamples/2; i++)
@@ -210,6 +607,257 @@ int32_t GenerateWaveform16(uint16_t *buffer, uint32_t numbersamples, uint32_t pe
 }
 
 
+/**
+*  One tone of a multi-tone waveform.
+*/
+typedef struct {
+	double frequency;						/*!< frequency in Hz, adjusted to a whole number of periods per buffer */
+	double amplitude;						/*!< relative amplitude, the sum of all tones is scaled to the DAC range */
+	double phase;							/*!< phase of the first sample in degrees */
+} ToneSpec;
+
+/**
+*  Generate the sum of several sine waves. Every tone is planned to a whole number of periods per buffer, so the
+*  composite waveform wraps cleanly as well.
+*
+*  @param buffer	destination buffer of numbersamples samples
+*  @param numbersamples	number of samples to generate
+*  @param tones	tones to generate
+*  @param nbrTones	number of tones ( up to WFM_MAX_TONES )
+*  @param sampleRate	DAC sample rate in Hz
+*  @param amplitude	amplitude of the composite signal ( peak to peak in DAC codes )
+*  @return
+*						- -1 ( invalid argument or a tone cannot be generated )
+*						- 0 ( Success )
+*/
+static int32_t GenerateMultiTone16(uint16_t *buffer, uint32_t numbersamples, const ToneSpec *tones, uint32_t nbrTones, double sampleRate,
+								   uint32_t amplitude)
+{
+	uint64_t phase[WFM_MAX_TONES];
+	uint64_t tuningWord[WFM_MAX_TONES];
+	float gain[WFM_MAX_TONES];
+	double total = 0;
+
+	if(!buffer || !tones || nbrTones == 0 || nbrTones > WFM_MAX_TONES) {
+		printf("GenerateMultiTone16() -> invalid argument\n");
+		return -1;
+	}
+
+	for(uint32_t t = 0; t < nbrTones; t++)
+		total += fabs(tones[t].amplitude);
+	if(total <= 0) {
+		printf("GenerateMultiTone16() -> all tones have a null amplitude\n");
+		return -1;
+	}
+
+	for(uint32_t t = 0; t < nbrTones; t++) {
+		WaveformPlan plan;
+		if(GetWaveformPlan(tones[t].frequency, sampleRate, &numbersamples, 1, &plan) != 0)
+			return -1;
+		phase[t] = DdsPhaseFromTurns(tones[t].phase / 360.0);
+		tuningWord[t] = DdsTuningWord(plan.cycles, numbersamples);
+		gain[t] = (float)(tones[t].amplitude / total * (amplitude / 2 - 1));
+	}
+
+	const float *table = GetDdsSineTable();
+	ParallelGenerate(numbersamples, [&](uint32_t start, uint32_t count) {
+		float acc[WFM_BLOCK_SIZE];
+		uint64_t p[WFM_MAX_TONES];
+		for(uint32_t t = 0; t < nbrTones; t++)
+			p[t] = phase[t] + tuningWord[t] * start;
+
+		// accumulate one block at a time, tone after tone, so the accumulator stays in L1
+		for(uint32_t block = start; block < start + count; block += WFM_BLOCK_SIZE) {
+			uint32_t n = (start + count - block < WFM_BLOCK_SIZE) ? start + count - block : WFM_BLOCK_SIZE;
+			memset(acc, 0, n * sizeof(float));
+			for(uint32_t t = 0; t < nbrTones; t++) {
+				for(uint32_t i = 0; i < n; i++) {
+					acc[i] += gain[t] * DdsSineAt(table, p[t]);
+					p[t] += tuningWord[t];
+				}
+			}
+			for(uint32_t i = 0; i < n; i++)
+				buffer[block + i] = (uint16_t)(int32_t)acc[i];
+		}
+	});
+	return 0;
+}
+
+/**
+*  Generate a frequency sweep over the whole buffer. The phase of every sample is computed in closed form, so the
+*  buffer can be split across threads.
+*  - linear:		f(t) = fstart + (fstop - fstart) * t / T
+*  - exponential:	f(t) = fstart * (fstop / fstart) ^ (t / T)
+*
+*  @param buffer	destination buffer of numbersamples samples
+*  @param numbersamples	number of samples to generate
+*  @param fstart	frequency of the first sample in Hz
+*  @param fstop	frequency reached at the end of the buffer in Hz
+*  @param sampleRate	DAC sample rate in Hz
+*  @param amplitude	amplitude of the signal to generate ( peak to peak in DAC codes )
+*  @param datatype	CHIRP_LINEAR or CHIRP_EXPONENTIAL
+*  @return
+*						- -1 ( invalid argument )
+*						- 0 ( Success )
+*/
+static int32_t GenerateChirp16(uint16_t *buffer, uint32_t numbersamples, double fstart, double fstop, double sampleRate, uint32_t amplitude,
+							   uint8_t datatype)
+{
+	if(!buffer || numbersamples == 0 || sampleRate <= 0 || (datatype == CHIRP_EXPONENTIAL && (fstart <= 0 || fstop <= 0))) {
+		printf("GenerateChirp16() -> invalid argument\n");
+		return -1;
+	}
+
+	const float *table = GetDdsSineTable();
+	const int32_t ampl = amplitude / 2 - 1;
+	const double f0 = fstart / sampleRate;						// cycles per sample
+	const double rate = (fstop - fstart) / sampleRate / numbersamples;	// linear: cycles per sample^2
+	const double ratio = fstop / fstart;
+	const double logRatio = log(ratio);
+
+	ParallelGenerate(numbersamples, [=](uint32_t start, uint32_t count) {
+		for(uint32_t i = start; i < start + count; i++) {
+			double n = i;
+			double turns;
+			if(datatype == CHIRP_LINEAR || fabs(logRatio) < 1e-12)
+				turns = f0 * n + 0.5 * rate * n * n;
+			else
+				turns = f0 * numbersamples / logRatio * (exp(logRatio * n / numbersamples) - 1.0);
+			buffer[i] = (uint16_t)(int32_t)(DdsSineAt(table, DdsPhaseFromTurns(turns)) * ampl);
+		}
+	});
+	return 0;
+}
+
+/**
+*  Load one component of an IQ waveform from a text file. Every line holds an "I Q" pair ( comma, semicolon or
+*  white space separated ) of values between -1 and 1. The file is repeated if it is shorter than the buffer and
+*  truncated if it is longer.
+*
+*  @param buffer	destination buffer of numbersamples samples
+*  @param numbersamples	number of samples to generate
+*  @param filename	pointer to a string representing the filename/path
+*  @param column	0 loads I, 1 loads Q
+*  @param amplitude	amplitude of the signal to generate ( peak to peak in DAC codes )
+*  @return
+*						- -1 ( Unexpected NULL argument )
+*						- -3 ( cannot open the file )
+*						- -4 ( no sample found in the file )
+*						- 0 ( Success )
+*/
+static int32_t LoadIqWaveform16(uint16_t *buffer, uint32_t numbersamples, const char *filename, int32_t column, uint32_t amplitude)
+{
+	char line[256];
+	uint32_t count = 0;
+	const int32_t ampl = amplitude / 2 - 1;
+
+	if(!buffer || !filename) {
+		printf("LoadIqWaveform16() -> unexpected NULL argument\n");
+		return -1;
+	}
+
+	FILE *fInFile = fopen(filename, "r");
+	if(fInFile == NULL) {
+		printf("LoadIqWaveform16() -> Cannot open file '%s' with read access\n", filename);
+		return -3;
+	}
+	while(count < numbersamples && fgets(line, sizeof(line), fInFile) != NULL) {
+		double value[2];
+		for(char *c = line; *c; c++) {
+			if(*c == ',' || *c == ';')
+				*c = ' ';
+		}
+		if(sscanf(line, "%lf %lf", &value[0], &value[1]) != 2)
+			continue;				// header or comment line
+		if(value[column] > 1.0) value[column] = 1.0;
+		if(value[column] < -1.0) value[column] = -1.0;
+		buffer[count++] = (uint16_t)(int32_t)(value[column] * ampl);
+	}
+	fclose(fInFile);
+
+	if(count == 0) {
+		printf("LoadIqWaveform16() -> no IQ sample found in '%s'\n", filename);
+		return -4;
+	}
+	for(uint32_t i = count; i < numbersamples; i++)
+		buffer[i] = buffer[i % count];
+	return 0;
+}
+
+/**
+*  Generate a waveform described by a command line specification:
+*  - sine:<frequency>
+*  - tones:<frequency>[/<amplitude>[/<phase in degrees>]],...
+*  - chirp:<start frequency>:<stop frequency>
+*  - expchirp:<start frequency>:<stop frequency>
+*  - square:<period in samples>
+*  - iq:<file> ( DAC0 receives the I column, DAC1 the Q column )
+*
+*  @param buffer	destination buffer of numbersamples samples
+*  @param numbersamples	number of samples to generate
+*  @param spec	waveform specification
+*  @param dac	DAC the waveform is generated for ( 0 or 1 )
+*  @param sampleRate	DAC sample rate in Hz
+*  @param amplitude	amplitude of the signal to generate ( peak to peak in DAC codes )
+*  @return
+*						- -1 ( invalid specification or generation failed )
+*						- 0 ( Success )
+*/
+static int32_t GenerateWaveformFromSpec(uint16_t *buffer, uint32_t numbersamples, const char *spec, int32_t dac, double sampleRate,
+										uint32_t amplitude)
+{
+	double f0, f1;
+
+	if(!strncmp(spec, "sine:", 5)) {
+		WaveformPlan plan;
+		if(GenerateSineWaveform16(buffer, numbersamples, atof(spec + 5), sampleRate, amplitude, &plan) != 0)
+			return -1;
+		printf("DAC%d sine: %u periods in %u samples at %.3fMHz -> %.6fMHz\n", dac, plan.cycles, plan.numbersamples,
+			sampleRate / 1e6, plan.actualFreq / 1e6);
+		return 0;
+	}
+	if(!strncmp(spec, "tones:", 6)) {
+		ToneSpec tones[WFM_MAX_TONES];
+		uint32_t nbrTones = 0;
+		const char *p = spec + 6;
+		while(*p && nbrTones < WFM_MAX_TONES) {
+			ToneSpec *tone = &tones[nbrTones++];
+			tone->amplitude = 1.0;
+			tone->phase = 0.0;
+			if(sscanf(p, "%lf/%lf/%lf", &tone->frequency, &tone->amplitude, &tone->phase) < 1) {
+				printf("Invalid tone list '%s'\n", spec + 6);
+				return -1;
+			}
+			p = strchr(p, ',');
+			if(!p)
+				break;
+			p++;
+		}
+		printf("DAC%d multi-tone: %u tones\n", dac, nbrTones);
+		return GenerateMultiTone16(buffer, numbersamples, tones, nbrTones, sampleRate, amplitude);
+	}
+	if(sscanf(spec, "chirp:%lf:%lf", &f0, &f1) == 2) {
+		printf("DAC%d linear chirp: %.3fMHz -> %.3fMHz\n", dac, f0 / 1e6, f1 / 1e6);
+		return GenerateChirp16(buffer, numbersamples, f0, f1, sampleRate, amplitude, CHIRP_LINEAR);
+	}
+	if(sscanf(spec, "expchirp:%lf:%lf", &f0, &f1) == 2) {
+		printf("DAC%d exponential chirp: %.3fMHz -> %.3fMHz\n", dac, f0 / 1e6, f1 / 1e6);
+		return GenerateChirp16(buffer, numbersamples, f0, f1, sampleRate, amplitude, CHIRP_EXPONENTIAL);
+	}
+	if(!strncmp(spec, "square:", 7)) {
+		printf("DAC%d square: period %d samples\n", dac, atoi(spec + 7));
+		return GenerateWaveform16(buffer, numbersamples, atoi(spec + 7), 0, amplitude, SQUARE_WAVE);
+	}
+	if(!strncmp(spec, "iq:", 3)) {
+		printf("DAC%d %s column of '%s'\n", dac, dac == 0 ? "I" : "Q", spec + 3);
+		return LoadIqWaveform16(buffer, numbersamples, spec + 3, dac == 0 ? 0 : 1, amplitude);
+	}
+
+	printf("Unknown waveform specification '%s'\n", spec);
+	return -1;
+}
+
+
 
 #ifndef API_ENUM_DISPLAY
 #define API_ENUM_DISPLAY 1
@@ -217,6 +865,60 @@ int32_t GenerateWaveform16(uint16_t *buffer, uint32_t numbersamples, uint32_t pe
 
 // Save a buffer to a file.
 #ifndef Save16BitArrayToFile
+// Two ASCII digits for every value from 0 to 99, used to render two decimal digits per table lookup
+static const char DigitPairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/**
+*  Render a 16 bit sample array as decimal text, one sample per line. The output is identical to printing
+*  every sample with the "%hi\n" format but processes two digits per table lookup and never calls into stdio.
+*
+*  @param buf16	samples to render
+*  @param count	number of samples
+*  @param out	destination, must hold at least count*MAX_ASCII_SAMPLE_SIZE bytes
+*  @return number of bytes written to out
+*/
+static size_t FormatInt16ArrayAscii(const int16_t *buf16, int32_t count, char *out)
+{
+	char *p = out;
+
+	for(int32_t i = 0; i < count; i++) {
+		int32_t value = buf16[i];
+		uint32_t u;
+		if(value < 0) {
+			*p++ = '-';
+			u = (uint32_t)(-value);
+		} else
+			u = (uint32_t)value;
+
+		// at most 5 digits ( 32768 )
+		if(u < 10) {
+			*p++ = (char)('0' + u);
+		} else if(u < 100) {
+			memcpy(p, &DigitPairs[2 * u], 2);
+			p += 2;
+		} else if(u < 1000) {
+			*p++ = (char)('0' + u / 100);
+			memcpy(p, &DigitPairs[2 * (u % 100)], 2);
+			p += 2;
+		} else if(u < 10000) {
+			memcpy(p, &DigitPairs[2 * (u / 100)], 2);
+			memcpy(p + 2, &DigitPairs[2 * (u % 100)], 2);
+			p += 4;
+		} else {
+			*p++ = (char)('0' + u / 10000);
+			u %= 10000;
+			memcpy(p, &DigitPairs[2 * (u / 100)], 2);
+			memcpy(p + 2, &DigitPairs[2 * (u % 100)], 2);
+			p += 4;
+		}
+		*p++ = '\n';
+	}
+	return (size_t)(p - out);
+}
+
 /**
 *  Save a 16 bit sample array to file.
 *
@@ -233,7 +935,6 @@ int32_t GenerateWaveform16(uint16_t *buffer, uint32_t numbersamples, uint32_t pe
 */
 static uint32_t Save16BitArrayToFile(void *buf, int32_t bufsize, const char *filename, int32_t mode)
 {
-	int32_t i;
 	FILE *fOutFile;
 	char sOpenMode[55];
 
@@ -268,10 +969,13 @@ static uint32_t Save16BitArrayToFile(void *buf, int32_t bufsize, const char *fil
 		fwrite(buf, 2, bufsize, fOutFile);
 	else // -> ASCII
 	{
-		// Here we don't take risk. We pass a int16_t casted as an int32_t,
-		// and we use the normalized int32_t -> int16_t format converter (%hi)
-		for(i = 0; i < bufsize; i++)
-			fprintf(fOutFile, "%hi\n", (int32_t)buf16[i]);
+		// Render the whole buffer in memory first and write it with a single call. The text is the
+		// same as the one produced by the normalized int32_t -> int16_t format converter (%hi).
+		// The text buffer is kept per thread so repeated calls do not reallocate it.
+		static thread_local std::vector<char> text;
+		if(text.size() < (size_t)bufsize * MAX_ASCII_SAMPLE_SIZE)
+			text.resize((size_t)bufsize * MAX_ASCII_SAMPLE_SIZE);
+		fwrite(text.data(), 1, FormatInt16ArrayAscii(buf16, bufsize, text.data()), fOutFile);
 	}
 
 	fclose(fOutFile);
@@ -280,6 +984,181 @@ static uint32_t Save16BitArrayToFile(void *buf, int32_t bufsize, const char *fil
 
 #endif
 
+/**
+*  Compare the ASCII path of Save16BitArrayToFile() with the former per sample fprintf() implementation on
+*  16K and 16M sample buffers. Both files are checked to be byte identical and then deleted.
+*
+*  @return
+*						- -1 ( out of memory, file error or output mismatch )
+*						- 0 ( Success )
+*/
+static int32_t BenchmarkAsciiFormatter(void)
+{
+	const int32_t sizes[] = { 16 * 1024, 16 * 1024 * 1024 };
+	int32_t rc = 0;
+
+	for(uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && rc == 0; s++) {
+		int32_t count = sizes[s];
+		int16_t *samples = (int16_t *)_aligned_malloc(2 * count, 4096);
+		if(!samples) {
+			printf("BenchmarkAsciiFormatter() -> cannot allocate %d samples\n", count);
+			return -1;
+		}
+
+		// sine wave plus a deterministic pseudo random component so all lengths and both signs are exercised,
+		// the first samples cover the extreme values
+		uint32_t lcg = 12345;
+		for(int32_t i = 0; i < count; i++) {
+			lcg = lcg * 1103515245 + 12345;
+			samples[i] = (int16_t)(int32_t)(20000 * sin(i * 0.01) + (int32_t)((lcg >> 16) & 0x1fff) - 4096);
+		}
+		samples[0] = -32768; samples[1] = 32767; samples[2] = 0; samples[3] = -1; samples[4] = 9; samples[5] = -10;
+
+		DeleteFile("bench_ref.txt");
+		DeleteFile("bench_fast.txt");
+
+		// reference: one fprintf per sample
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		FILE *fRef = fopen("bench_ref.txt", "a");
+		if(fRef == NULL) {
+			printf("BenchmarkAsciiFormatter() -> Cannot open file 'bench_ref.txt' with write access\n");
+			_aligned_free(samples);
+			return -1;
+		}
+		for(int32_t i = 0; i < count; i++)
+			fprintf(fRef, "%hi\n", (int32_t)samples[i]);
+		fclose(fRef);
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+		// batch formatter
+		Save16BitArrayToFile(samples, count, "bench_fast.txt", ASCII);
+		std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+		double tRef = std::chrono::duration<double>(t1 - t0).count();
+		double tFast = std::chrono::duration<double>(t2 - t1).count();
+		printf("%9d samples: fprintf %8.3f ms (%6.1f ns/sample), batch %8.3f ms (%6.1f ns/sample), speedup x%.1f\n",
+			count, tRef * 1e3, tRef * 1e9 / count, tFast * 1e3, tFast * 1e9 / count, tRef / tFast);
+
+		// the two files must be byte identical
+		FILE *fA = fopen("bench_ref.txt", "rb");
+		FILE *fB = fopen("bench_fast.txt", "rb");
+		if(fA == NULL || fB == NULL) {
+			printf("BenchmarkAsciiFormatter() -> Cannot read back the benchmark files\n");
+			rc = -1;
+		} else {
+			char bufA[4096], bufB[4096];
+			size_t nA, nB;
+			do {
+				nA = fread(bufA, 1, sizeof(bufA), fA);
+				nB = fread(bufB, 1, sizeof(bufB), fB);
+				if(nA != nB || memcmp(bufA, bufB, nA) != 0) {
+					printf("BenchmarkAsciiFormatter() -> output differs from fprintf for %d samples\n", count);
+					rc = -1;
+					break;
+				}
+			} while(nA > 0);
+		}
+		if(fA) fclose(fA);
+		if(fB) fclose(fB);
+
+		DeleteFile("bench_ref.txt");
+		DeleteFile("bench_fast.txt");
+		_aligned_free(samples);
+	}
+
+	if(rc == 0)
+		printf("ASCII output identical to fprintf\n");
+	return rc;
+}
+
+/**
+*  Result of a ramp pattern check.
+*/
+typedef struct {
+	uint32_t errorCount;					/*!< number of samples differing from the expected ramp */
+	int32_t firstError;						/*!< index of the first failing sample, -1 when the check passed */
+	uint16_t bitErrorMask;					/*!< OR of all the received ^ expected differences, bit n is ADC data line n */
+	uint32_t bitErrors[ADC_DATA_BITS];		/*!< number of errors seen on every data line */
+	uint32_t errorRuns;						/*!< number of runs of consecutive failing samples */
+	uint32_t longestRun;					/*!< length of the longest run of failing samples */
+} RampCheckResult;
+
+/**
+*  Scalar part of CheckRampPattern(): accumulate the errors of samples [from, to).
+*/
+static void CheckRampPatternScalar(const uint16_t *data, int32_t from, int32_t to, uint16_t start, RampCheckResult *result,
+								   uint32_t *currentRun)
+{
+	for(int32_t j = from; j < to; j++) {
+		uint16_t diff = (uint16_t)((data[j] >> 2) ^ ((start + j) & ADC_DATA_MASK));
+		if(diff == 0) {
+			*currentRun = 0;
+			continue;
+		}
+		if(result->errorCount++ == 0)
+			result->firstError = j;
+		result->bitErrorMask |= diff;
+		for(uint32_t b = 0; b < ADC_DATA_BITS; b++)
+			result->bitErrors[b] += (diff >> b) & 1;
+		if((*currentRun)++ == 0)
+			result->errorRuns++;
+		if(*currentRun > result->longestRun)
+			result->longestRun = *currentRun;
+	}
+}
+
+/**
+*  Compare a buffer of 14 bit ADC samples ( 16 bit aligned ) with a ramp incrementing by one every sample.
+*  Whole vectors are compared at once and only the vectors holding an error are inspected sample by sample,
+*  so a clean buffer is checked at memory speed.
+*
+*  @param data	samples received from the ADC
+*  @param count	number of samples
+*  @param start	expected value of the first sample ( 14 bit )
+*  @param result	receives the error statistics
+*  @return expected value of the sample following the buffer, to check the next buffer for continuity
+*/
+static uint16_t CheckRampPattern(const uint16_t *data, int32_t count, uint16_t start, RampCheckResult *result)
+{
+	uint32_t currentRun = 0;
+	int32_t j = 0;
+
+	memset(result, 0, sizeof(*result));
+	result->firstError = -1;
+
+#if defined(FMC_HAVE_AVX2)
+	const __m256i mask256 = _mm256_set1_epi16(ADC_DATA_MASK);
+	const __m256i step256 = _mm256_set1_epi16(16);
+	__m256i expected256 = _mm256_add_epi16(_mm256_set1_epi16((int16_t)start),
+		_mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	for(; j + 16 <= count; j += 16) {
+		__m256i received = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(data + j)), 2);
+		__m256i equal = _mm256_cmpeq_epi16(received, _mm256_and_si256(expected256, mask256));
+		if((uint32_t)_mm256_movemask_epi8(equal) != 0xFFFFFFFFu)
+			CheckRampPatternScalar(data, j, j + 16, start, result, &currentRun);
+		else
+			currentRun = 0;
+		expected256 = _mm256_add_epi16(expected256, step256);
+	}
+#elif defined(FMC_HAVE_SSE2)
+	const __m128i mask128 = _mm_set1_epi16(ADC_DATA_MASK);
+	const __m128i step128 = _mm_set1_epi16(8);
+	__m128i expected128 = _mm_add_epi16(_mm_set1_epi16((int16_t)start), _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+	for(; j + 8 <= count; j += 8) {
+		__m128i received = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(data + j)), 2);
+		__m128i equal = _mm_cmpeq_epi16(received, _mm_and_si128(expected128, mask128));
+		if(_mm_movemask_epi8(equal) != 0xFFFF)
+			CheckRampPatternScalar(data, j, j + 8, start, result, &currentRun);
+		else
+			currentRun = 0;
+		expected128 = _mm_add_epi16(expected128, step128);
+	}
+#endif
+	CheckRampPatternScalar(data, j, count, start, result, &currentRun);
+
+	return (uint16_t)((start + count) & ADC_DATA_MASK);
+}
+
 /**
 *  Verifies Ramp Pattern (Card Specific)
 *
@@ -294,35 +1173,3975 @@ int32_t verify_ramp_pattern(char *pInData, int32_t burstSize)
 {
 	// verify the patterned data
 	// pattern data on FMC15x bit is 14 resolution, 16 bit aligned.
+	// the ramp is expected to start from the first received sample
+
+	const uint16_t *pattern_data = (const uint16_t *)pInData;
+	RampCheckResult result;
+
+	CheckRampPattern(pattern_data, burstSize, pattern_data[0] >> 2, &result);
+
+	if (result.errorCount) {
+		printf ("Pattern Check Failed with %d pattern errors\n", result.errorCount);
+		printf ("  first error at sample %d, failing data lines 0x%4.4X, %u error runs (longest %u samples)\n",
+			result.firstError, result.bitErrorMask, result.errorRuns, result.longestRun);
+		return -1;
+	}
+	else {
+		printf ("Pattern Check Passed!\n");
+		return 0;
+	}
+}
 
-	uint16_t *pattern_data = (uint16_t *)pInData;
 
-	uint16_t check_data = (pattern_data[0] >> 2) + 1;
+/**
+*  Sample buffers carved out of a single region reserved at startup, backed by 2 MiB huge pages and locked in
+*  memory, so that sipif_readdata() and the file writers never touch a page that is not mapped in the TLB or not
+*  resident. Released buffers go to a free list per size and are handed out again as they are, the region is only
+*  returned to the system at exit. Requests the region cannot satisfy fall back to _aligned_malloc().
+*/
+typedef struct {
+	uint8_t *base;							/*!< start of the region, NULL when the pool is disabled */
+	size_t size;							/*!< size of the region in bytes */
+	size_t used;							/*!< bytes handed out at least once, buffers are carved from the start */
+	const char *backing;					/*!< kind of pages backing the region */
+	bool locked;							/*!< the region is locked in memory */
+	std::map<size_t, std::vector<uint8_t *> > freeBuffers;	/*!< released buffers, by size */
+	std::map<uint8_t *, size_t> bufferSize;	/*!< size of every buffer carved from the region */
+	uint64_t recycled;						/*!< number of requests served from the free lists */
+	uint64_t fallbacks;						/*!< number of requests served by _aligned_malloc() */
+	std::mutex lock;
+} BufferPool;
+
+static BufferPool g_bufferPool;				/*!< pool of the SampleRing slots and card buffers */
 
-	uint32_t error_count = 0;
-	uint16_t mask = 0x3fff;
+/**
+*  Reserve the region of a BufferPool. Huge pages are tried first ( MAP_HUGETLB, then transparent huge pages on
+*  Linux, MEM_LARGE_PAGES on Windows ), then normal pages. Failing to lock the region is only reported.
+*
+*  @param pool	pool to create
+*  @param size	size of the region in bytes, rounded up to a multiple of HUGE_PAGE_SIZE
+*  @return
+*						- -1 ( cannot reserve the region, every buffer will come from _aligned_malloc() )
+*						- 0 ( Success )
+*/
+static int32_t BufferPool_Create(BufferPool *pool, size_t size)
+{
+	size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+	pool->base = NULL;
+	pool->size = pool->used = 0;
+	pool->backing = "normal pages";
+	pool->locked = false;
+	pool->recycled = pool->fallbacks = 0;
+	if(size == 0)
+		return 0;
+
+#ifdef WIN32
+	SIZE_T largePage = GetLargePageMinimum();
+	if(largePage != 0 && size % largePage == 0) {
+		// needs the "Lock pages in memory" privilege, large pages are never paged out
+		pool->base = (uint8_t *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if(pool->base) {
+			pool->backing = "large pages";
+			pool->locked = true;
+		}
+	}
+	if(!pool->base) {
+		pool->base = (uint8_t *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if(pool->base) {
+			SetProcessWorkingSetSize(GetCurrentProcess(), size + (64u << 20), size + (128u << 20));
+			pool->locked = (VirtualLock(pool->base, size) != 0);
+		}
+	}
+#else
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if(p != MAP_FAILED) {
+		pool->backing = "2 MiB huge pages";
+	}
+	else {
+		// no huge pages reserved, ask for transparent huge pages on a 2 MiB aligned region
+		p = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p != MAP_FAILED) {
+			uint8_t *aligned = (uint8_t *)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+			if(aligned != (uint8_t *)p)
+				munmap(p, aligned - (uint8_t *)p);
+			munmap(aligned + size, (uint8_t *)p + HUGE_PAGE_SIZE - aligned);
+			p = aligned;
+#ifdef MADV_HUGEPAGE
+			if(madvise(p, size, MADV_HUGEPAGE) == 0)
+				pool->backing = "transparent huge pages";
+#endif
+		}
+	}
+	if(p != MAP_FAILED) {
+		pool->base = (uint8_t *)p;
+		// mlock() also faults every page in, nothing is left to fault during a capture
+		pool->locked = (mlock(p, size) == 0);
+		if(!pool->locked)
+			memset(p, 0, size);
+	}
+#endif
+	if(!pool->base) {
+		printf("BufferPool_Create() -> cannot reserve %u MiB, buffers are allocated on demand\n", (uint32_t)(size >> 20));
+		return -1;
+	}
+	pool->size = size;
+	if(!pool->locked)
+		printf("BufferPool_Create() -> cannot lock %u MiB in memory, check the locked memory limit\n", (uint32_t)(size >> 20));
+	return 0;
+}
+
+/**
+*  Get a 4 KiB aligned buffer from the pool. Buffers of HUGE_PAGE_SIZE and more start on a huge page.
+*
+*  @param pool	pool created with BufferPool_Create()
+*  @param bytes	size of the buffer
+*  @return buffer, NULL when out of memory
+*/
+static uint8_t *BufferPool_Alloc(BufferPool *pool, size_t bytes)
+{
+	size_t granule = (bytes >= HUGE_PAGE_SIZE) ? HUGE_PAGE_SIZE : 4096;
+	size_t size = (bytes + granule - 1) & ~(granule - 1);
+	std::lock_guard<std::mutex> guard(pool->lock);
+
+	std::vector<uint8_t *> &freeList = pool->freeBuffers[size];
+	if(!freeList.empty()) {
+		uint8_t *buf = freeList.back();
+		freeList.pop_back();
+		pool->recycled++;
+		return buf;
+	}
+	size_t start = (pool->used + granule - 1) & ~(granule - 1);
+	if(pool->base && start + size <= pool->size) {
+		uint8_t *buf = pool->base + start;
+		pool->used = start + size;
+		pool->bufferSize[buf] = size;
+		return buf;
+	}
+	pool->fallbacks++;
+	return (uint8_t *)_aligned_malloc(bytes, 4096);
+}
+
+/**
+*  Give a buffer back to the pool, where it waits for the next request of the same size.
+*
+*  @param pool	pool the buffer was taken from
+*  @param buf	buffer returned by BufferPool_Alloc(), may be NULL
+*/
+static void BufferPool_Free(BufferPool *pool, uint8_t *buf)
+{
+	if(!buf)
+		return;
+	std::lock_guard<std::mutex> guard(pool->lock);
+	std::map<uint8_t *, size_t>::const_iterator it = pool->bufferSize.find(buf);
+	if(it == pool->bufferSize.end()) {
+		_aligned_free(buf);
+		return;
+	}
+	pool->freeBuffers[it->second].push_back(buf);
+}
+
+/**
+*  Print how the pool was backed and used.
+*/
+static void BufferPool_PrintStats(const BufferPool *pool)
+{
+	if(!pool->base)
+		return;
+	printf("Buffer pool: %u of %u MiB used, %s, %s, %llu buffers recycled, %llu allocated outside the pool\n",
+		(uint32_t)((pool->used + (1u << 20) - 1) >> 20), (uint32_t)(pool->size >> 20), pool->backing,
+		pool->locked ? "locked" : "not locked", (unsigned long long)pool->recycled, (unsigned long long)pool->fallbacks);
+}
+
+/**
+*  Return the region of the pool to the system. No buffer of the pool may be in use.
+*
+*  @param pool	pool created with BufferPool_Create()
+*/
+static void BufferPool_Destroy(BufferPool *pool)
+{
+	if(!pool->base)
+		return;
+#ifdef WIN32
+	VirtualFree(pool->base, 0, MEM_RELEASE);
+#else
+	if(pool->locked)
+		munlock(pool->base, pool->size);
+	munmap(pool->base, pool->size);
+#endif
+	pool->base = NULL;
+	pool->freeBuffers.clear();
+	pool->bufferSize.clear();
+}
+
+/**
+*  Size of count samples packed by Packed14_Pack().
+*
+*  @param count	number of samples
+*  @return size in bytes
+*/
+static uint32_t Packed14_Bytes(uint32_t count)
+{
+	return (count * 7 + 3) / 4;
+}
+
+/**
+*  Pack ADC samples on 14 bits: the two unused low bits of the left justified samples are dropped and every group
+*  of 4 samples is stored as a 56 bit little endian word in 7 bytes, the first sample in the low bits, so 8 samples
+*  take 14 bytes. A last group of fewer than 4 samples only keeps the bytes holding their bits. The output may
+*  overlap the input as long as it does not start after it, bursts can be packed in place.
+*
+*  @param in	16 bit left justified ADC samples
+*  @param count	number of samples
+*  @param out	receives Packed14_Bytes(count) bytes
+*/
+static void Packed14_Pack(const int16_t *in, uint32_t count, uint8_t *out)
+{
+	uint32_t i = 0;
+	// the vector loops store one byte past their group, which the next group overwrites: the last group ( even
+	// partial ) is left to the scalar loop
+#if defined(FMC_HAVE_AVX2)
+	const __m256i pairs256 = _mm256_set1_epi32(0x40000001);
+	const __m256i low256 = _mm256_set1_epi64x(0xFFFFFFFF);
+	for(; i + 16 < count; i += 16) {
+		// 14 bit values, pairs merged in 28 bits, then quads in 56 bits
+		__m256i v = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(in + i)), 2);
+		__m256i p = _mm256_madd_epi16(v, pairs256);
+		__m256i q = _mm256_or_si256(_mm256_and_si256(p, low256), _mm256_slli_epi64(_mm256_srli_epi64(p, 32), 28));
+		__m128i lo = _mm256_castsi256_si128(q), hi = _mm256_extracti128_si256(q, 1);
+		uint8_t *o = out + (size_t)i / 4 * 7;
+		_mm_storel_epi64((__m128i *)o, lo);
+		_mm_storel_epi64((__m128i *)(o + 7), _mm_srli_si128(lo, 8));
+		_mm_storel_epi64((__m128i *)(o + 14), hi);
+		_mm_storel_epi64((__m128i *)(o + 21), _mm_srli_si128(hi, 8));
+	}
+#elif defined(FMC_HAVE_SSE2)
+	const __m128i pairs128 = _mm_set1_epi32(0x40000001);
+	const __m128i low128 = _mm_set_epi32(0, -1, 0, -1);
+	for(; i + 8 < count; i += 8) {
+		__m128i v = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(in + i)), 2);
+		__m128i p = _mm_madd_epi16(v, pairs128);
+		__m128i q = _mm_or_si128(_mm_and_si128(p, low128), _mm_slli_epi64(_mm_srli_epi64(p, 32), 28));
+		uint8_t *o = out + (size_t)i / 4 * 7;
+		_mm_storel_epi64((__m128i *)o, q);
+		_mm_storel_epi64((__m128i *)(o + 7), _mm_srli_si128(q, 8));
+	}
+#endif
+	for(; i < count; i += 4) {
+		uint32_t n = (count - i < 4) ? count - i : 4;
+		uint64_t q = 0;
+		for(uint32_t j = 0; j < n; j++)
+			q |= (uint64_t)((uint16_t)in[i + j] >> 2) << (14 * j);
+		uint8_t *o = out + (size_t)i / 4 * 7;
+		for(uint32_t j = 0; j < Packed14_Bytes(n); j++)
+			o[j] = (uint8_t)(q >> (8 * j));
+	}
+}
+
+/**
+*  Unpack samples stored by Packed14_Pack() back to 16 bit left justified samples.
+*
+*  @param in	Packed14_Bytes(count) bytes of packed samples
+*  @param count	number of samples
+*  @param out	receives count samples, must not overlap the input
+*/
+static void Packed14_Unpack(const uint8_t *in, uint32_t count, int16_t *out)
+{
+	uint32_t i = 0;
+	// the vector loops read one byte past their group, the last group ( even partial ) is left to the scalar loop
+#if defined(FMC_HAVE_AVX2)
+	const __m256i low256 = _mm256_set1_epi64x(0x0FFFFFFF);
+	const __m256i mask256 = _mm256_set1_epi32(0x3FFF);
+	for(; i + 16 < count; i += 16) {
+		const uint8_t *g = in + (size_t)i / 4 * 7;
+		int64_t w[4];
+		memcpy(&w[0], g, 8);
+		memcpy(&w[1], g + 7, 8);
+		memcpy(&w[2], g + 14, 8);
+		memcpy(&w[3], g + 21, 8);
+		// 56 bit quads split in 28 bit pairs, then in 14 bit samples moved back to the top of 16 bits
+		__m256i q = _mm256_set_epi64x(w[3], w[2], w[1], w[0]);
+		__m256i p = _mm256_or_si256(_mm256_and_si256(q, low256), _mm256_slli_epi64(_mm256_and_si256(_mm256_srli_epi64(q, 28), low256), 32));
+		__m256i v = _mm256_or_si256(_mm256_and_si256(p, mask256), _mm256_slli_epi32(_mm256_srli_epi32(p, 14), 16));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_slli_epi16(v, 2));
+	}
+#elif defined(FMC_HAVE_SSE2)
+	const __m128i low128 = _mm_set_epi32(0, 0x0FFFFFFF, 0, 0x0FFFFFFF);
+	const __m128i mask128 = _mm_set1_epi32(0x3FFF);
+	for(; i + 8 < count; i += 8) {
+		const uint8_t *g = in + (size_t)i / 4 * 7;
+		__m128i q = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)g), _mm_loadl_epi64((const __m128i *)(g + 7)));
+		__m128i p = _mm_or_si128(_mm_and_si128(q, low128), _mm_slli_epi64(_mm_and_si128(_mm_srli_epi64(q, 28), low128), 32));
+		__m128i v = _mm_or_si128(_mm_and_si128(p, mask128), _mm_slli_epi32(_mm_srli_epi32(p, 14), 16));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_slli_epi16(v, 2));
+	}
+#endif
+	for(; i < count; i += 4) {
+		uint32_t n = (count - i < 4) ? count - i : 4;
+		const uint8_t *g = in + (size_t)i / 4 * 7;
+		uint64_t q = 0;
+		for(uint32_t j = 0; j < Packed14_Bytes(n); j++)
+			q |= (uint64_t)g[j] << (8 * j);
+		for(uint32_t j = 0; j < n; j++)
+			out[i + j] = (int16_t)(uint16_t)(((q >> (14 * j)) & ADC_DATA_MASK) << 2);
+	}
+}
+
+/**
+*  Pack consecutive bursts into the blocks of a CAPTURE_FORMAT_PACKED14 capture file, zero padded up to blockSize.
+*  The blocks may be written over the bursts, see Packed14_Pack().
+*
+*  @param in	nbrBursts bursts of burstSamples samples
+*  @param burstSamples	samples per burst ( twice the burst size for ADC0/ADC1 pairs )
+*  @param nbrBursts	number of bursts
+*  @param out	receives nbrBursts blocks of blockSize bytes
+*  @param blockSize	distance between two blocks in bytes, at least Packed14_Bytes(burstSamples) and at most 2 * burstSamples
+*/
+static void Packed14_PackBursts(const int16_t *in, uint32_t burstSamples, uint32_t nbrBursts, uint8_t *out, uint32_t blockSize)
+{
+	const uint32_t packedBytes = Packed14_Bytes(burstSamples);
+	for(uint32_t b = 0; b < nbrBursts; b++) {
+		uint8_t *block = out + (size_t)b * blockSize;
+		Packed14_Pack(in + (size_t)b * burstSamples, burstSamples, block);
+		memset(block + packedBytes, 0, blockSize - packedBytes);
+	}
+}
+
+/**
+*  Encode one block of the delta codec: a header byte holding the bit width of the block ( bits 0-4 ) and
+*  CODEC_BLOCK_SHIFTED, the first sample as a little endian 16 bit value, then the zig-zag coded differences between
+*  consecutive samples packed on that many bits, least significant bit first. When the two low bits of every sample
+*  are zero, as with the left justified 14 bit ADC data, the samples are shifted right by two before coding.
+*  Differences and zig-zag codes wrap around on 16 bits, so any int16 data is coded without loss.
+*
+*  @param x	samples
+*  @param count	number of samples, 1 to CODEC_BLOCK_SAMPLES
+*  @param stride	distance between two samples ( 2 for ADC0/ADC1 pairs )
+*  @param out	receives the block, up to 3 + 2*count bytes
+*  @return number of bytes written
+*/
+static uint32_t DeltaCodec_EncodeBlock(const int16_t *x, uint32_t count, uint32_t stride, uint8_t *out)
+{
+	int16_t v[CODEC_BLOCK_SAMPLES];
+	uint16_t zz[CODEC_BLOCK_SAMPLES];
+	uint32_t i;
+
+	if(stride == 1)
+		memcpy(v, x, count * sizeof(int16_t));
+	else {
+		for(i = 0; i < count; i++)
+			v[i] = x[(size_t)i * stride];
+	}
+
+	// drop the low bits when the whole block leaves them unused
+	uint16_t lowBits = 0;
+	i = 0;
+#ifdef FMC_HAVE_SSE2
+	__m128i low128 = _mm_setzero_si128();
+	for(; i + 8 <= count; i += 8)
+		low128 = _mm_or_si128(low128, _mm_loadu_si128((const __m128i *)(v + i)));
+	low128 = _mm_or_si128(low128, _mm_srli_si128(low128, 8));
+	low128 = _mm_or_si128(low128, _mm_srli_si128(low128, 4));
+	low128 = _mm_or_si128(low128, _mm_srli_si128(low128, 2));
+	lowBits = (uint16_t)_mm_cvtsi128_si32(low128);
+#endif
+	for(; i < count; i++)
+		lowBits |= (uint16_t)v[i];
+	const int shift = (lowBits & 3) == 0 ? 2 : 0;
+
+	// zig-zag coded differences, and the OR of all of them for the bit width
+	uint16_t all = 0;
+	i = 1;
+#if defined(FMC_HAVE_AVX2)
+	const __m128i shift128 = _mm_cvtsi32_si128(shift);
+	__m256i all256 = _mm256_setzero_si256();
+	for(; i + 16 <= count; i += 16) {
+		__m256i cur = _mm256_sra_epi16(_mm256_loadu_si256((const __m256i *)(v + i)), shift128);
+		__m256i prev = _mm256_sra_epi16(_mm256_loadu_si256((const __m256i *)(v + i - 1)), shift128);
+		__m256i d = _mm256_sub_epi16(cur, prev);
+		__m256i z = _mm256_xor_si256(_mm256_slli_epi16(d, 1), _mm256_srai_epi16(d, 15));
+		_mm256_storeu_si256((__m256i *)(zz + i), z);
+		all256 = _mm256_or_si256(all256, z);
+	}
+	__m128i all128 = _mm_or_si128(_mm256_castsi256_si128(all256), _mm256_extracti128_si256(all256, 1));
+#elif defined(FMC_HAVE_SSE2)
+	const __m128i shift128 = _mm_cvtsi32_si128(shift);
+	__m128i all128 = _mm_setzero_si128();
+	for(; i + 8 <= count; i += 8) {
+		__m128i cur = _mm_sra_epi16(_mm_loadu_si128((const __m128i *)(v + i)), shift128);
+		__m128i prev = _mm_sra_epi16(_mm_loadu_si128((const __m128i *)(v + i - 1)), shift128);
+		__m128i d = _mm_sub_epi16(cur, prev);
+		__m128i z = _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+		_mm_storeu_si128((__m128i *)(zz + i), z);
+		all128 = _mm_or_si128(all128, z);
+	}
+#endif
+#ifdef FMC_HAVE_SSE2
+	all128 = _mm_or_si128(all128, _mm_srli_si128(all128, 8));
+	all128 = _mm_or_si128(all128, _mm_srli_si128(all128, 4));
+	all128 = _mm_or_si128(all128, _mm_srli_si128(all128, 2));
+	all = (uint16_t)_mm_cvtsi128_si32(all128);
+#endif
+	for(; i < count; i++) {
+		int16_t d = (int16_t)((v[i] >> shift) - (v[i - 1] >> shift));
+		zz[i] = (uint16_t)((uint16_t)(d << 1) ^ (uint16_t)(d >> 15));
+		all |= zz[i];
+	}
+	uint32_t width = 0;
+	while(width < 16 && (all >> width) != 0)
+		width++;
+
+	uint16_t first = (uint16_t)(v[0] >> shift);
+	out[0] = (uint8_t)(width | (shift ? CODEC_BLOCK_SHIFTED : 0));
+	out[1] = (uint8_t)first;
+	out[2] = (uint8_t)(first >> 8);
+
+	// pack the codes through a 64 bit accumulator
+	uint8_t *p = out + 3;
+	uint64_t acc = 0;
+	uint32_t bits = 0;
+	for(i = 1; width > 0 && i < count; i++) {
+		acc |= (uint64_t)zz[i] << bits;
+		bits += width;
+		while(bits >= 8) {
+			*p++ = (uint8_t)acc;
+			acc >>= 8;
+			bits -= 8;
+		}
+	}
+	if(bits > 0)
+		*p++ = (uint8_t)acc;
+	return (uint32_t)(p - out);
+}
+
+/**
+*  Largest output of DeltaCodec_Encode().
+*
+*  @param count	number of samples
+*  @return size in bytes
+*/
+static uint32_t DeltaCodec_MaxBytes(uint32_t count)
+{
+	return (count + CODEC_BLOCK_SAMPLES - 1) / CODEC_BLOCK_SAMPLES * 3 + 2 * count;
+}
+
+/**
+*  Lossless coding of a run of int16 samples as consecutive blocks of CODEC_BLOCK_SAMPLES samples ( the last one
+*  may be shorter ), see DeltaCodec_EncodeBlock(). The output is not delimited, the decoder needs the number of
+*  samples. capfile.py holds the matching decoder.
+*
+*  @param x	samples
+*  @param count	number of samples
+*  @param stride	distance between two samples ( 2 for ADC0/ADC1 pairs )
+*  @param out	receives up to DeltaCodec_MaxBytes(count) bytes
+*  @return number of bytes written
+*/
+static uint32_t DeltaCodec_Encode(const int16_t *x, uint32_t count, uint32_t stride, uint8_t *out)
+{
+	uint32_t bytes = 0;
+	for(uint32_t i = 0; i < count; i += CODEC_BLOCK_SAMPLES) {
+		uint32_t n = (count - i < CODEC_BLOCK_SAMPLES) ? count - i : CODEC_BLOCK_SAMPLES;
+		bytes += DeltaCodec_EncodeBlock(x + (size_t)i * stride, n, stride, out + bytes);
+	}
+	return bytes;
+}
+
+
+/**
+*  Header of a capture file ( .cap ). The header fills the first CAPTURE_PAGE_SIZE bytes of the file and is followed
+*  by one block per burst. Every block starts on a page boundary and holds burstSize little endian int16 samples,
+*  padded with zeros up to blockSize bytes, so the sample area can be memory mapped and used without any copy.
+*  All fields have a fixed size and are laid out without implicit padding.
+*
+*  Delta coded files ( CAPTURE_FORMAT_DELTA and CAPTURE_FORMAT_DELTA_PAIRS, blockSize 0 ) hold chunks instead of
+*  blocks: a CaptureChunkHeader followed by the DeltaCodec_Encode() output of every burst of the chunk, one run per
+*  channel, and zero padding up to chunkBytes.
+*/
+typedef struct {
+	char magic[8];							/*!< CAPTURE_FILE_MAGIC */
+	uint32_t version;						/*!< CAPTURE_FILE_VERSION */
+	uint32_t headerSize;					/*!< offset of the first burst block in bytes */
+	uint32_t constellationId;				/*!< constellation ID as returned by cid_getconstellationid() */
+	int32_t vcxoType;						/*!< FMC150_VCXO_xxx value passed to fmc15x_init() */
+	int32_t card;							/*!< FMC card index ( 0 or 1 ) */
+	int32_t channel;						/*!< CAPTURE_CHANNEL_xxx */
+	uint32_t burstSize;						/*!< number of samples per burst */
+	uint32_t blockSize;						/*!< distance between two bursts in bytes, multiple of CAPTURE_PAGE_SIZE, 0 for delta coded files */
+	uint32_t sampleFormat;					/*!< CAPTURE_FORMAT_xxx */
+	uint32_t reserved;						/*!< zero */
+	double referenceFreq;					/*!< reference frequency in MHz as returned by sipif_getsipcmdfreq() */
+	double sampleRate;						/*!< sample rate in Hz */
+	uint64_t nbrBursts;						/*!< number of burst blocks following the header */
+	int64_t startTime;						/*!< time of the first burst, nanoseconds since 1970-01-01 UTC */
+	int64_t stopTime;						/*!< time of the last burst, nanoseconds since 1970-01-01 UTC */
+} CaptureFileHeader;
+static_assert(sizeof(CaptureFileHeader) == 88, "capture file header layout must not change");
+
+/**
+*  Header of a chunk of bursts in a delta coded capture file.
+*/
+typedef struct {
+	uint32_t nbrBursts;						/*!< number of bursts in the chunk */
+	uint32_t payloadBytes;					/*!< coded bytes following this header */
+	uint32_t chunkBytes;					/*!< distance to the next chunk, this header and the padding included */
+	uint32_t reserved;						/*!< zero */
+} CaptureChunkHeader;
+static_assert(sizeof(CaptureChunkHeader) == 16, "capture chunk header layout must not change");
+
+#ifndef WIN32
+/**
+*  Write of a DirectWriter, identified by its sequence number.
+*/
+typedef struct {
+	const void *buf;						/*!< data, must stay valid until the write completes */
+	uint32_t bytes;							/*!< size of the write */
+	uint64_t offset;						/*!< file offset */
+	int32_t result;							/*!< bytes written or -errno once done */
+	bool done;								/*!< the write completed */
+} DirectWriteRequest;
+
+/**
+*  Writer keeping a file open with O_DIRECT and up to depth writes in flight, submitted through io_uring or, when
+*  the kernel does not provide it, through a pool of pwrite() threads. Writes complete in any order but are
+*  waited for in submission order, so the caller can recycle its buffers in FIFO order.
+*/
+typedef struct {
+	int fd;									/*!< file descriptor */
+	bool direct;							/*!< O_DIRECT is in effect, buffers and sizes must be page aligned */
+	uint32_t depth;							/*!< maximum number of writes in flight */
+	std::vector<DirectWriteRequest> req;	/*!< writes in flight, indexed by sequence number modulo depth */
+	uint64_t submitted;						/*!< sequence number of the next write */
+	uint64_t waited;						/*!< sequence number of the oldest write not yet waited for */
+#ifdef FMC_HAVE_IO_URING
+	int ringFd;								/*!< io_uring instance, -1 when the thread pool is used */
+	void *sqRing, *cqRing;					/*!< mapped submission and completion rings */
+	size_t sqRingSize, cqRingSize;
+	struct io_uring_sqe *sqes;				/*!< mapped submission queue entries */
+	size_t sqesSize;
+	unsigned *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe *cqes;
+#endif
+	std::vector<std::thread> workers;		/*!< pwrite() threads */
+	uint64_t queued;						/*!< sequence number of the next write taken by a worker */
+	bool stopping;							/*!< set to stop the workers */
+	std::mutex lock;
+	std::condition_variable cond;
+} DirectWriter;
+
+#ifdef FMC_HAVE_IO_URING
+/**
+*  Set up an io_uring instance with room for depth writes.
+*
+*  @param dw	writer
+*  @return
+*						- -1 ( io_uring not available )
+*						- 0 ( Success )
+*/
+static int32_t DirectWriter_SetupUring(DirectWriter *dw)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	dw->ringFd = (int)syscall(__NR_io_uring_setup, dw->depth, &params);
+	if(dw->ringFd < 0)
+		return -1;
+
+	dw->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	dw->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	dw->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	dw->sqRing = mmap(NULL, dw->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dw->ringFd, IORING_OFF_SQ_RING);
+	dw->cqRing = mmap(NULL, dw->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dw->ringFd, IORING_OFF_CQ_RING);
+	void *sqes = mmap(NULL, dw->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dw->ringFd, IORING_OFF_SQES);
+	if(dw->sqRing == MAP_FAILED || dw->cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+		if(dw->sqRing != MAP_FAILED)
+			munmap(dw->sqRing, dw->sqRingSize);
+		if(dw->cqRing != MAP_FAILED)
+			munmap(dw->cqRing, dw->cqRingSize);
+		if(sqes != MAP_FAILED)
+			munmap(sqes, dw->sqesSize);
+		close(dw->ringFd);
+		dw->ringFd = -1;
+		return -1;
+	}
+	dw->sqes = (struct io_uring_sqe *)sqes;
+	dw->sqTail = (unsigned *)((uint8_t *)dw->sqRing + params.sq_off.tail);
+	dw->sqMask = (unsigned *)((uint8_t *)dw->sqRing + params.sq_off.ring_mask);
+	dw->sqArray = (unsigned *)((uint8_t *)dw->sqRing + params.sq_off.array);
+	dw->cqHead = (unsigned *)((uint8_t *)dw->cqRing + params.cq_off.head);
+	dw->cqTail = (unsigned *)((uint8_t *)dw->cqRing + params.cq_off.tail);
+	dw->cqMask = (unsigned *)((uint8_t *)dw->cqRing + params.cq_off.ring_mask);
+	dw->cqes = (struct io_uring_cqe *)((uint8_t *)dw->cqRing + params.cq_off.cqes);
+	return 0;
+}
+
+/**
+*  Mark the writes found in the completion ring as done.
+*
+*  @param dw	writer using io_uring
+*/
+static void DirectWriter_ReapUring(DirectWriter *dw)
+{
+	unsigned head = *dw->cqHead;
+	unsigned tail = __atomic_load_n(dw->cqTail, __ATOMIC_ACQUIRE);
+	for(; head != tail; head++) {
+		const struct io_uring_cqe *cqe = &dw->cqes[head & *dw->cqMask];
+		DirectWriteRequest *r = &dw->req[cqe->user_data % dw->depth];
+		r->result = cqe->res;
+		r->done = true;
+	}
+	__atomic_store_n(dw->cqHead, head, __ATOMIC_RELEASE);
+}
+#endif
+
+/**
+*  Create a file for direct writes, replacing any existing file, and reserve its space on the disk.
+*
+*  @param dw	writer to open
+*  @param filename	pointer to a string representing the filename/path
+*  @param preallocate	expected size of the file in bytes, 0 to skip the reservation
+*  @param depth	maximum number of writes in flight
+*  @return
+*						- -3 ( cannot create the file )
+*						- 0 ( Success )
+*/
+static int32_t DirectWriter_Open(DirectWriter *dw, const char *filename, uint64_t preallocate, uint32_t depth)
+{
+	dw->direct = true;
+	dw->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if(dw->fd < 0 && errno == EINVAL) {
+		// the file system does not support direct I/O ( tmpfs ), go through the page cache
+		dw->direct = false;
+		dw->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(dw->fd < 0) {
+		printf("DirectWriter_Open() -> Cannot open file '%s' with write access\n", filename);
+		return -3;
+	}
+	// reserve the blocks up front so the file system does not allocate them write after write
+	if(preallocate > 0 && fallocate(dw->fd, 0, 0, (off_t)preallocate) != 0)
+		printf("DirectWriter_Open() -> cannot preallocate %llu bytes for '%s', writing without\n", (unsigned long long)preallocate, filename);
+
+	dw->depth = depth > 0 ? depth : 1;
+	dw->req.assign(dw->depth, DirectWriteRequest());
+	dw->submitted = dw->waited = dw->queued = 0;
+	dw->stopping = false;
+#ifdef FMC_HAVE_IO_URING
+	if(DirectWriter_SetupUring(dw) == 0)
+		return 0;
+#endif
+	// no io_uring, one pwrite() thread per write in flight
+	for(uint32_t i = 0; i < dw->depth; i++) {
+		dw->workers.push_back(std::thread([dw] {
+			std::unique_lock<std::mutex> guard(dw->lock);
+			for(;;) {
+				dw->cond.wait(guard, [dw] { return dw->stopping || dw->queued < dw->submitted; });
+				if(dw->queued == dw->submitted)
+					return;
+				DirectWriteRequest *r = &dw->req[dw->queued++ % dw->depth];
+				guard.unlock();
+				uint32_t written = 0;
+				int32_t result = 0;
+				while(written < r->bytes) {
+					ssize_t n = pwrite(dw->fd, (const uint8_t *)r->buf + written, r->bytes - written, (off_t)(r->offset + written));
+					if(n <= 0) {
+						result = (n < 0) ? -errno : -EIO;
+						break;
+					}
+					written += (uint32_t)n;
+				}
+				guard.lock();
+				r->result = result < 0 ? result : (int32_t)written;
+				r->done = true;
+				dw->cond.notify_all();
+			}
+		}));
+	}
+	return 0;
+}
+
+/**
+*  Wait for the oldest write in flight.
+*
+*  @param dw	open writer
+*  @return
+*						- -4 ( the write failed )
+*						- 0 ( Success )
+*/
+static int32_t DirectWriter_WaitOldest(DirectWriter *dw)
+{
+	if(dw->waited == dw->submitted)
+		return 0;
+	DirectWriteRequest *r = &dw->req[dw->waited % dw->depth];
+#ifdef FMC_HAVE_IO_URING
+	if(dw->ringFd >= 0) {
+		DirectWriter_ReapUring(dw);
+		while(!r->done) {
+			syscall(__NR_io_uring_enter, dw->ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			DirectWriter_ReapUring(dw);
+		}
+	}
+	else
+#endif
+	{
+		std::unique_lock<std::mutex> guard(dw->lock);
+		dw->cond.wait(guard, [r] { return r->done; });
+	}
+	dw->waited++;
+	if(r->result != (int32_t)r->bytes) {
+		printf("DirectWriter_WaitOldest() -> write of %u bytes at %llu failed (%d)\n", r->bytes, (unsigned long long)r->offset, r->result);
+		return -4;
+	}
+	return 0;
+}
+
+/**
+*  Submit a write, waiting for the oldest one first when depth writes are already in flight. With O_DIRECT the
+*  buffer, size and offset must be multiples of CAPTURE_PAGE_SIZE.
+*
+*  @param dw	open writer
+*  @param buf	data, must stay valid until the write has been waited for
+*  @param bytes	size of the write
+*  @param offset	file offset
+*  @return
+*						- -4 ( the oldest write failed or the submission failed )
+*						- 0 ( Success )
+*/
+static int32_t DirectWriter_Submit(DirectWriter *dw, const void *buf, uint32_t bytes, uint64_t offset)
+{
+	int32_t rc = 0;
+	if(dw->submitted - dw->waited == dw->depth)
+		rc = DirectWriter_WaitOldest(dw);
+
+	DirectWriteRequest *r = &dw->req[dw->submitted % dw->depth];
+	r->buf = buf;
+	r->bytes = bytes;
+	r->offset = offset;
+	r->result = 0;
+	r->done = false;
+#ifdef FMC_HAVE_IO_URING
+	if(dw->ringFd >= 0) {
+		unsigned tail = *dw->sqTail;
+		unsigned index = tail & *dw->sqMask;
+		struct io_uring_sqe *sqe = &dw->sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = dw->fd;
+		sqe->addr = (uint64_t)(uintptr_t)buf;
+		sqe->len = bytes;
+		sqe->off = offset;
+		sqe->user_data = dw->submitted;
+		dw->sqArray[index] = index;
+		__atomic_store_n(dw->sqTail, tail + 1, __ATOMIC_RELEASE);
+		dw->submitted++;
+		if(syscall(__NR_io_uring_enter, dw->ringFd, 1, 0, 0, NULL, 0) != 1) {
+			printf("DirectWriter_Submit() -> io_uring submission failed\n");
+			r->result = -EIO;
+			r->done = true;
+			return -4;
+		}
+		return rc;
+	}
+#endif
+	std::lock_guard<std::mutex> guard(dw->lock);
+	dw->submitted++;
+	dw->cond.notify_all();
+	return rc;
+}
+
+/**
+*  Wait for every write in flight, set the final size of the file and close it.
+*
+*  @param dw	open writer
+*  @param size	final size of the file in bytes
+*  @return
+*						- -4 ( a write failed )
+*						- 0 ( Success )
+*/
+static int32_t DirectWriter_Close(DirectWriter *dw, uint64_t size)
+{
+	int32_t rc = 0;
+	while(dw->waited < dw->submitted) {
+		if(DirectWriter_WaitOldest(dw) != 0)
+			rc = -4;
+	}
+	{
+		std::lock_guard<std::mutex> guard(dw->lock);
+		dw->stopping = true;
+		dw->cond.notify_all();
+	}
+	for(size_t i = 0; i < dw->workers.size(); i++)
+		dw->workers[i].join();
+	dw->workers.clear();
+#ifdef FMC_HAVE_IO_URING
+	if(dw->ringFd >= 0) {
+		munmap(dw->sqes, dw->sqesSize);
+		munmap(dw->cqRing, dw->cqRingSize);
+		munmap(dw->sqRing, dw->sqRingSize);
+		close(dw->ringFd);
+		dw->ringFd = -1;
+	}
+#endif
+	// drop the preallocated blocks that were not used
+	if(ftruncate(dw->fd, (off_t)size) != 0)
+		rc = -4;
+	if(close(dw->fd) != 0)
+		rc = -4;
+	dw->fd = -1;
+	return rc;
+}
+#endif
+
+/**
+*  Capture file opened for writing.
+*/
+typedef struct {
+	FILE *fOutFile;
+	CaptureFileHeader header;
+	uint64_t dataBytes;						/*!< bytes written after the header */
+	uint32_t queueDepth;					/*!< writes CaptureFile_SubmitBursts() may keep in flight, 1 for stdio writes */
+#ifndef WIN32
+	DirectWriter *direct;					/*!< direct writer of a streaming capture, NULL for stdio writes */
+	uint8_t *staging[NBR_RING_SLOTS_MAX];	/*!< coded chunks in flight of a delta coded direct capture */
+	uint32_t stagingSize;					/*!< size of each staging buffer */
+	uint32_t maxBursts;						/*!< largest CaptureFile_SubmitBursts() call of a delta coded direct capture */
+	uint64_t nbrChunks;						/*!< chunks submitted so far, selects the staging buffer */
+#endif
+} CaptureFile;
+
+static uint32_t g_writeQueueDepth = WRITE_QUEUE_DEFAULT_DEPTH;	/*!< direct writes in flight of a streaming capture, see --write-queue */
+static bool g_captureCompression = false;		/*!< delta code the ADC capture files, see --compress */
+static bool g_capturePacking = false;			/*!< pack the ADC capture files on 14 bits, see --pack */
+
+/**
+*  Current time in nanoseconds since 1970-01-01 UTC, as stored in the capture file header.
+*/
+static int64_t GetTimestampNs(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+*  Fill a capture file header with the description of the board. The channel, burst count and timestamps are
+*  set when the file is written.
+*
+*  @param header	header to fill
+*  @param constellationId	constellation ID
+*  @param vcxoType	VCXO type
+*  @param referenceFreq	reference frequency in MHz
+*  @param sampleRate	sample rate in Hz ( as measured by fmc15x_freqcnt_getfrequency() )
+*  @param BurstSize	number of samples per burst
+*  @param card	FMC card index
+*/
+static void CaptureFile_InitHeader(CaptureFileHeader *header, uint16_t constellationId, int32_t vcxoType, float referenceFreq,
+								   double sampleRate, int32_t BurstSize, int32_t card)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, CAPTURE_FILE_MAGIC, sizeof(header->magic));
+	header->version = CAPTURE_FILE_VERSION;
+	header->headerSize = CAPTURE_PAGE_SIZE;
+	header->constellationId = constellationId;
+	header->vcxoType = vcxoType;
+	header->card = card;
+	header->channel = CAPTURE_CHANNEL_ADC0;
+	header->burstSize = BurstSize;
+	header->blockSize = (2 * BurstSize + CAPTURE_PAGE_SIZE - 1) / CAPTURE_PAGE_SIZE * CAPTURE_PAGE_SIZE;
+	header->sampleFormat = CAPTURE_FORMAT_INT16;
+	header->referenceFreq = referenceFreq;
+	header->sampleRate = sampleRate;
+}
+
+/**
+*  Copy the board description to the header of a capture file being created.
+*
+*  @param cap	capture file being opened
+*  @param header	board description, see CaptureFile_InitHeader()
+*  @param channel	CAPTURE_CHANNEL_xxx
+*/
+static void CaptureFile_SetupHeader(CaptureFile *cap, const CaptureFileHeader *header, int32_t channel)
+{
+	cap->header = *header;
+	cap->header.channel = channel;
+	if(channel == CAPTURE_CHANNEL_ADC01) {
+		cap->header.sampleFormat = CAPTURE_FORMAT_INT16_PAIRS;
+		cap->header.blockSize = (4 * header->burstSize + CAPTURE_PAGE_SIZE - 1) / CAPTURE_PAGE_SIZE * CAPTURE_PAGE_SIZE;
+	}
+	bool adc = (channel == CAPTURE_CHANNEL_ADC0 || channel == CAPTURE_CHANNEL_ADC1 || channel == CAPTURE_CHANNEL_ADC01);
+	uint32_t burstSamples = (channel == CAPTURE_CHANNEL_ADC01 ? 2 : 1) * header->burstSize;
+	if(g_captureCompression && adc) {
+		cap->header.sampleFormat = (channel == CAPTURE_CHANNEL_ADC01) ? CAPTURE_FORMAT_DELTA_PAIRS : CAPTURE_FORMAT_DELTA;
+		cap->header.blockSize = 0;
+	}
+	else if(g_capturePacking && adc) {
+		cap->header.sampleFormat = (channel == CAPTURE_CHANNEL_ADC01) ? CAPTURE_FORMAT_PACKED14_PAIRS : CAPTURE_FORMAT_PACKED14;
+		cap->header.blockSize = (Packed14_Bytes(burstSamples) + CAPTURE_PAGE_SIZE - 1) / CAPTURE_PAGE_SIZE * CAPTURE_PAGE_SIZE;
+		// blocks are packed over the bursts they come from, they must not be larger ( bursts of less than a page )
+		if(cap->header.blockSize > 2 * burstSamples) {
+			cap->header.sampleFormat = (channel == CAPTURE_CHANNEL_ADC01) ? CAPTURE_FORMAT_INT16_PAIRS : CAPTURE_FORMAT_INT16;
+			cap->header.blockSize = (2 * burstSamples + CAPTURE_PAGE_SIZE - 1) / CAPTURE_PAGE_SIZE * CAPTURE_PAGE_SIZE;
+		}
+	}
+	cap->header.nbrBursts = 0;
+	cap->header.startTime = cap->header.stopTime = 0;
+	cap->dataBytes = 0;
+}
+
+/**
+*  Code bursts as a chunk of a delta coded capture file.
+*
+*  @param cap	delta coded capture file
+*  @param samples	nbrBursts consecutive bursts of burstSize samples ( or sample pairs ) each
+*  @param nbrBursts	number of bursts
+*  @param out	receives up to CaptureFile_MaxChunkBytes() bytes, chunkBytes is left to the caller
+*  @return size of the chunk without padding
+*/
+static uint32_t CaptureFile_EncodeChunk(const CaptureFile *cap, const void *samples, uint32_t nbrBursts, uint8_t *out)
+{
+	const uint32_t nbrChannels = (cap->header.sampleFormat == CAPTURE_FORMAT_DELTA_PAIRS) ? 2 : 1;
+	const uint32_t burstSize = cap->header.burstSize;
+	CaptureChunkHeader chunk;
+	uint32_t bytes = sizeof(chunk);
+
+	for(uint32_t b = 0; b < nbrBursts; b++) {
+		const int16_t *burst = (const int16_t *)samples + (size_t)b * burstSize * nbrChannels;
+		for(uint32_t ch = 0; ch < nbrChannels; ch++)
+			bytes += DeltaCodec_Encode(burst + ch, burstSize, nbrChannels, out + bytes);
+	}
+	chunk.nbrBursts = nbrBursts;
+	chunk.payloadBytes = bytes - sizeof(chunk);
+	chunk.chunkBytes = bytes;
+	chunk.reserved = 0;
+	memcpy(out, &chunk, sizeof(chunk));
+	return bytes;
+}
+
+/**
+*  Largest chunk CaptureFile_EncodeChunk() may produce.
+*
+*  @param cap	delta coded capture file
+*  @param nbrBursts	number of bursts in the chunk
+*  @return size in bytes
+*/
+static uint32_t CaptureFile_MaxChunkBytes(const CaptureFile *cap, uint32_t nbrBursts)
+{
+	const uint32_t nbrChannels = (cap->header.sampleFormat == CAPTURE_FORMAT_DELTA_PAIRS) ? 2 : 1;
+	return sizeof(CaptureChunkHeader) + nbrBursts * nbrChannels * DeltaCodec_MaxBytes(cap->header.burstSize);
+}
+
+/**
+*  Create a capture file, replacing any existing file.
+*
+*  @param cap	capture file to open
+*  @param filename	pointer to a string representing the filename/path
+*  @param header	board description, see CaptureFile_InitHeader()
+*  @param channel	CAPTURE_CHANNEL_xxx
+*  @return
+*						- -1 ( Unexpected NULL argument )
+*						- -3 ( cannot create the file )
+*						- 0 ( Success )
+*/
+static int32_t CaptureFile_Open(CaptureFile *cap, const char *filename, const CaptureFileHeader *header, int32_t channel)
+{
+	static const uint8_t zeros[CAPTURE_PAGE_SIZE] = { 0 };
+
+	if(!cap || !filename || !header) {
+		printf("CaptureFile_Open() -> unexpected NULL argument\n");
+		return -1;
+	}
+
+	CaptureFile_SetupHeader(cap, header, channel);
+	cap->queueDepth = 1;
+#ifndef WIN32
+	cap->direct = NULL;
+	cap->stagingSize = 0;
+#endif
+	cap->fOutFile = fopen(filename, "wb");
+	if(cap->fOutFile == NULL) {
+		printf("CaptureFile_Open() -> Cannot open file '%s' with write access\n", filename);
+		return -3;
+	}
+
+	// reserve the header page, the real header is written by CaptureFile_Close()
+	fwrite(zeros, 1, CAPTURE_PAGE_SIZE, cap->fOutFile);
+	return 0;
+}
+
+/**
+*  Check whether a capture file stores its samples packed on 14 bits.
+*
+*  @param cap	open capture file
+*  @return true for CAPTURE_FORMAT_PACKED14 and CAPTURE_FORMAT_PACKED14_PAIRS
+*/
+static bool CaptureFile_IsPacked(const CaptureFile *cap)
+{
+	return cap->header.sampleFormat == CAPTURE_FORMAT_PACKED14 || cap->header.sampleFormat == CAPTURE_FORMAT_PACKED14_PAIRS;
+}
+
+/**
+*  Append bursts to a capture file.
+*
+*  @param cap	capture file opened with CaptureFile_Open()
+*  @param samples	nbrBursts consecutive bursts of burstSize samples ( or sample pairs ) each, or nbrBursts blocks
+*					filled by Packed14_PackBursts() for a packed file
+*  @param nbrBursts	number of bursts
+*  @return
+*						- -4 ( write failed )
+*						- 0 ( Success )
+*/
+static int32_t CaptureFile_AppendBursts(CaptureFile *cap, const void *samples, uint32_t nbrBursts)
+{
+	static const uint8_t zeros[CAPTURE_PAGE_SIZE] = { 0 };
+	const uint32_t burstBytes = (cap->header.sampleFormat == CAPTURE_FORMAT_INT16_PAIRS ? 4 : 2) * cap->header.burstSize;
+	const uint32_t padding = cap->header.blockSize - burstBytes;	// unused for delta coded and packed files
+	int64_t now = GetTimestampNs();
+
+	if(cap->header.nbrBursts == 0)
+		cap->header.startTime = now;
+	cap->header.stopTime = now;
+
+	if(cap->header.blockSize == 0) {
+		// delta coded, one chunk for all the bursts
+		static thread_local std::vector<uint8_t> chunk;
+		chunk.resize(CaptureFile_MaxChunkBytes(cap, nbrBursts));
+		uint32_t bytes = CaptureFile_EncodeChunk(cap, samples, nbrBursts, &chunk[0]);
+		if(fwrite(&chunk[0], 1, bytes, cap->fOutFile) != bytes)
+			return -4;
+		cap->dataBytes += bytes;
+	}
+	else if(padding == 0 || CaptureFile_IsPacked(cap)) {
+		// bursts are already page sized ( or packed in blocks ), write them all at once
+		if(fwrite(samples, cap->header.blockSize, nbrBursts, cap->fOutFile) != nbrBursts)
+			return -4;
+		cap->dataBytes += (uint64_t)nbrBursts * cap->header.blockSize;
+	}
+	else {
+		for(uint32_t i = 0; i < nbrBursts; i++) {
+			if(fwrite((const uint8_t *)samples + (size_t)i * burstBytes, 1, burstBytes, cap->fOutFile) != burstBytes ||
+				fwrite(zeros, 1, padding, cap->fOutFile) != padding)
+				return -4;
+		}
+		cap->dataBytes += (uint64_t)nbrBursts * cap->header.blockSize;
+	}
+	cap->header.nbrBursts += nbrBursts;
+	return 0;
+}
+
+/**
+*  Create a capture file for a long stream of bursts, replacing any existing file. When the bursts fill whole pages,
+*  the file is written with a DirectWriter: O_DIRECT writes of the caller's buffers, g_writeQueueDepth of them in
+*  flight, into space reserved for nbrBursts bursts. Delta coded files are written the same way, every call being
+*  coded into a page aligned chunk of its own. Otherwise, or with g_writeQueueDepth set to 0, the file is written
+*  through stdio as with CaptureFile_Open().
+*
+*  @param cap	capture file to open
+*  @param filename	pointer to a string representing the filename/path
+*  @param header	board description, see CaptureFile_InitHeader()
+*  @param channel	CAPTURE_CHANNEL_xxx
+*  @param nbrBursts	expected number of bursts, used to preallocate the file
+*  @param maxBursts	largest number of bursts handed to a single CaptureFile_SubmitBursts() call
+*  @return
+*						- -1 ( Unexpected NULL argument )
+*						- -3 ( cannot create the file )
+*						- 0 ( Success )
+*/
+static int32_t CaptureFile_OpenStream(CaptureFile *cap, const char *filename, const CaptureFileHeader *header, int32_t channel,
+									  uint64_t nbrBursts, uint32_t maxBursts)
+{
+#ifndef WIN32
+	if(cap && filename && header && g_writeQueueDepth > 0) {
+		CaptureFile_SetupHeader(cap, header, channel);
+		uint32_t burstBytes = (cap->header.sampleFormat == CAPTURE_FORMAT_INT16_PAIRS ? 4 : 2) * cap->header.burstSize;
+		if(burstBytes == cap->header.blockSize || cap->header.blockSize == 0 || CaptureFile_IsPacked(cap)) {
+			cap->fOutFile = NULL;
+			cap->queueDepth = g_writeQueueDepth;
+			cap->maxBursts = maxBursts;
+			cap->nbrChunks = 0;
+			cap->stagingSize = 0;
+			uint64_t preallocate = cap->header.headerSize + nbrBursts * cap->header.blockSize;
+			if(cap->header.blockSize == 0) {
+				// coded chunks go through staging buffers, one per write in flight. The space reserved is the size of
+				// the raw samples, the file is trimmed to what was written when closed.
+				cap->stagingSize = (CaptureFile_MaxChunkBytes(cap, maxBursts) + CAPTURE_PAGE_SIZE - 1) & ~(uint32_t)(CAPTURE_PAGE_SIZE - 1);
+				for(uint32_t i = 0; i < cap->queueDepth; i++) {
+					cap->staging[i] = BufferPool_Alloc(&g_bufferPool, cap->stagingSize);
+					if(!cap->staging[i]) {
+						printf("CaptureFile_OpenStream() -> cannot allocate %u bytes\n", cap->stagingSize);
+						for(uint32_t j = 0; j < i; j++)
+							BufferPool_Free(&g_bufferPool, cap->staging[j]);
+						return -1;
+					}
+				}
+				preallocate = cap->header.headerSize + nbrBursts * burstBytes;
+			}
+			cap->direct = new DirectWriter;
+			if(DirectWriter_Open(cap->direct, filename, preallocate, cap->queueDepth) != 0) {
+				for(uint32_t i = 0; cap->stagingSize > 0 && i < cap->queueDepth; i++)
+					BufferPool_Free(&g_bufferPool, cap->staging[i]);
+				delete cap->direct;
+				cap->direct = NULL;
+				return -3;
+			}
+#ifdef FMC_HAVE_IO_URING
+			bool uring = cap->direct->ringFd >= 0;
+#else
+			bool uring = false;
+#endif
+			printf("Writing '%s' with %s%s, %u writes in flight%s\n", filename, uring ? "io_uring" : "pwrite() threads",
+				cap->direct->direct ? " and O_DIRECT" : "", cap->queueDepth,
+				cap->stagingSize ? ", delta coded" : (CaptureFile_IsPacked(cap) ? ", packed on 14 bits" : ""));
+			return 0;
+		}
+	}
+#endif
+	return CaptureFile_Open(cap, filename, header, channel);
+}
+
+/**
+*  Hand bursts over to a capture file. Files opened with CaptureFile_Open() write them before returning. Files
+*  written by a DirectWriter only queue the write: the buffer must stay untouched until CaptureFile_WaitBursts()
+*  has returned for this call, calls being waited for in order.
+*
+*  Delta coded files are coded before returning, so only the coded chunk stays in flight.
+*
+*  @param cap	capture file opened with CaptureFile_Open() or CaptureFile_OpenStream()
+*  @param samples	nbrBursts consecutive bursts ( blocks for a packed file ), 4 KiB aligned for a DirectWriter
+*  @param nbrBursts	number of bursts
+*  @return
+*						- -4 ( write failed, or more than maxBursts bursts for a delta coded file )
+*						- 0 ( Success )
+*/
+static int32_t CaptureFile_SubmitBursts(CaptureFile *cap, const void *samples, uint32_t nbrBursts)
+{
+#ifndef WIN32
+	if(cap->direct) {
+		int64_t now = GetTimestampNs();
+		if(cap->header.nbrBursts == 0)
+			cap->header.startTime = now;
+		cap->header.stopTime = now;
+		uint64_t offset = cap->header.headerSize + cap->dataBytes;
+		uint32_t bytes = nbrBursts * cap->header.blockSize;
+		if(cap->header.blockSize == 0) {
+			if(nbrBursts > cap->maxBursts)
+				return -4;
+			// the staging buffer of the write queued depth chunks ago is free again once DirectWriter_Submit()
+			// has waited for it
+			uint8_t *chunk = cap->staging[cap->nbrChunks++ % cap->queueDepth];
+			if(cap->direct->submitted - cap->direct->waited == cap->queueDepth && DirectWriter_WaitOldest(cap->direct) != 0)
+				return -4;
+			bytes = CaptureFile_EncodeChunk(cap, samples, nbrBursts, chunk);
+			uint32_t padded = (bytes + CAPTURE_PAGE_SIZE - 1) & ~(uint32_t)(CAPTURE_PAGE_SIZE - 1);
+			memset(chunk + bytes, 0, padded - bytes);
+			((CaptureChunkHeader *)chunk)->chunkBytes = padded;
+			samples = chunk;
+			bytes = padded;
+		}
+		cap->header.nbrBursts += nbrBursts;
+		cap->dataBytes += bytes;
+		return DirectWriter_Submit(cap->direct, samples, bytes, offset);
+	}
+#endif
+	return CaptureFile_AppendBursts(cap, samples, nbrBursts);
+}
+
+/**
+*  Wait for the oldest CaptureFile_SubmitBursts() call still in flight.
+*
+*  @param cap	capture file opened with CaptureFile_Open() or CaptureFile_OpenStream()
+*  @return
+*						- -4 ( write failed )
+*						- 0 ( Success )
+*/
+static int32_t CaptureFile_WaitBursts(CaptureFile *cap)
+{
+#ifndef WIN32
+	if(cap->direct)
+		return DirectWriter_WaitOldest(cap->direct);
+#endif
+	return 0;
+}
+
+/**
+*  Write the final header and close a capture file.
+*
+*  @param cap	capture file opened with CaptureFile_Open()
+*  @return
+*						- -4 ( header write failed )
+*						- 0 ( Success )
+*/
+static int32_t CaptureFile_Close(CaptureFile *cap)
+{
+	int32_t rc = 0;
+#ifndef WIN32
+	if(cap->direct) {
+		// the header page is written like the bursts, from a page aligned buffer
+		uint8_t *page = (uint8_t *)_aligned_malloc(CAPTURE_PAGE_SIZE, CAPTURE_PAGE_SIZE);
+		if(!page)
+			rc = -4;
+		else {
+			memset(page, 0, CAPTURE_PAGE_SIZE);
+			memcpy(page, &cap->header, sizeof(cap->header));
+			rc = DirectWriter_Submit(cap->direct, page, CAPTURE_PAGE_SIZE, 0);
+		}
+		if(DirectWriter_Close(cap->direct, cap->header.headerSize + cap->dataBytes) != 0)
+			rc = -4;
+		_aligned_free(page);
+		for(uint32_t i = 0; cap->stagingSize > 0 && i < cap->queueDepth; i++)
+			BufferPool_Free(&g_bufferPool, cap->staging[i]);
+		delete cap->direct;
+		cap->direct = NULL;
+		return rc;
+	}
+#endif
+	if(fseek(cap->fOutFile, 0, SEEK_SET) != 0 || fwrite(&cap->header, sizeof(cap->header), 1, cap->fOutFile) != 1)
+		rc = -4;
+	fclose(cap->fOutFile);
+	cap->fOutFile = NULL;
+	return rc;
+}
+
+/**
+*  Save a single burst as a capture file.
+*
+*  @param buf	burst samples
+*  @param filename	pointer to a string representing the filename/path
+*  @param header	board description, see CaptureFile_InitHeader()
+*  @param channel	CAPTURE_CHANNEL_xxx
+*  @return
+*						- < 0 ( error code from CaptureFile_Open(), CaptureFile_AppendBursts() or CaptureFile_Close() )
+*						- 0 ( Success )
+*/
+static int32_t SaveBurstToCaptureFile(const void *buf, const char *filename, const CaptureFileHeader *header, int32_t channel)
+{
+	CaptureFile cap;
+	int32_t rc = CaptureFile_Open(&cap, filename, header, channel);
+	if(rc != 0)
+		return rc;
+	if(CaptureFile_IsPacked(&cap)) {
+		static thread_local std::vector<uint8_t> block;
+		block.resize(cap.header.blockSize);
+		Packed14_PackBursts((const int16_t *)buf, (cap.header.sampleFormat == CAPTURE_FORMAT_PACKED14_PAIRS ? 2 : 1) * cap.header.burstSize, 1,
+			&block[0], cap.header.blockSize);
+		buf = &block[0];
+	}
+	rc = CaptureFile_AppendBursts(&cap, buf, 1);
+	if(CaptureFile_Close(&cap) != 0 || rc != 0) {
+		printf("SaveBurstToCaptureFile() -> write to '%s' failed\n", filename);
+		return -4;
+	}
+	return 0;
+}
+
+/**
+*  Registers tracked by the shadow register layer. Every register write is a round trip to the board, so writes
+*  that would store the value the register already holds are skipped. Only the routers and the card control
+*  registers, which this application alone programs, are tracked: bus commands such as the I2C switch selection
+*  are always sent, since the vendor library and card resets change them behind the shadow's back.
+*/
+enum {
+	SHADOW_ROUTER = 0,						/*!< sxdx_configurerouter() */
+	SHADOW_CHANNELS,						/*!< fmc15x_ctrl_enable_channel() */
+	SHADOW_BURST,							/*!< fmc15x_ctrl_configure_burst() */
+	SHADOW_PATTERN,							/*!< fmc15x_adc_pattern_check() */
+	SHADOW_NBR_KINDS
+};
+
+static const char *g_shadowNames[SHADOW_NBR_KINDS] = { "routers", "channel enables", "burst settings", "ADC pattern mode" };
+static std::mutex g_shadowLock;
+static std::map<uint64_t, uint64_t> g_shadowRegs;		/*!< last value written, keyed by kind << 32 | address */
+static uint64_t g_shadowWritten[SHADOW_NBR_KINDS];
+static uint64_t g_shadowSkipped[SHADOW_NBR_KINDS];
+static bool g_shadowEnabled = true;
+
+/**
+*  Check whether a register write is needed. Writes to the same register must be serialized by the caller, which
+*  the router and I2C switch locks already do for the routers and the cards.
+*
+*  @return true when the register may not hold value yet
+*/
+static bool ShadowReg_NeedWrite(uint32_t kind, uint32_t addr, uint64_t value)
+{
+	std::lock_guard<std::mutex> guard(g_shadowLock);
+	std::map<uint64_t, uint64_t>::iterator it = g_shadowRegs.find((uint64_t)kind << 32 | addr);
+	if(g_shadowEnabled && it != g_shadowRegs.end() && it->second == value) {
+		g_shadowSkipped[kind]++;
+		return false;
+	}
+	g_shadowWritten[kind]++;
+	return true;
+}
+
+/**
+*  Record the outcome of a register write. A failed write leaves the register state unknown.
+*/
+static void ShadowReg_Update(uint32_t kind, uint32_t addr, uint64_t value, bool written)
+{
+	std::lock_guard<std::mutex> guard(g_shadowLock);
+	if(written)
+		g_shadowRegs[(uint64_t)kind << 32 | addr] = value;
+	else
+		g_shadowRegs.erase((uint64_t)kind << 32 | addr);
+}
+
+/**
+*  Forget the shadowed card control values after fmc15x_init() reset a card. The routers are not part of the card
+*  and keep their values.
+*/
+static void ShadowReg_InvalidateCard(void)
+{
+	std::lock_guard<std::mutex> guard(g_shadowLock);
+	g_shadowRegs.erase(g_shadowRegs.lower_bound((uint64_t)SHADOW_CHANNELS << 32), g_shadowRegs.end());
+}
+
+/**
+*  sxdx_configurerouter() skipping settings the router already has.
+*/
+static int32_t ShadowReg_ConfigureRouter(uint32_t addr, uint64_t setting)
+{
+	if(!ShadowReg_NeedWrite(SHADOW_ROUTER, addr, setting))
+		return SXDXROUTER_ERR_OK;
+	int32_t rc = sxdx_configurerouter(addr, setting);
+	ShadowReg_Update(SHADOW_ROUTER, addr, setting, rc == SXDXROUTER_ERR_OK);
+	return rc;
+}
+
+/**
+*  fmc15x_ctrl_enable_channel() skipping channel selections already in place.
+*/
+static int32_t ShadowReg_EnableChannel(uint32_t addr, int32_t adc0, int32_t adc1, int32_t dac0, int32_t dac1)
+{
+	uint64_t value = (uint64_t)(adc0 == ENABLED) | (uint64_t)(adc1 == ENABLED) << 1 | (uint64_t)(dac0 == ENABLED) << 2 |
+		(uint64_t)(dac1 == ENABLED) << 3;
+	if(!ShadowReg_NeedWrite(SHADOW_CHANNELS, addr, value))
+		return FMC15x_CTRL_ERR_OK;
+	int32_t rc = fmc15x_ctrl_enable_channel(addr, adc0, adc1, dac0, dac1);
+	ShadowReg_Update(SHADOW_CHANNELS, addr, value, rc == FMC15x_CTRL_ERR_OK);
+	return rc;
+}
+
+/**
+*  fmc15x_ctrl_configure_burst() skipping burst settings already in place.
+*/
+static int32_t ShadowReg_ConfigureBurst(uint32_t addr, uint32_t nbrBurst, uint32_t burstSize)
+{
+	uint64_t value = (uint64_t)nbrBurst << 32 | burstSize;
+	if(!ShadowReg_NeedWrite(SHADOW_BURST, addr, value))
+		return FMC15x_CTRL_ERR_OK;
+	int32_t rc = fmc15x_ctrl_configure_burst(addr, nbrBurst, burstSize);
+	ShadowReg_Update(SHADOW_BURST, addr, value, rc == FMC15x_CTRL_ERR_OK);
+	return rc;
+}
+
+/**
+*  fmc15x_adc_pattern_check() skipping the call when the ADC is already in the requested mode.
+*/
+static int32_t ShadowReg_AdcPatternCheck(uint32_t addr, bool enable)
+{
+	if(!ShadowReg_NeedWrite(SHADOW_PATTERN, addr, enable))
+		return FMC15x_ADC_ERR_OK;
+	int32_t rc = fmc15x_adc_pattern_check(addr, enable);
+	ShadowReg_Update(SHADOW_PATTERN, addr, enable, rc == FMC15x_ADC_ERR_OK);
+	return rc;
+}
+
+/**
+*  Print the number of register writes made and skipped by the shadow register layer.
+*/
+static void ShadowReg_PrintStats(void)
+{
+	std::lock_guard<std::mutex> guard(g_shadowLock);
+	uint64_t written = 0, skipped = 0;
+	printf("--- Register writes ---\n");
+	for(uint32_t kind = 0; kind < SHADOW_NBR_KINDS; kind++) {
+		printf("%-18s: %6llu written, %6llu skipped\n", g_shadowNames[kind], (unsigned long long)g_shadowWritten[kind],
+			(unsigned long long)g_shadowSkipped[kind]);
+		written += g_shadowWritten[kind];
+		skipped += g_shadowSkipped[kind];
+	}
+	printf("%-18s: %6llu written, %6llu skipped\n", "total", (unsigned long long)written, (unsigned long long)skipped);
+	printf("-----------------------\n");
+}
+
+/**
+*  Operations that can be queued in a SipTransaction.
+*/
+enum {
+	SIPTR_ROUTER = 0,						/*!< sxdx_configurerouter() */
+	SIPTR_CHANNELS,							/*!< fmc15x_ctrl_enable_channel() */
+	SIPTR_ARM,								/*!< fmc15x_ctrl_arm_dac() */
+	SIPTR_TRIGGER							/*!< fmc15x_ctrl_sw_trigger() */
+};
+
+static const char *g_sipTransactionNames[] = { "configure router", "enable channels", "arm DAC", "send software trigger" };
+
+/**
+*  One queued register operation.
+*/
+typedef struct {
+	uint32_t kind;							/*!< SIPTR_xxx */
+	uint32_t addr;							/*!< register or peripheral address */
+	uint64_t value;							/*!< value written, channel selection for SIPTR_CHANNELS */
+} SipTransactionOp;
+
+/**
+*  Register operations flushed together by SipTransaction_Commit(): the per burst control sequence ( router,
+*  channels, arm, trigger ). Over SIPIF_ETHAPI and SIPIF_TCPIP_V4 every register access is a network round trip,
+*  which a batching backend can save. Only the simulated link ( FMC15X_SIM ) has one, the 4DSP libraries still
+*  get the operations one by one.
+*/
+typedef struct {
+	SipTransactionOp op[SIP_TRANSACTION_MAX_OPS];
+	uint32_t nbrOps;						/*!< number of queued operations */
+	int32_t failedOp;						/*!< index of the operation that failed, -1 when none */
+	bool overflow;							/*!< more than SIP_TRANSACTION_MAX_OPS operations were queued */
+} SipTransaction;
+
+#ifdef FMC15X_SIM
+static bool g_sipBatchEnabled = false;	/*!< set for the network interfaces, see SipTransaction_Commit() */
+static uint64_t g_sipBatches;			/*!< number of transactions sent as one batch */
+static uint64_t g_sipBatchedOps;		/*!< operations carried by those batches */
+
+// batch entry points of the simulated link, see fmc15x_sim.cpp
+void sipif_sim_batch_begin(void);
+void sipif_sim_batch_end(void);
+#endif
+
+/**
+*  Start an empty transaction.
+*/
+static void SipTransaction_Begin(SipTransaction *tr)
+{
+	tr->nbrOps = 0;
+	tr->failedOp = -1;
+	tr->overflow = false;
+}
+
+/**
+*  Queue one operation, see the SipTransaction_xxx() wrappers below.
+*/
+static void SipTransaction_Queue(SipTransaction *tr, uint32_t kind, uint32_t addr, uint64_t value)
+{
+	if(tr->nbrOps >= SIP_TRANSACTION_MAX_OPS) {
+		tr->overflow = true;
+		return;
+	}
+	tr->op[tr->nbrOps].kind = kind;
+	tr->op[tr->nbrOps].addr = addr;
+	tr->op[tr->nbrOps].value = value;
+	tr->nbrOps++;
+}
+
+static void SipTransaction_ConfigureRouter(SipTransaction *tr, uint32_t addr, uint64_t setting)
+{
+	SipTransaction_Queue(tr, SIPTR_ROUTER, addr, setting);
+}
+
+static void SipTransaction_EnableChannel(SipTransaction *tr, uint32_t addr, int32_t adc0, int32_t adc1, int32_t dac0, int32_t dac1)
+{
+	SipTransaction_Queue(tr, SIPTR_CHANNELS, addr, (uint64_t)(adc0 == ENABLED) | (uint64_t)(adc1 == ENABLED) << 1 |
+		(uint64_t)(dac0 == ENABLED) << 2 | (uint64_t)(dac1 == ENABLED) << 3);
+}
+
+static void SipTransaction_ArmDac(SipTransaction *tr, uint32_t addr)
+{
+	SipTransaction_Queue(tr, SIPTR_ARM, addr, 0);
+}
+
+static void SipTransaction_SwTrigger(SipTransaction *tr, uint32_t addr)
+{
+	SipTransaction_Queue(tr, SIPTR_TRIGGER, addr, 0);
+}
+
+/**
+*  Flush the queued operations in order, stopping at the first one that fails. Writes go through the shadow
+*  register layer, so writes that change nothing are dropped from the batch.
+*
+*  The 4DSP libraries have no batched entry point, so with them the operations are still issued one by one. The
+*  simulated link ( build with FMC15X_SIM ) carries a committed transaction in a single round trip.
+*
+*  @param tr	transaction to flush
+*  @return
+*						- -1 ( too many operations queued, nothing was sent )
+*						- -2 ( an operation failed, tr->failedOp gives its index )
+*						- 0 ( Success )
+*/
+static int32_t SipTransaction_Commit(SipTransaction *tr)
+{
+	int32_t rc = 0;
+	tr->failedOp = -1;
+	if(tr->overflow) {
+		printf("SipTransaction_Commit() -> more than %d operations queued\n", SIP_TRANSACTION_MAX_OPS);
+		return -1;
+	}
+#ifdef FMC15X_SIM
+	if(g_sipBatchEnabled)
+		sipif_sim_batch_begin();
+#endif
+	for(uint32_t i = 0; i < tr->nbrOps && tr->failedOp < 0; i++) {
+		const SipTransactionOp *op = &tr->op[i];
+		bool ok = false;
+		switch(op->kind) {
+		case SIPTR_ROUTER:
+			ok = ShadowReg_ConfigureRouter(op->addr, op->value) == SXDXROUTER_ERR_OK;
+			break;
+		case SIPTR_CHANNELS:
+			ok = ShadowReg_EnableChannel(op->addr, op->value & 1 ? ENABLED : DISABLED, op->value & 2 ? ENABLED : DISABLED,
+				op->value & 4 ? ENABLED : DISABLED, op->value & 8 ? ENABLED : DISABLED) == FMC15x_CTRL_ERR_OK;
+			break;
+		case SIPTR_ARM:
+			ok = fmc15x_ctrl_arm_dac(op->addr) == FMC15x_CTRL_ERR_OK;
+			break;
+		case SIPTR_TRIGGER:
+			ok = fmc15x_ctrl_sw_trigger(op->addr) == FMC15x_CTRL_ERR_OK;
+			break;
+		}
+		if(!ok) {
+			printf("SipTransaction_Commit() -> could not %s at 0x%8.8X\n", g_sipTransactionNames[op->kind], op->addr);
+			tr->failedOp = i;
+			rc = -2;
+		}
+	}
+#ifdef FMC15X_SIM
+	if(g_sipBatchEnabled) {
+		sipif_sim_batch_end();
+		std::lock_guard<std::mutex> guard(g_shadowLock);
+		g_sipBatches++;
+		g_sipBatchedOps += tr->nbrOps;
+	}
+#endif
+	return rc;
+}
+
+/**
+*  Print the number of batched transactions sent over a network interface. Nothing is batched, and nothing
+*  printed, without a batching backend ( FMC15X_SIM ).
+*/
+static void SipTransaction_PrintStats(void)
+{
+#ifdef FMC15X_SIM
+	std::lock_guard<std::mutex> guard(g_shadowLock);
+	if(g_sipBatches > 0)
+		printf("%llu register transactions carried %llu operations\n", (unsigned long long)g_sipBatches, (unsigned long long)g_sipBatchedOps);
+#endif
+}
+
+/**
+*  Ring of 4 KiB aligned sample buffers shared by one producer thread and one consumer thread, taken from g_bufferPool.
+*  Slots are filled and drained in FIFO order, so a single write index and a single read index are enough.
+*/
+typedef struct {
+	uint8_t *slot[NBR_RING_SLOTS_MAX];		/*!< slot memory, allocated with BufferPool_Alloc() */
+	uint32_t bytes[NBR_RING_SLOTS_MAX];		/*!< number of valid bytes in each slot */
+	uint32_t nbrSlots;						/*!< number of slots in use */
+	uint32_t slotSize;						/*!< size of each slot in bytes */
+	uint32_t wrIdx;							/*!< next slot handed to the producer */
+	uint32_t rdIdx;							/*!< next slot handed to the consumer */
+	uint32_t count;							/*!< number of slots committed and not yet released */
+	uint32_t producerStalls;				/*!< number of times the producer had to wait for a free slot */
+	bool closed;							/*!< set by the producer once no more data will be committed */
+	std::mutex lock;
+	std::condition_variable cond;
+} SampleRing;
+
+/**
+*  Allocate the slots of a SampleRing.
+*
+*  @param ring	ring to initialize
+*  @param nbrSlots	number of slots ( up to NBR_RING_SLOTS_MAX )
+*  @param slotSize	size of each slot in bytes
+*  @return
+*						- -1 ( invalid argument )
+*						- -2 ( out of memory )
+*						- 0 ( Success )
+*/
+static int32_t SampleRing_Create(SampleRing *ring, uint32_t nbrSlots, uint32_t slotSize)
+{
+	if(!ring || nbrSlots == 0 || nbrSlots > NBR_RING_SLOTS_MAX) {
+		printf("SampleRing_Create() -> invalid argument\n");
+		return -1;
+	}
+
+	memset(ring->slot, 0, sizeof(ring->slot));
+	memset(ring->bytes, 0, sizeof(ring->bytes));
+	ring->nbrSlots = nbrSlots;
+	ring->slotSize = slotSize;
+	ring->wrIdx = ring->rdIdx = ring->count = 0;
+	ring->producerStalls = 0;
+	ring->closed = false;
+
+	for(uint32_t i = 0; i < nbrSlots; i++) {
+		ring->slot[i] = BufferPool_Alloc(&g_bufferPool, slotSize);
+		if(!ring->slot[i]) {
+			printf("SampleRing_Create() -> cannot allocate %u bytes\n", slotSize);
+			for(uint32_t j = 0; j < i; j++)
+				BufferPool_Free(&g_bufferPool, ring->slot[j]);
+			return -2;
+		}
+	}
+	return 0;
+}
+
+/**
+*  Release the slots of a SampleRing.
+*
+*  @param ring	ring previously initialized with SampleRing_Create()
+*/
+static void SampleRing_Destroy(SampleRing *ring)
+{
+	for(uint32_t i = 0; i < ring->nbrSlots; i++) {
+		BufferPool_Free(&g_bufferPool, ring->slot[i]);
+		ring->slot[i] = NULL;
+	}
+	ring->nbrSlots = 0;
+}
+
+/**
+*  Producer side: wait for a free slot.
+*
+*  @param ring	ring to get the slot from
+*  @return index of the slot the producer may fill
+*/
+static uint32_t SampleRing_AcquireWrite(SampleRing *ring)
+{
+	std::unique_lock<std::mutex> guard(ring->lock);
+	if(ring->count == ring->nbrSlots)
+		ring->producerStalls++;
+	ring->cond.wait(guard, [ring] { return ring->count < ring->nbrSlots; });
+	return ring->wrIdx % ring->nbrSlots;
+}
+
+/**
+*  Producer side: hand a filled slot over to the consumer.
+*
+*  @param ring	ring the slot belongs to
+*  @param bytes	number of valid bytes in the slot
+*/
+static void SampleRing_CommitWrite(SampleRing *ring, uint32_t bytes)
+{
+	std::lock_guard<std::mutex> guard(ring->lock);
+	ring->bytes[ring->wrIdx % ring->nbrSlots] = bytes;
+	ring->wrIdx++;
+	ring->count++;
+	ring->cond.notify_all();
+}
+
+/**
+*  Producer side: signal that no more slots will be committed.
+*
+*  @param ring	ring to close
+*/
+static void SampleRing_Close(SampleRing *ring)
+{
+	std::lock_guard<std::mutex> guard(ring->lock);
+	ring->closed = true;
+	ring->cond.notify_all();
+}
+
+/**
+*  Consumer side: wait for a filled slot beyond the ones the consumer already holds.
+*
+*  @param ring	ring to get the slot from
+*  @param ahead	number of slots acquired and not yet released by the consumer
+*  @param idx	receives the index of the filled slot
+*  @return
+*						- false ( ring closed and no slot beyond the held ones )
+*						- true ( slot available )
+*/
+static bool SampleRing_AcquireReadAhead(SampleRing *ring, uint32_t ahead, uint32_t *idx)
+{
+	std::unique_lock<std::mutex> guard(ring->lock);
+	ring->cond.wait(guard, [ring, ahead] { return ring->count > ahead || ring->closed; });
+	if(ring->count <= ahead)
+		return false;
+	*idx = (ring->rdIdx + ahead) % ring->nbrSlots;
+	return true;
+}
+
+/**
+*  Consumer side: wait for the next filled slot.
+*
+*  @param ring	ring to get the slot from
+*  @param idx	receives the index of the filled slot
+*  @return
+*						- false ( ring closed and drained )
+*						- true ( slot available )
+*/
+static bool SampleRing_AcquireRead(SampleRing *ring, uint32_t *idx)
+{
+	return SampleRing_AcquireReadAhead(ring, 0, idx);
+}
+
+/**
+*  Consumer side: give the oldest drained slot back to the producer.
+*
+*  @param ring	ring the slot belongs to
+*/
+static void SampleRing_Release(SampleRing *ring)
+{
+	std::lock_guard<std::mutex> guard(ring->lock);
+	ring->rdIdx++;
+	ring->count--;
+	ring->cond.notify_all();
+}
+
+/**
+*  Calibration of an ADC channel applied when its samples are converted to float, see ConvertAdcSamples().
+*/
+typedef struct {
+	float offset;							/*!< DC offset of the ADC in codes, on 14 bits */
+	float gain;								/*!< gain correction, the samples are multiplied by it */
+} AdcCalibration;
+
+/**
+*  Precomputed tables of a real FFT of n samples, shared by every burst of that size. The n real samples are
+*  transformed as n/2 complex samples and the result is split back into the n/2+1 bins of the real spectrum.
+*/
+typedef struct {
+	uint32_t n;								/*!< number of real samples, power of two */
+	std::vector<uint32_t> bitrev;			/*!< bit reversed index of each of the n/2 complex samples */
+	std::vector<float> twRe;				/*!< real part of exp(-2*pi*i*k/n), k < n/2 */
+	std::vector<float> twIm;				/*!< imaginary part of exp(-2*pi*i*k/n), k < n/2 */
+	std::vector<float> window;				/*!< Hann window of n samples */
+	double windowSum;						/*!< sum of the window, coherent gain times n */
+} FftPlan;
+
+static std::mutex g_fftPlanLock;
+static std::map<uint32_t, FftPlan *> g_fftPlans;	/*!< plans built so far, kept until the application exits */
+static bool g_spectrumEnabled = false;			/*!< save the power spectrum of every ADC burst, see --spectrum */
+static uint32_t g_nbrPeaks = 0;					/*!< number of peaks reported for every ADC burst, see --peaks */
+static float g_peakProminence = PEAK_DEFAULT_PROMINENCE;	/*!< minimum prominence of a reported peak in dB */
+static std::mutex g_peakLogLock;				/*!< serializes the writers appending to PEAK_LOG_FILE */
+static double g_adcFullScaleDbm = ADC_FULL_SCALE_DBM;	/*!< power of a full scale sine at the ADC input */
+static uint32_t g_averageBursts = 0;			/*!< number of bursts of an averaged spectrum, see --average */
+static uint32_t g_averageSegment = 0;			/*!< samples per averaged segment, 0 for the burst size */
+static uint32_t g_averageOverlap = WELCH_DEFAULT_OVERLAP;	/*!< overlap of the averaged segments in percent */
+static AdcCalibration g_adcCalibration[2] = { { 0.0f, 1.0f }, { 0.0f, 1.0f } };	/*!< ADC0 and ADC1, see --adc-cal */
+static bool g_removeDc = false;					/*!< subtract the mean of every block instead of the calibrated offset */
+
+/**
+*  Get the FFT plan for n samples, building it on first use.
+*
+*  @param n	number of real samples
+*  @return plan, NULL when n is not a power of two of at least 4
+*/
+static const FftPlan *FftPlan_Get(uint32_t n)
+{
+	if(n < 4 || (n & (n - 1)) != 0)
+		return NULL;
+	std::lock_guard<std::mutex> guard(g_fftPlanLock);
+	std::map<uint32_t, FftPlan *>::iterator it = g_fftPlans.find(n);
+	if(it != g_fftPlans.end())
+		return it->second;
+
+	const double pi = 3.14159265358979323846;
+	FftPlan *plan = new FftPlan;
+	uint32_t m = n / 2, bits = 0;
+	while((1u << bits) < m)
+		bits++;
+	plan->n = n;
+	plan->bitrev.resize(m);
+	for(uint32_t i = 0; i < m; i++) {
+		uint32_t r = 0;
+		for(uint32_t b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		plan->bitrev[i] = r;
+	}
+	plan->twRe.resize(m);
+	plan->twIm.resize(m);
+	for(uint32_t k = 0; k < m; k++) {
+		plan->twRe[k] = (float)cos(2 * pi * k / n);
+		plan->twIm[k] = (float)-sin(2 * pi * k / n);
+	}
+	plan->window.resize(n);
+	plan->windowSum = 0;
+	for(uint32_t i = 0; i < n; i++) {
+		plan->window[i] = (float)(0.5 - 0.5 * cos(2 * pi * i / n));
+		plan->windowSum += plan->window[i];
+	}
+	g_fftPlans[n] = plan;
+	return plan;
+}
+
+/**
+*  Sum of the 14 bit codes of a channel.
+*
+*  @param in	16 bit left justified ADC samples
+*  @param count	number of samples of the channel
+*  @param stride	distance between two samples of the channel ( 2 for ADC0/ADC1 pairs )
+*  @return sum of the samples shifted right by two
+*/
+static int64_t SumAdcCodes(const int16_t *in, uint32_t count, uint32_t stride)
+{
+	int64_t sum = 0;
+	uint32_t i = 0;
+#if defined(FMC_HAVE_SSE2)
+	// the last pair of a channel has no sample after it, the vector loops stop one group early for stride 2
+	const uint32_t limit = (stride == 1) ? count : count - 1;
+	if(count > 0 && (stride == 1 || stride == 2)) {
+		// 32 bit lanes hold at most 2^15 codes of 14 bits before being folded into the 64 bit sum
+		while(i + 8 <= limit) {
+			__m128i acc = _mm_setzero_si128();
+			for(uint32_t n = 0; n < 1u << 15 && i + 8 <= limit; n += 2, i += 8) {
+				__m128i a, b;
+				if(stride == 1) {
+					__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+					a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 18);
+					b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 18);
+				}
+				else {
+					a = _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128((const __m128i *)(in + 2 * i)), 16), 18);
+					b = _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128((const __m128i *)(in + 2 * i + 8)), 16), 18);
+				}
+				acc = _mm_add_epi32(acc, _mm_add_epi32(a, b));
+			}
+			int32_t lanes[4];
+			_mm_storeu_si128((__m128i *)lanes, acc);
+			sum += (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		}
+	}
+#endif
+	for(; i < count; i++)
+		sum += in[(size_t)i * stride] >> 2;
+	return sum;
+}
+
+/**
+*  Convert the samples of an ADC channel to calibrated floats: the two unused low bits are dropped, the offset
+*  is subtracted and the gain applied, so that a full scale sine has an amplitude of 1 ( g_adcFullScaleDbm ).
+*  With removeDc the mean of the block replaces the calibrated offset. The conversion is a single multiply and
+*  subtract per sample, the mean costs one more pass over samples that are still in the cache.
+*
+*  @param in	16 bit left justified ADC samples
+*  @param count	number of samples of the channel
+*  @param stride	distance between two samples of the channel ( 2 for ADC0/ADC1 pairs )
+*  @param cal	calibration of the channel
+*  @param removeDc	subtract the mean of the samples
+*  @param out	receives count floats
+*/
+static void ConvertAdcSamples(const int16_t *in, uint32_t count, uint32_t stride, const AdcCalibration *cal, bool removeDc, float *out)
+{
+	if(count == 0)
+		return;
+	double offset = removeDc ? (double)SumAdcCodes(in, count, stride) / count : cal->offset;
+	const float scale = cal->gain / (float)(1 << (ADC_DATA_BITS - 1));
+	const float bias = (float)(offset * scale);
+	uint32_t i = 0;
+#if defined(FMC_HAVE_SSE2)
+	const uint32_t limit = (stride == 1) ? count : count - 1;
+	if(stride == 1 || stride == 2) {
+#if defined(FMC_HAVE_AVX2)
+		const __m256 scale256 = _mm256_set1_ps(scale), bias256 = _mm256_set1_ps(bias);
+		for(; i + 8 <= limit; i += 8) {
+			__m256i codes;
+			if(stride == 1)
+				codes = _mm256_srai_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i))), 2);
+			else
+				codes = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_loadu_si256((const __m256i *)(in + 2 * i)), 16), 18);
+			_mm256_storeu_ps(out + i, _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(codes), scale256), bias256));
+		}
+#endif
+		const __m128 scale128 = _mm_set1_ps(scale), bias128 = _mm_set1_ps(bias);
+		for(; i + 4 <= limit; i += 4) {
+			__m128i codes;
+			if(stride == 1) {
+				__m128i v = _mm_loadl_epi64((const __m128i *)(in + i));
+				codes = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 18);
+			}
+			else
+				codes = _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128((const __m128i *)(in + 2 * i)), 16), 18);
+			_mm_storeu_ps(out + i, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(codes), scale128), bias128));
+		}
+	}
+#endif
+	for(; i < count; i++)
+		out[i] = (float)(in[(size_t)i * stride] >> 2) * scale - bias;
+}
+
+/**
+*  Hann windowed power spectrum of a burst of ADC samples, relative to full scale: a full scale sine centred on a
+*  bin reads 1.
+*
+*  @param samples	ADC samples converted by ConvertAdcSamples()
+*  @param plan	plan of the burst size, see FftPlan_Get()
+*  @param re	work buffer of plan->n/2 floats
+*  @param im	work buffer of plan->n/2 floats
+*  @param power	receives the plan->n/2+1 bins from DC to half the sample rate
+*/
+static void ComputeLinearSpectrum(const float *samples, const FftPlan *plan, float *re, float *im, float *power)
+{
+	uint32_t n = plan->n, m = n / 2;
+
+	// even samples in the real part, odd samples in the imaginary part, in bit reversed order
+	for(uint32_t i = 0; i < m; i++) {
+		uint32_t j = plan->bitrev[i];
+		re[j] = samples[2 * i] * plan->window[2 * i];
+		im[j] = samples[2 * i + 1] * plan->window[2 * i + 1];
+	}
+
+	// radix 2 butterflies of the n/2 point complex FFT, its twiddles are every other one of the n point table
+	for(uint32_t len = 2; len <= m; len <<= 1) {
+		uint32_t half = len / 2, step = n / len;
+		for(uint32_t base = 0; base < m; base += len) {
+			for(uint32_t j = 0; j < half; j++) {
+				float wr = plan->twRe[j * step], wi = plan->twIm[j * step];
+				uint32_t a = base + j, b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+
+	// split into the spectrum of the real signal: X[k] = E[k] + W^k O[k]
+	double scale = 2.0 / plan->windowSum;
+	for(uint32_t k = 0; k <= m; k++) {
+		uint32_t p = k % m, q = (m - k) % m;
+		double er = 0.5 * (re[p] + re[q]), ei = 0.5 * (im[p] - im[q]);
+		double or_ = 0.5 * (im[p] + im[q]), oi = -0.5 * (re[p] - re[q]);
+		double wr = (k < m) ? plan->twRe[k] : -1.0, wi = (k < m) ? plan->twIm[k] : 0.0;
+		double xr = er + wr * or_ - wi * oi;
+		double xi = ei + wr * oi + wi * or_;
+		power[k] = (float)((xr * xr + xi * xi) * scale * scale);
+	}
+}
+
+/**
+*  Convert a spectrum relative to full scale to dBm with g_adcFullScaleDbm.
+*
+*  @param power	spectrum from ComputeLinearSpectrum(), may be the same buffer as dBm
+*  @param nbrBins	number of bins
+*  @param dBm	receives the calibrated spectrum
+*/
+static void SpectrumToDbm(const float *power, uint32_t nbrBins, float *dBm)
+{
+	for(uint32_t k = 0; k < nbrBins; k++)
+		dBm[k] = (float)(10.0 * log10(power[k] + 1e-24) + g_adcFullScaleDbm);
+}
+
+/**
+*  Hann windowed power spectrum of a burst of ADC samples, calibrated in dBm with g_adcFullScaleDbm: a full scale
+*  sine centred on a bin reads g_adcFullScaleDbm. See ComputeLinearSpectrum() for the arguments.
+*/
+static void ComputePowerSpectrum(const float *samples, const FftPlan *plan, float *re, float *im, float *dBm)
+{
+	ComputeLinearSpectrum(samples, plan, re, im, dBm);
+	SpectrumToDbm(dBm, plan->n / 2 + 1, dBm);
+}
+
+/**
+*  Peak of a spectrum reported by FindSpectrumPeaks().
+*/
+typedef struct {
+	uint32_t bin;							/*!< index of the local maximum ( middle of a plateau ) */
+	float height;							/*!< power at the bin in dBm */
+	float prominence;						/*!< height above the higher of its two bases, as scipy.signal.find_peaks() */
+	double frequency;						/*!< frequency in Hz, interpolated between the bins */
+	float level;							/*!< power in dBm, interpolated between the bins */
+} SpectrumPeak;
+
+/**
+*  One pass of the prominence base search: for every bin, the lowest value between the bin and the nearest
+*  strictly higher bin in the scan direction ( or the end of the spectrum ). A stack of the bins not yet exceeded
+*  keeps the pass linear.
+*
+*  @param y	spectrum
+*  @param n	number of bins
+*  @param dir	1 to look to the left of every bin, -1 to look to the right
+*  @param base	receives the base of every bin
+*/
+static void FindPeakBases(const float *y, uint32_t n, int32_t dir, float *base)
+{
+	static thread_local std::vector<uint32_t> stackIdx;
+	static thread_local std::vector<float> stackGap;	// lowest value between a stack entry and the one above it
+	// the bottom entry stands for the start of the spectrum, higher than any bin
+	stackIdx.assign(1, UINT32_MAX);
+	stackGap.assign(1, HUGE_VALF);
+	for(uint32_t step = 0; step < n; step++) {
+		uint32_t i = (dir > 0) ? step : n - 1 - step;
+		float lowest = y[i];
+		while(stackIdx.back() != UINT32_MAX && y[stackIdx.back()] <= y[i]) {
+			lowest = std::min(lowest, std::min(stackGap.back(), y[stackIdx.back()]));
+			stackIdx.pop_back();
+			stackGap.pop_back();
+		}
+		lowest = std::min(lowest, stackGap.back());
+		stackGap.back() = lowest;
+		base[i] = lowest;
+		stackIdx.push_back(i);
+		stackGap.push_back(y[i]);
+	}
+}
+
+/**
+*  Find the peaks of a spectrum the way scipy.signal.find_peaks(y, prominence=minProminence) does ( local maxima,
+*  plateaus reported at their middle, prominence measured from the higher of the two bases ), and keep the
+*  strongest ones. The frequency and level of each peak are refined by a parabola through the three bins around it.
+*
+*  @param y	spectrum in dB
+*  @param n	number of bins
+*  @param binWidth	frequency step between two bins in Hz
+*  @param minProminence	minimum prominence in dB
+*  @param peaks	receives up to maxPeaks peaks, strongest first
+*  @param maxPeaks	number of peaks to keep
+*  @return number of peaks stored in peaks
+*/
+static uint32_t FindSpectrumPeaks(const float *y, uint32_t n, double binWidth, float minProminence, SpectrumPeak *peaks, uint32_t maxPeaks)
+{
+	static thread_local std::vector<float> leftBase, rightBase;
+	if(n < 3 || maxPeaks == 0)
+		return 0;
+	leftBase.resize(n);
+	rightBase.resize(n);
+	FindPeakBases(y, n, 1, &leftBase[0]);
+	FindPeakBases(y, n, -1, &rightBase[0]);
+
+	uint32_t nbrPeaks = 0;
+	for(uint32_t i = 1; i + 1 < n; i++) {
+		if(!(y[i - 1] < y[i]))
+			continue;
+		uint32_t ahead = i + 1;
+		while(ahead < n - 1 && y[ahead] == y[i])
+			ahead++;
+		if(y[ahead] < y[i]) {
+			uint32_t k = (i + ahead - 1) / 2;
+			SpectrumPeak peak;
+			peak.bin = k;
+			peak.height = y[k];
+			peak.prominence = y[k] - std::max(leftBase[k], rightBase[k]);
+			if(peak.prominence >= minProminence) {
+				float a = y[k - 1], b = y[k], c = y[k + 1];
+				float curvature = a - 2 * b + c;
+				float offset = (curvature != 0) ? 0.5f * (a - c) / curvature : 0.0f;
+				peak.frequency = (k + offset) * binWidth;
+				peak.level = b - 0.25f * (a - c) * offset;
+				// insert in the list of the strongest peaks
+				uint32_t pos = (nbrPeaks < maxPeaks) ? nbrPeaks++ : maxPeaks;
+				while(pos > 0 && peaks[pos - 1].height < peak.height) {
+					if(pos < maxPeaks)
+						peaks[pos] = peaks[pos - 1];
+					pos--;
+				}
+				if(pos < maxPeaks)
+					peaks[pos] = peak;
+			}
+		}
+		i = ahead - 1;
+	}
+	return nbrPeaks;
+}
+
+/**
+*  Compute the power spectrum of every channel of a burst. With g_spectrumEnabled the spectra are saved as
+*  <name>_spectrum.csv, one line per bin: frequency in Hz followed by the power in dBm of each channel, and the
+*  strongest bin of each channel is printed. With g_nbrPeaks the strongest prominent peaks of each channel are
+*  printed and appended to PEAK_LOG_FILE.
+*
+*  @param buf	burst samples, ADC0/ADC1 pairs for CAPTURE_CHANNEL_ADC01
+*  @param burstSize	number of samples per channel
+*  @param channel	CAPTURE_CHANNEL_ADC0, CAPTURE_CHANNEL_ADC1 or CAPTURE_CHANNEL_ADC01, selects the calibration
+*  @param sampleRate	sample rate in Hz
+*  @param name	output file name without extension
+*  @return
+*						- -1 ( burst size is not a power of two )
+*						- -2 ( cannot create the file )
+*						- 0 ( Success )
+*/
+static int32_t AnalyseBurstSpectrum(const void *buf, uint32_t burstSize, int32_t channel, double sampleRate, const char *name)
+{
+	uint32_t first = (channel == CAPTURE_CHANNEL_ADC1) ? 1 : 0, nbrChannels = (channel == CAPTURE_CHANNEL_ADC01) ? 2 : 1;
+	const FftPlan *plan = FftPlan_Get(burstSize);
+	if(!plan) {
+		printf("AnalyseBurstSpectrum() -> burst size %u is not a power of two\n", burstSize);
+		return -1;
+	}
+	uint32_t nbrBins = burstSize / 2 + 1;
+	std::vector<float> samples(burstSize), work(burstSize), dBm(nbrBins * nbrChannels);
+	for(uint32_t ch = 0; ch < nbrChannels; ch++) {
+		float *spectrum = &dBm[ch * nbrBins];
+		ConvertAdcSamples((const int16_t *)buf + ch, burstSize, nbrChannels, &g_adcCalibration[first + ch], g_removeDc, &samples[0]);
+		ComputePowerSpectrum(&samples[0], plan, &work[0], &work[burstSize / 2], spectrum);
+		if(g_nbrPeaks > 0) {
+			SpectrumPeak peaks[MAX_REPORTED_PEAKS];
+			uint32_t nbrPeaks = FindSpectrumPeaks(spectrum, nbrBins, sampleRate / burstSize, g_peakProminence, peaks, g_nbrPeaks);
+			std::lock_guard<std::mutex> guard(g_peakLogLock);
+			FILE *log = fopen(PEAK_LOG_FILE, "a");
+			for(uint32_t i = 0; i < nbrPeaks; i++) {
+				printf("%s%s peak %u: %.4f MHz at %.2f dBm, prominence %.1f dB\n", name, nbrChannels == 1 ? "" : (ch == 0 ? " ADC0" : " ADC1"),
+					i + 1, peaks[i].frequency / 1e6, peaks[i].level, peaks[i].prominence);
+				if(log)
+					fprintf(log, "%s,%u,%u,%.1f,%.2f,%.2f\n", name, ch, i + 1, peaks[i].frequency, peaks[i].level, peaks[i].prominence);
+			}
+			if(log)
+				fclose(log);
+		}
+		else {
+			uint32_t peak = 1;
+			for(uint32_t k = 2; k < nbrBins; k++) {
+				if(spectrum[k] > spectrum[peak])
+					peak = k;
+			}
+			printf("%s: peak %.4f MHz at %.2f dBm\n", name, peak * sampleRate / burstSize / 1e6, spectrum[peak]);
+		}
+	}
+	if(!g_spectrumEnabled)
+		return 0;
+
+	char filename[96];
+	sprintf(filename, "%s_spectrum.csv", name);
+	FILE *f = fopen(filename, "w");
+	if(!f) {
+		printf("AnalyseBurstSpectrum() -> cannot create '%s'\n", filename);
+		return -2;
+	}
+	for(uint32_t k = 0; k < nbrBins; k++) {
+		fprintf(f, "%.1f", k * sampleRate / burstSize);
+		for(uint32_t ch = 0; ch < nbrChannels; ch++)
+			fprintf(f, ",%.2f", dBm[ch * nbrBins + k]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+*  Welch averaged spectrum of one ADC channel: the samples are cut in Hann windowed segments overlapping by a
+*  fixed number of samples and the power spectra of the segments are averaged, along with the max and min hold of
+*  every bin. The accumulators are plain float arrays updated in a single pass per segment.
+*/
+typedef struct {
+	const FftPlan *plan;					/*!< plan of the segment size */
+	uint32_t adc;							/*!< ADC of the channel, selects the calibration */
+	uint32_t hop;							/*!< samples between the starts of two segments */
+	std::vector<float> pending;				/*!< calibrated samples not yet covered by a full segment ( contiguous data only ) */
+	std::vector<float> work;				/*!< FFT work buffer */
+	std::vector<float> power;				/*!< spectrum of the last segment, relative to full scale */
+	std::vector<float> sum;					/*!< sum of the segment spectra */
+	std::vector<float> maxHold;				/*!< highest power seen in every bin */
+	std::vector<float> minHold;				/*!< lowest power seen in every bin */
+	uint32_t nbrSegments;					/*!< number of segments accumulated */
+} SpectrumAverager;
+
+/**
+*  Clear the accumulators of a SpectrumAverager, the samples waiting for the next segment are kept.
+*
+*  @param avg	averager initialized with SpectrumAverager_Init()
+*/
+static void SpectrumAverager_Reset(SpectrumAverager *avg)
+{
+	std::fill(avg->sum.begin(), avg->sum.end(), 0.0f);
+	std::fill(avg->maxHold.begin(), avg->maxHold.end(), 0.0f);
+	std::fill(avg->minHold.begin(), avg->minHold.end(), HUGE_VALF);
+	avg->nbrSegments = 0;
+}
+
+/**
+*  Set up a SpectrumAverager.
+*
+*  @param avg	averager to initialize
+*  @param adc	ADC of the channel ( 0 or 1 )
+*  @param segment	samples per segment, a power of two of at least 4
+*  @param overlap	overlap of two consecutive segments in percent ( 0 to 99 )
+*  @return
+*						- -1 ( invalid segment size or overlap )
+*						- 0 ( Success )
+*/
+static int32_t SpectrumAverager_Init(SpectrumAverager *avg, uint32_t adc, uint32_t segment, uint32_t overlap)
+{
+	avg->plan = FftPlan_Get(segment);
+	if(!avg->plan || overlap > 99) {
+		printf("SpectrumAverager_Init() -> invalid segment of %u samples with %u%% overlap\n", segment, overlap);
+		return -1;
+	}
+	avg->adc = adc;
+	avg->hop = segment - (uint32_t)((uint64_t)segment * overlap / 100);
+	avg->pending.clear();
+	avg->work.resize(segment);
+	avg->power.resize(segment / 2 + 1);
+	avg->sum.resize(segment / 2 + 1);
+	avg->maxHold.resize(segment / 2 + 1);
+	avg->minHold.resize(segment / 2 + 1);
+	SpectrumAverager_Reset(avg);
+	return 0;
+}
+
+/**
+*  Add the segments of a block of samples to the averages.
+*
+*  @param avg	initialized averager
+*  @param samples	16 bit left justified ADC samples
+*  @param count	number of samples of the channel
+*  @param stride	distance between two samples of the channel ( 2 for ADC0/ADC1 pairs )
+*  @param contiguous	the block follows the previous one without a gap, segments may straddle the two blocks.
+*						Otherwise the samples left over from the previous block are dropped.
+*/
+static void SpectrumAverager_Feed(SpectrumAverager *avg, const int16_t *samples, uint32_t count, uint32_t stride, bool contiguous)
+{
+	const uint32_t n = avg->plan->n, nbrBins = n / 2 + 1;
+	if(!contiguous)
+		avg->pending.clear();
+	size_t base = avg->pending.size();
+	avg->pending.resize(base + count);
+	ConvertAdcSamples(samples, count, stride, &g_adcCalibration[avg->adc], g_removeDc, &avg->pending[base]);
+
+	size_t pos = 0;
+	for(; pos + n <= avg->pending.size(); pos += avg->hop) {
+		ComputeLinearSpectrum(&avg->pending[pos], avg->plan, &avg->work[0], &avg->work[n / 2], &avg->power[0]);
+		float *sum = &avg->sum[0], *maxHold = &avg->maxHold[0], *minHold = &avg->minHold[0];
+		const float *power = &avg->power[0];
+		for(uint32_t k = 0; k < nbrBins; k++) {
+			sum[k] += power[k];
+			maxHold[k] = std::max(maxHold[k], power[k]);
+			minHold[k] = std::min(minHold[k], power[k]);
+		}
+		avg->nbrSegments++;
+	}
+	avg->pending.erase(avg->pending.begin(), avg->pending.begin() + std::min(pos, avg->pending.size()));
+}
+
+/**
+*  Save the averaged spectra of one or two channels as <name>_welch.csv, one line per bin: frequency in Hz followed
+*  by the average, max hold and min hold power in dBm of each channel. The strongest bin of each average is printed.
+*
+*  @param avg	averagers of the channels, all with the same segment size
+*  @param nbrChannels	number of averagers
+*  @param sampleRate	sample rate in Hz
+*  @param name	output file name without extension
+*  @return
+*						- -1 ( no segment accumulated )
+*						- -2 ( cannot create the file )
+*						- 0 ( Success )
+*/
+static int32_t SpectrumAverager_Save(const SpectrumAverager *avg, uint32_t nbrChannels, double sampleRate, const char *name)
+{
+	const uint32_t n = avg[0].plan->n, nbrBins = n / 2 + 1;
+	std::vector<float> dBm(3 * nbrBins * nbrChannels);
+	for(uint32_t ch = 0; ch < nbrChannels; ch++) {
+		if(avg[ch].nbrSegments == 0) {
+			printf("SpectrumAverager_Save() -> no segment to average for '%s'\n", name);
+			return -1;
+		}
+		float *mean = &dBm[3 * ch * nbrBins];
+		float scale = 1.0f / avg[ch].nbrSegments;
+		for(uint32_t k = 0; k < nbrBins; k++)
+			mean[k] = avg[ch].sum[k] * scale;
+		SpectrumToDbm(mean, nbrBins, mean);
+		SpectrumToDbm(&avg[ch].maxHold[0], nbrBins, mean + nbrBins);
+		SpectrumToDbm(&avg[ch].minHold[0], nbrBins, mean + 2 * nbrBins);
+
+		uint32_t peak = 1;
+		for(uint32_t k = 2; k < nbrBins; k++) {
+			if(mean[k] > mean[peak])
+				peak = k;
+		}
+		printf("%s%s: %u segments of %u samples averaged, peak %.4f MHz at %.2f dBm ( max hold %.2f dBm )\n", name,
+			nbrChannels == 1 ? "" : (ch == 0 ? " ADC0" : " ADC1"), avg[ch].nbrSegments, n, peak * sampleRate / n / 1e6,
+			mean[peak], mean[nbrBins + peak]);
+	}
+
+	char filename[96];
+	sprintf(filename, "%s_welch.csv", name);
+	FILE *f = fopen(filename, "w");
+	if(!f) {
+		printf("SpectrumAverager_Save() -> cannot create '%s'\n", filename);
+		return -2;
+	}
+	for(uint32_t k = 0; k < nbrBins; k++) {
+		fprintf(f, "%.1f", k * sampleRate / n);
+		for(uint32_t ch = 0; ch < nbrChannels; ch++) {
+			const float *mean = &dBm[3 * ch * nbrBins];
+			fprintf(f, ",%.2f,%.2f,%.2f", mean[k], mean[nbrBins + k], mean[2 * nbrBins + k]);
+		}
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+*  Continuously stream one ADC through the DDR3 memory FIFO into a binary file.
+*
+*  The FIFO is armed for an unlimited number of bursts and the ADC is triggered once for all the bursts needed to
+*  cover the requested duration. A reader thread keeps sipif_readdata() busy on a ring of NBR_STREAM_SLOTS buffers
+*  while the calling thread writes the filled buffers to disk, so the FIFO is drained without waiting on file I/O.
+*  The samples are stored as a capture file with one block per burst, written straight from the ring buffers with
+*  up to g_writeQueueDepth writes in flight, see CaptureFile_OpenStream().
+*
+*  With checkPattern set, the ADC outputs its ramp test pattern and every burst is checked by the writing thread.
+*  Breaks of the ramp between two consecutive bursts are reported as possible gaps in the stream.
+*
+*  With g_averageBursts set, the writing thread also keeps a Welch averaged spectrum of the stream, with segments
+*  running across the bursts, and saves it as <filename without .cap>_welch.csv every g_averageBursts bursts.
+*
+*  @param AddrSipFMC150Ctrl	address of the FMC15x control star
+*  @param AddrSipRouterS3D1	address of the 3-to-1 router
+*  @param AddrSipMemoryFIFO	address of the DDR3 memory FIFO star
+*  @param AddrSipFMC150AdcSpi	address of the ADC SPI interface, used to enable the ramp pattern
+*  @param currentCard	FMC card index ( 0 or 1 )
+*  @param adc	ADC to stream ( 0 or 1 )
+*  @param BurstSize	number of samples per burst
+*  @param seconds	duration of the capture
+*  @param checkPattern	stream the ADC ramp test pattern and check every burst
+*  @param capInfo	board description stored in the capture file header, its sample rate sets the number of bursts
+*  @param filename	capture file, overwritten
+*  @return
+*						- -1 ( invalid argument or out of memory )
+*						- -2 ( device configuration failed )
+*						- -3 ( device read failed )
+*						- -4 ( file write failed )
+*						- -5 ( pattern check failed )
+*						- 0 ( Success )
+*/
+static int32_t StreamAdcToFile(uint32_t AddrSipFMC150Ctrl, uint32_t AddrSipRouterS3D1, uint32_t AddrSipMemoryFIFO, uint32_t AddrSipFMC150AdcSpi,
+							   int32_t currentCard, int32_t adc, int32_t BurstSize, double seconds, bool checkPattern,
+							   const CaptureFileHeader *capInfo, const char *filename)
+{
+	SampleRing ring;
+	CaptureFile cap;
+	const uint32_t burstBytes = 2 * BurstSize;
+	const uint32_t totalBursts = capInfo ? (uint32_t)ceil(seconds * capInfo->sampleRate / BurstSize) : 0;
+	uint64_t bytesWritten = 0;
+	int32_t readError = 0;
+	int32_t rc = 0;
+	uint64_t checkedBursts = 0, badBursts = 0, patternErrors = 0, rampBreaks = 0;
+	uint16_t nextExpected = 0;
+	uint16_t bitErrorMask = 0;
+	SpectrumAverager avg;
+	uint32_t averagedBursts = 0;
+	char welchName[64];
+	std::vector<int16_t> unpacked;
+
+	if(!filename || totalBursts == 0 || (adc != 0 && adc != 1)) {
+		printf("StreamAdcToFile() -> invalid argument\n");
+		return -1;
+	}
+
+	bool averaging = g_averageBursts > 0 &&
+		SpectrumAverager_Init(&avg, adc, g_averageSegment ? g_averageSegment : BurstSize, g_averageOverlap) == 0;
+	if(averaging) {
+		snprintf(welchName, sizeof(welchName), "%s", filename);
+		char *ext = strrchr(welchName, '.');
+		if(ext && !strcmp(ext, ".cap"))
+			*ext = '\0';
+	}
+
+	if(SampleRing_Create(&ring, NBR_STREAM_SLOTS, STREAM_BURSTS_PER_SLOT * burstBytes) != 0)
+		return -1;
+
+	if(CaptureFile_OpenStream(&cap, filename, capInfo, adc == 0 ? CAPTURE_CHANNEL_ADC0 : CAPTURE_CHANNEL_ADC1, totalBursts,
+		STREAM_BURSTS_PER_SLOT) != 0) {
+		SampleRing_Destroy(&ring);
+		return -4;
+	}
+	// packed bursts are unpacked again for the pattern check and the averages
+	const bool packed = CaptureFile_IsPacked(&cap);
+	if(packed && (checkPattern || averaging))
+		unpacked.resize(BurstSize);
+
+	// route data from the selected ADC's FIFO, then program the number of bursts and arm the memory FIFO
+	uint64_t routerSetting = ~((uint64_t)0xFF) | (uint64_t)(currentCard * 2 + adc);
+	if(ShadowReg_AdcPatternCheck(AddrSipFMC150AdcSpi, checkPattern) != FMC15x_ADC_ERR_OK ||
+		ShadowReg_ConfigureRouter(AddrSipRouterS3D1, routerSetting) != SXDXROUTER_ERR_OK ||
+		ShadowReg_ConfigureBurst(AddrSipFMC150Ctrl, totalBursts, BurstSize) != FMC15x_CTRL_ERR_OK ||
+		memfifo_configure(AddrSipMemoryFIFO, 0, NBRBURST_UNLIMITED, burstBytes, 0, 0, FIFO_ARMED) != MEMFIFO_ERR_OK ||
+		ShadowReg_EnableChannel(AddrSipFMC150Ctrl, adc == 0 ? ENABLED : DISABLED, adc == 1 ? ENABLED : DISABLED, ENABLED, ENABLED) != FMC15x_CTRL_ERR_OK ||
+		fmc15x_ctrl_arm_dac(AddrSipFMC150Ctrl) != FMC15x_CTRL_ERR_OK) {
+		printf("StreamAdcToFile() -> Could not configure streaming on card %d\n", currentCard);
+		CaptureFile_Close(&cap);
+		SampleRing_Destroy(&ring);
+		return -2;
+	}
+
+	printf("Streaming %u bursts (%.3f s) from ADC%d on card %d to '%s'\n", totalBursts, seconds, adc, currentCard, filename);
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+	if(fmc15x_ctrl_sw_trigger(AddrSipFMC150Ctrl) != FMC15x_CTRL_ERR_OK) {
+		printf("StreamAdcToFile() -> Could not send software trigger\n");
+		CaptureFile_Close(&cap);
+		SampleRing_Destroy(&ring);
+		return -2;
+	}
+
+	// reader: keeps the link busy as long as there is a free slot in the ring
+	std::thread reader([&] {
+		uint32_t remaining = totalBursts;
+		while(remaining > 0) {
+			uint32_t bursts = remaining < STREAM_BURSTS_PER_SLOT ? remaining : STREAM_BURSTS_PER_SLOT;
+			uint32_t idx = SampleRing_AcquireWrite(&ring);
+			if(sipif_readdata(ring.slot[idx], bursts * burstBytes) != SIPIF_ERR_OK) {
+				readError = 1;
+				break;
+			}
+			// pack while the slot is still in the cache
+			if(packed)
+				Packed14_PackBursts((const int16_t *)ring.slot[idx], BurstSize, bursts, ring.slot[idx], cap.header.blockSize);
+			SampleRing_CommitWrite(&ring, bursts * burstBytes);
+			remaining -= bursts;
+		}
+		SampleRing_Close(&ring);
+	});
+
+	// writer: drains the ring to disk in the order the data was read. A slot goes back to the reader once its write
+	// has completed, up to cap.queueDepth slots are being written at a time.
+	uint32_t idx, inFlight = 0, pendingWrites = 0;
+	uint32_t writeDepth = cap.queueDepth < ring.nbrSlots ? cap.queueDepth : ring.nbrSlots;
+	for(;;) {
+		if(inFlight == writeDepth || !SampleRing_AcquireReadAhead(&ring, inFlight, &idx)) {
+			if(inFlight == 0)
+				break;
+			// after a failed write the remaining slots are released without being written
+			if(pendingWrites > 0) {
+				pendingWrites--;
+				if(CaptureFile_WaitBursts(&cap) != 0 && rc == 0) {
+					printf("StreamAdcToFile() -> write to '%s' failed\n", filename);
+					rc = -4;
+				}
+			}
+			SampleRing_Release(&ring);
+			inFlight--;
+			continue;
+		}
+		for(uint32_t b = 0; (checkPattern || averaging) && b < ring.bytes[idx] / burstBytes; b++) {
+			const int16_t *samples = (const int16_t *)(ring.slot[idx] + (size_t)b * burstBytes);
+			if(packed) {
+				Packed14_Unpack(ring.slot[idx] + (size_t)b * cap.header.blockSize, BurstSize, &unpacked[0]);
+				samples = &unpacked[0];
+			}
+			if(checkPattern) {
+				const uint16_t *burst = (const uint16_t *)samples;
+				RampCheckResult result;
+				if(checkedBursts++ > 0 && (burst[0] >> 2) != nextExpected)
+					rampBreaks++;
+				nextExpected = CheckRampPattern(burst, BurstSize, burst[0] >> 2, &result);
+				if(result.errorCount) {
+					badBursts++;
+					patternErrors += result.errorCount;
+					bitErrorMask |= result.bitErrorMask;
+				}
+			}
+			if(averaging) {
+				SpectrumAverager_Feed(&avg, samples, BurstSize, 1, true);
+				if(++averagedBursts == g_averageBursts) {
+					SpectrumAverager_Save(&avg, 1, capInfo->sampleRate, welchName);
+					SpectrumAverager_Reset(&avg);
+					averagedBursts = 0;
+				}
+			}
+		}
+		if(rc == 0) {
+			pendingWrites++;
+			if(CaptureFile_SubmitBursts(&cap, ring.slot[idx], ring.bytes[idx] / burstBytes) != 0) {
+				printf("StreamAdcToFile() -> write to '%s' failed\n", filename);
+				rc = -4;
+			}
+		}
+		bytesWritten += ring.bytes[idx];
+		inFlight++;
+	}
+	reader.join();
+	if(averaging && averagedBursts > 0 && avg.nbrSegments > 0)
+		SpectrumAverager_Save(&avg, 1, capInfo->sampleRate, welchName);
+	if(CaptureFile_Close(&cap) != 0 && rc == 0) {
+		printf("StreamAdcToFile() -> write to '%s' failed\n", filename);
+		rc = -4;
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	printf("Streamed %llu bytes in %.3f s (%.1f MB/s, %.1f MSPS), reader waited on the disk %u times\n",
+		(unsigned long long)bytesWritten, elapsed, bytesWritten / elapsed / 1e6, bytesWritten / 2 / elapsed / 1e6, ring.producerStalls);
+	SampleRing_Destroy(&ring);
+
+	if(checkPattern) {
+		printf("Pattern check: %llu bursts, %llu failed (%llu sample errors, data lines 0x%4.4X), %llu ramp breaks between bursts\n",
+			(unsigned long long)checkedBursts, (unsigned long long)badBursts, (unsigned long long)patternErrors, bitErrorMask,
+			(unsigned long long)rampBreaks);
+		if(badBursts && rc == 0)
+			rc = -5;
+	}
+
+	// go back to the single burst configuration used by the rest of the application
+	ShadowReg_ConfigureBurst(AddrSipFMC150Ctrl, 1, BurstSize);
+	ShadowReg_AdcPatternCheck(AddrSipFMC150AdcSpi, false);
+
+	if(readError) {
+		printf("StreamAdcToFile() -> device read failed after %llu bytes\n", (unsigned long long)bytesWritten);
+		return -3;
+	}
+	return rc;
+}
+
+/**
+*  Background writer persisting captured bursts while the acquisition loop goes on with the next trigger.
+*  Each queued burst is saved as <name>.txt ( ASCII ), <name>.bin ( BINARY ) and <name>.cap ( capture file ),
+*  replacing any previous file. The spectrum of the ADC bursts is analysed too, see AnalyseBurstSpectrum().
+*
+*  With g_averageBursts set, the ADC bursts are queued in sets ( see Card_Acquire() ): every burst of a set is added
+*  to the Welch averages of its channels, and only the last one is saved and analysed, along with the averages.
+*/
+typedef struct {
+	SampleRing ring;						/*!< buffers handed to sipif_readdata() and then to the writer thread */
+	char name[NBR_RING_SLOTS_MAX][64];		/*!< output file name ( without extension ) of each queued slot */
+	int32_t channel[NBR_RING_SLOTS_MAX];	/*!< CAPTURE_CHANNEL_xxx of each queued slot */
+	uint8_t setFlags[NBR_RING_SLOTS_MAX];	/*!< BURST_SET_xxx of each queued slot */
+	uint8_t nextSetFlags;					/*!< BURST_SET_xxx given to the next queued slot */
+	bool averaging;							/*!< Welch averages enabled, see g_averageBursts */
+	SpectrumAverager avg[2];				/*!< averages of ADC0 and ADC1, only used by the writer thread */
+	CaptureFileHeader capInfo;				/*!< board description stored in the capture files */
+	std::thread writer;						/*!< thread draining the ring to disk */
+} BurstSaver;
+
+/**
+*  Allocate the buffers of a BurstSaver and start its writer thread.
+*
+*  @param saver	saver to start
+*  @param capInfo	board description, capInfo->burstSize gives the size of the buffers
+*  @param nbrChannels	number of ADC channels a buffer must hold ( 2 for interleaved dual ADC captures )
+*  @return
+*						- -1 ( out of memory )
+*						- 0 ( Success )
+*/
+static int32_t BurstSaver_Start(BurstSaver *saver, const CaptureFileHeader *capInfo, uint32_t nbrChannels)
+{
+	if(SampleRing_Create(&saver->ring, NBR_SAVE_SLOTS, 2 * capInfo->burstSize * nbrChannels) != 0)
+		return -1;
+	saver->capInfo = *capInfo;
+	saver->nextSetFlags = BURST_SET_FIRST | BURST_SET_LAST;
+	uint32_t segment = g_averageSegment ? g_averageSegment : capInfo->burstSize;
+	saver->averaging = g_averageBursts > 0 && SpectrumAverager_Init(&saver->avg[0], 0, segment, g_averageOverlap) == 0 &&
+		SpectrumAverager_Init(&saver->avg[1], 1, segment, g_averageOverlap) == 0;
+
+	saver->writer = std::thread([saver] {
+		uint32_t idx;
+		char filename[72];
+		while(SampleRing_AcquireRead(&saver->ring, &idx)) {
+			int32_t channel = saver->channel[idx];
+			bool adcBurst = channel == CAPTURE_CHANNEL_ADC0 || channel == CAPTURE_CHANNEL_ADC1 || channel == CAPTURE_CHANNEL_ADC01;
+			if(saver->averaging && adcBurst) {
+				// ADC0/ADC1 pairs feed both averagers
+				uint32_t first = (channel == CAPTURE_CHANNEL_ADC1) ? 1 : 0, nbrChannels = (channel == CAPTURE_CHANNEL_ADC01) ? 2 : 1;
+				for(uint32_t ch = 0; ch < nbrChannels; ch++) {
+					if(saver->setFlags[idx] & BURST_SET_FIRST)
+						SpectrumAverager_Reset(&saver->avg[first + ch]);
+					SpectrumAverager_Feed(&saver->avg[first + ch], (const int16_t *)saver->ring.slot[idx] + ch, saver->capInfo.burstSize,
+						nbrChannels, false);
+				}
+				if(saver->setFlags[idx] & BURST_SET_LAST)
+					SpectrumAverager_Save(&saver->avg[first], nbrChannels, saver->capInfo.sampleRate, saver->name[idx]);
+			}
+			if(!(saver->setFlags[idx] & BURST_SET_LAST)) {
+				SampleRing_Release(&saver->ring);
+				continue;
+			}
+
+			sprintf(filename, "%s.txt", saver->name[idx]);
+			DeleteFile(filename);
+			Save16BitArrayToFile(saver->ring.slot[idx], saver->ring.bytes[idx] / 2, filename, ASCII);
+			sprintf(filename, "%s.bin", saver->name[idx]);
+			DeleteFile(filename);
+			Save16BitArrayToFile(saver->ring.slot[idx], saver->ring.bytes[idx] / 2, filename, BINARY);
+			sprintf(filename, "%s.cap", saver->name[idx]);
+			SaveBurstToCaptureFile(saver->ring.slot[idx], filename, &saver->capInfo, saver->channel[idx]);
+			if((g_spectrumEnabled || g_nbrPeaks > 0) && adcBurst) {
+				AnalyseBurstSpectrum(saver->ring.slot[idx], saver->capInfo.burstSize, saver->channel[idx],
+					saver->capInfo.sampleRate, saver->name[idx]);
+			}
+			SampleRing_Release(&saver->ring);
+		}
+	});
+	return 0;
+}
+
+/**
+*  Get the buffer the next burst should be read into. The buffer stays owned by the caller until
+*  BurstSaver_Queue() is called, so it can also be used for data that does not need to be saved.
+*
+*  @param saver	running saver
+*  @return pointer to a 4 KiB aligned buffer of 2*BurstSize*nbrChannels bytes
+*/
+static uint8_t *BurstSaver_GetBuffer(BurstSaver *saver)
+{
+	return saver->ring.slot[SampleRing_AcquireWrite(&saver->ring)];
+}
+
+/**
+*  Queue the buffer returned by the last BurstSaver_GetBuffer() call for saving.
+*
+*  @param saver	running saver
+*  @param nbrSamples	number of 16 bit samples to save
+*  @param name	output file name without extension
+*  @param channel	CAPTURE_CHANNEL_xxx stored in the capture file
+*/
+static void BurstSaver_Queue(BurstSaver *saver, int32_t nbrSamples, const char *name, int32_t channel)
+{
+	uint32_t idx = saver->ring.wrIdx % saver->ring.nbrSlots;
+	saver->channel[idx] = channel;
+	saver->setFlags[idx] = saver->nextSetFlags;
+	strncpy(saver->name[idx], name, sizeof(saver->name[idx]) - 1);
+	saver->name[idx][sizeof(saver->name[idx]) - 1] = '\0';
+	SampleRing_CommitWrite(&saver->ring, 2 * nbrSamples);
+}
+
+/**
+*  Write all the queued bursts, stop the writer thread and release the buffers.
+*
+*  @param saver	running saver
+*/
+static void BurstSaver_Stop(BurstSaver *saver)
+{
+	SampleRing_Close(&saver->ring);
+	if(saver->writer.joinable())
+		saver->writer.join();
+	SampleRing_Destroy(&saver->ring);
+}
+
+/**
+*  Wait until all the queued bursts have been written, the writer keeps running.
+*
+*  @param saver	running saver
+*/
+static void BurstSaver_Flush(BurstSaver *saver)
+{
+	std::unique_lock<std::mutex> guard(saver->ring.lock);
+	saver->ring.cond.wait(guard, [saver] { return saver->ring.count == 0; });
+}
+
+/**
+*  Interleave two planes of samples into ADC0/ADC1 pairs.
+*
+*  @param adc0	ADC0 samples
+*  @param adc1	ADC1 samples
+*  @param out	receives 2*count samples, ADC0 first
+*  @param count	number of samples per plane
+*/
+static void InterleaveAdcPlanes(const uint16_t *adc0, const uint16_t *adc1, uint16_t *out, int32_t count)
+{
+	int32_t i = 0;
+#ifdef FMC_HAVE_SSE2
+	for(; i + 8 <= count; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(adc0 + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(adc1 + i));
+		_mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(a, b));
+		_mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+	}
+#endif
+	for(; i < count; i++) {
+		out[2 * i] = adc0[i];
+		out[2 * i + 1] = adc1[i];
+	}
+}
+
+/**
+*  Capture a burst from both ADCs of a card with a single software trigger, so that both channels hold samples
+*  taken at the same instants. Both channels are enabled and triggered once, then each FIFO is routed to the host
+*  through the S3D1 router and read. The caller must hold the routers.
+*
+*  @param AddrSipFMC150Ctrl	FMC15x.CTRL address of the card
+*  @param AddrSipRouterS3D1	S3D1 router address
+*  @param currentCard	card index, selects the router input
+*  @param BurstSize	number of samples per channel
+*  @param planes	receives the ADC0 burst followed by the ADC1 burst ( 4*BurstSize bytes )
+*  @return
+*						- -1 ( cannot enable the channels )
+*						- -2 ( cannot arm the DAC )
+*						- -3 ( cannot trigger )
+*						- -4 ( cannot configure the router )
+*						- -5 ( read failed )
+*						- 0 ( Success )
+*/
+static int32_t CaptureDualAdc(uint32_t AddrSipFMC150Ctrl, uint32_t AddrSipRouterS3D1, int32_t currentCard, int32_t BurstSize,
+							  uint8_t *planes)
+{
+	// the trigger and the ADC0 route go out as one transaction
+	SipTransaction tr;
+	SipTransaction_Begin(&tr);
+	SipTransaction_EnableChannel(&tr, AddrSipFMC150Ctrl, ENABLED, ENABLED, ENABLED, ENABLED);
+	SipTransaction_ArmDac(&tr, AddrSipFMC150Ctrl);
+	SipTransaction_SwTrigger(&tr, AddrSipFMC150Ctrl);
+	for(int32_t adc = 0; adc < 2; adc++) {
+		// the low byte of the S3D1 setting selects the FIFO, 2*card + adc
+		SipTransaction_ConfigureRouter(&tr, AddrSipRouterS3D1, ~(uint64_t)0xFF | (uint64_t)(currentCard * 2 + adc));
+		if(SipTransaction_Commit(&tr) != 0) {
+			printf("CaptureDualAdc() -> Could not trigger and route ADC%d\n", adc);
+			// operations 0 to 2 enable, arm and trigger, the router is always the last one
+			if(tr.failedOp == (int32_t)tr.nbrOps - 1)
+				return -4;
+			return tr.failedOp > 0 ? -1 - tr.failedOp : -1;
+		}
+		if(sipif_readdata(planes + adc * 2 * BurstSize, 2 * BurstSize) != SIPIF_ERR_OK) {
+			printf("CaptureDualAdc() -> Could not read ADC%d\n", adc);
+			return -5;
+		}
+		SipTransaction_Begin(&tr);
+	}
+	return 0;
+}
+
+/**
+*  Outcome of the ramp pattern check of one FMC card initialised with a given set of tap arguments, see
+*  TrainingCache_Lookup(). fmc15x_init() does not report the taps found by the IODELAY auto training, so only the
+*  need for the training is remembered: a card that passes the check with the tap arguments alone is initialised
+*  without training on the next start.
+*/
+typedef struct {
+	char board[96];							/*!< board identification, see main() */
+	uint16_t constellationId;				/*!< constellation ID */
+	uint8_t fpgatype;						/*!< FPGATYPE_160T or FPGATYPE_410T */
+	int32_t card;							/*!< FMC card index */
+	uint8_t tapiod_clk;						/*!< ADC clock IODELAY tap given to fmc15x_init() */
+	uint8_t tapiod_data;					/*!< ADC data IODELAY tap given to fmc15x_init() */
+	uint32_t odelay_tap;					/*!< ODELAY tap given to fmc15x_init() ( secondary FMC on PC720 ) */
+	int32_t patternResult;					/*!< result of the last ramp pattern check ( 0 passed, -1 failed ) */
+	int32_t trainingRequired;				/*!< 1 when the pattern check failed without auto training */
+} TrainingCacheEntry;
+
+static std::mutex g_trainingCacheLock;		/*!< the cards of a PC720 share TRAINING_CACHE_FILE */
+
+/**
+*  Read the entries of TRAINING_CACHE_FILE.
+*
+*  @param entries	receives the entries, empty when there is no file
+*/
+static void TrainingCache_Read(std::vector<TrainingCacheEntry> &entries)
+{
+	TrainingCacheEntry e;
+	unsigned int cid, fpga, clk, data;
+
+	FILE *fCache = fopen(TRAINING_CACHE_FILE, "r");
+	if(fCache == NULL)
+		return;
+	while(fscanf(fCache, "%95s %u %u %d %u %u %u %d %d", e.board, &cid, &fpga, &e.card, &clk, &data, &e.odelay_tap,
+		&e.patternResult, &e.trainingRequired) == 9) {
+		e.constellationId = (uint16_t)cid;
+		e.fpgatype = (uint8_t)fpga;
+		e.tapiod_clk = (uint8_t)clk;
+		e.tapiod_data = (uint8_t)data;
+		entries.push_back(e);
+	}
+	fclose(fCache);
+}
+
+/**
+*  Check whether two entries are about the same card initialised with the same tap arguments.
+*
+*  @param a	first entry
+*  @param b	second entry
+*  @return true when only patternResult and trainingRequired may differ
+*/
+static bool TrainingCache_SameKey(const TrainingCacheEntry *a, const TrainingCacheEntry *b)
+{
+	return !strcmp(a->board, b->board) && a->constellationId == b->constellationId && a->fpgatype == b->fpgatype &&
+		a->card == b->card && a->tapiod_clk == b->tapiod_clk && a->tapiod_data == b->tapiod_data && a->odelay_tap == b->odelay_tap;
+}
+
+/**
+*  Look for the outcome of a previous run in TRAINING_CACHE_FILE.
+*
+*  @param entry	board, constellationId, fpgatype, card and tap arguments to look for, receives patternResult and
+*				trainingRequired when found
+*  @return
+*						- -1 ( no entry )
+*						- 0 ( Success )
+*/
+static int32_t TrainingCache_Lookup(TrainingCacheEntry *entry)
+{
+	std::lock_guard<std::mutex> guard(g_trainingCacheLock);
+	std::vector<TrainingCacheEntry> entries;
+	TrainingCache_Read(entries);
+	for(size_t i = 0; i < entries.size(); i++) {
+		if(TrainingCache_SameKey(&entries[i], entry)) {
+			*entry = entries[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+*  Add or replace the outcome of a card in TRAINING_CACHE_FILE.
+*
+*  @param entry	outcome to store
+*/
+static void TrainingCache_Store(const TrainingCacheEntry *entry)
+{
+	std::lock_guard<std::mutex> guard(g_trainingCacheLock);
+	std::vector<TrainingCacheEntry> entries, kept;
+
+	// keep the entries of the other boards, cards and tap arguments
+	TrainingCache_Read(entries);
+	for(size_t i = 0; i < entries.size(); i++) {
+		if(!TrainingCache_SameKey(&entries[i], entry))
+			kept.push_back(entries[i]);
+	}
+	kept.push_back(*entry);
+
+	FILE *fCache = fopen(TRAINING_CACHE_FILE, "w");
+	if(fCache == NULL) {
+		printf("TrainingCache_Store() -> Cannot open file '%s' with write access\n", TRAINING_CACHE_FILE);
+		return;
+	}
+	for(size_t i = 0; i < kept.size(); i++) {
+		fprintf(fCache, "%s %u %u %d %u %u %u %d %d\n", kept[i].board, kept[i].constellationId, kept[i].fpgatype,
+			kept[i].card, kept[i].tapiod_clk, kept[i].tapiod_data, kept[i].odelay_tap, kept[i].patternResult,
+			kept[i].trainingRequired);
+	}
+	fclose(fCache);
+}
+
+/**
+*  One timed span of the startup profiler. Spans nest: a span opened while another one is open on the same
+*  thread becomes its child.
+*/
+typedef struct {
+	const char *name;						/*!< span name, must be a string literal */
+	int32_t parent;							/*!< index of the enclosing span, -1 for a top level span */
+	uint32_t depth;							/*!< nesting level, 0 for a top level span */
+	double start;							/*!< seconds from the first span to the start of this span */
+	double duration;						/*!< span duration in seconds, negative while the span is open */
+} ProfileSpanRecord;
+
+static std::mutex g_profileLock;
+static std::vector<ProfileSpanRecord> g_profileSpans;
+static std::chrono::steady_clock::time_point g_profileOrigin;
+static thread_local int32_t g_profileCurrent = -1;
+static const char *g_profileFile = NULL;
+
+/**
+*  Open a profiler span.
+*
+*  @param name	span name, must be a string literal
+*  @return span identifier to pass to Profile_End()
+*/
+static int32_t Profile_Begin(const char *name)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> guard(g_profileLock);
+
+	if(g_profileSpans.empty())
+		g_profileOrigin = now;
+	ProfileSpanRecord span;
+	span.name = name;
+	span.parent = g_profileCurrent;
+	span.depth = (g_profileCurrent < 0) ? 0 : g_profileSpans[g_profileCurrent].depth + 1;
+	span.start = std::chrono::duration<double>(now - g_profileOrigin).count();
+	span.duration = -1;
+	g_profileSpans.push_back(span);
+	g_profileCurrent = (int32_t)g_profileSpans.size() - 1;
+	return g_profileCurrent;
+}
+
+/**
+*  Close a profiler span and the spans still open inside it.
+*
+*  @param id	identifier returned by Profile_Begin()
+*/
+static void Profile_End(int32_t id)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> guard(g_profileLock);
+
+	if(id < 0 || id >= (int32_t)g_profileSpans.size())
+		return;
+	double t = std::chrono::duration<double>(now - g_profileOrigin).count();
+	for(int32_t i = g_profileCurrent; i >= 0 && i != g_profileSpans[id].parent; i = g_profileSpans[i].parent) {
+		if(g_profileSpans[i].duration < 0)
+			g_profileSpans[i].duration = t - g_profileSpans[i].start;
+	}
+	g_profileCurrent = g_profileSpans[id].parent;
+}
+
+/**
+*  Make the spans opened next by the calling thread children of another span, for worker threads.
+*
+*  @param parent	span identifier returned by Profile_Begin() in the parent thread
+*/
+static void Profile_Adopt(int32_t parent)
+{
+	g_profileCurrent = parent;
+}
+
+/**
+*  Close a span and open the next one at the same level, for sequential phases.
+*
+*  @param id	span to close ( ignored when negative ), receives the new span
+*  @param name	name of the next span, must be a string literal
+*/
+static void Profile_Next(int32_t *id, const char *name)
+{
+	if(*id >= 0)
+		Profile_End(*id);
+	*id = Profile_Begin(name);
+}
+
+/**
+*  List the spans below a parent depth first, so that the spans of concurrent threads are printed under their parent.
+*/
+static void Profile_Order(int32_t parent, std::vector<int32_t> &order)
+{
+	for(size_t i = 0; i < g_profileSpans.size(); i++) {
+		if(g_profileSpans[i].parent == parent) {
+			order.push_back((int32_t)i);
+			Profile_Order((int32_t)i, order);
+		}
+	}
+}
+
+/**
+*  Print the profiled spans as an indented tree and write them as JSON to g_profileFile. Spans still open
+*  ( early exit on error ) are closed at the time of the call and flagged as incomplete. Registered with atexit().
+*/
+static void Profile_WriteSummary(void)
+{
+	if(!g_profileFile)
+		return;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> guard(g_profileLock);
+	double t = std::chrono::duration<double>(now - g_profileOrigin).count();
+
+	printf("\n--- Startup profile ---\n");
+	printf("%-40s %10s %10s %7s\n", "span", "start ms", "dur ms", "% par");
+	std::vector<int32_t> order;
+	Profile_Order(-1, order);
+	for(size_t i = 0; i < order.size(); i++) {
+		ProfileSpanRecord &span = g_profileSpans[order[i]];
+		bool incomplete = span.duration < 0;
+		double duration = incomplete ? t - span.start : span.duration;
+		double parent = (span.parent < 0) ? 0 : g_profileSpans[span.parent].duration;
+		if(parent < 0)
+			parent = t - g_profileSpans[span.parent].start;
+		printf("%*s%-*s %10.3f %10.3f %6.1f%%%s\n", 2 * span.depth, "", 40 - 2 * span.depth, span.name, span.start * 1e3,
+			duration * 1e3, parent > 0 ? 100.0 * duration / parent : 100.0, incomplete ? " (incomplete)" : "");
+	}
+	printf("--------------------------------------\n");
+
+	FILE *fOutFile = fopen(g_profileFile, "w");
+	if(fOutFile == NULL) {
+		printf("Profile_WriteSummary() -> Cannot open file '%s' with write access\n", g_profileFile);
+		return;
+	}
+	fprintf(fOutFile, "{\n  \"clock\": \"steady_clock\",\n  \"total_ms\": %.6f,\n  \"spans\": [\n", t * 1e3);
+	for(size_t i = 0; i < g_profileSpans.size(); i++) {
+		ProfileSpanRecord &span = g_profileSpans[i];
+		bool incomplete = span.duration < 0;
+		fprintf(fOutFile, "    { \"id\": %u, \"name\": \"%s\", \"parent\": %d, \"depth\": %u, \"start_ms\": %.6f, \"duration_ms\": %.6f, \"complete\": %s }%s\n",
+			(uint32_t)i, span.name, span.parent, span.depth, span.start * 1e3, (incomplete ? t - span.start : span.duration) * 1e3,
+			incomplete ? "false" : "true", i + 1 < g_profileSpans.size() ? "," : "");
+	}
+	fprintf(fOutFile, "  ]\n}\n");
+	fclose(fOutFile);
+	printf("Startup profile written to '%s'\n", g_profileFile);
+}
+
+/**
+*  Look for an optional "--name" or "--name=value" argument following the mandatory arguments.
+*
+*  @param argc	the number of options in the command line
+*  @param argv	the command line
+*  @param name	option name without the leading "--"
+*  @return
+*						- NULL ( option not given )
+*						- pointer to the option value ( empty string when the option has no value )
+*/
+static const char *GetOptionArg(int32_t argc, char* argv[], const char *name)
+{
+	size_t len = strlen(name);
+	for(int32_t i = 6; i < argc; i++) {
+		if(strncmp(argv[i], "--", 2) != 0 || strncmp(argv[i] + 2, name, len) != 0)
+			continue;
+		if(argv[i][2 + len] == '\0')
+			return argv[i] + 2 + len;
+		if(argv[i][2 + len] == '=')
+			return argv[i] + 3 + len;
+	}
+	return NULL;
+}
+
+/**
+*  Settings shared by all the FMC cards of the constellation, see RunCard().
+*/
+typedef struct {
+	uint16_t constellationId;				/*!< constellation ID as returned by cid_getconstellationid() */
+	uint32_t AddrSipFMC150;					/*!< FMC150/FMC151 star address */
+	uint32_t AddrSipFMC150SEC;				/*!< secondary FMC150/FMC151 star address ( PC720 with two cards ) */
+	uint32_t AddrSipI2cMaster;				/*!< I2C master star address */
+	uint32_t AddrSipRouterS1D3;				/*!< router carrying the waveforms to the DACs */
+	uint32_t AddrSipRouterS3D1;				/*!< router carrying the ADC samples to the host */
+	uint32_t AddrSipMemoryFIFO;				/*!< DDR3 memory FIFO star address ( ZC706 DDR3 only ) */
+	int32_t modeClock;						/*!< clock mode argument */
+	uint8_t tapiod_clk;						/*!< default ADC clock IODELAY tap */
+	uint8_t tapiod_data;					/*!< default ADC data IODELAY tap */
+	uint32_t odelay_tap;					/*!< default ODELAY tap */
+	uint8_t fpgatype;						/*!< FPGATYPE_xxx */
+	int32_t auto_training;					/*!< auto training argument */
+	float fReference;						/*!< reference frequency in MHz */
+	int32_t devIdx;							/*!< device index argument */
+	const char *boardId;					/*!< board identification for the training cache */
+	bool useTrainingCache;					/*!< skip the IODELAY auto training when a previous run did not need it */
+	const char *dac0Spec;					/*!< DAC0 waveform, see GenerateWaveformFromSpec() */
+	const char *dac1Spec;					/*!< DAC1 waveform, see GenerateWaveformFromSpec() */
+	double streamSeconds;					/*!< streaming duration, 0 when disabled */
+	int32_t streamAdc;						/*!< ADC used in streaming mode */
+	bool streamCheck;						/*!< stream the ramp pattern and check it */
+	int32_t dualAdc;						/*!< DUAL_ADC_xxx */
+	bool keepState;							/*!< leave the card ready after the first capture, for the service mode */
+} CardSetup;
+
+static std::mutex g_i2cSwitchLock;			/*!< held while a card of a PC720 is selected by the I2C switch */
+static std::mutex g_routerLock;				/*!< held while the shared S1D3/S3D1 routers point to a card */
+
+/**
+*  A card that has been brought up by RunCard(), with everything needed to load the DACs and capture more bursts.
+*  In service mode ( see ServeCommands() ) the state outlives RunCard() so that the buffers, the writer thread and
+*  the IODELAY calibration stay warm between commands.
+*/
+typedef struct {
+	int32_t card;							/*!< card index, 0 for the primary card */
+	uint16_t constellationId;				/*!< constellation ID read with cid_getconstellationid() */
+	int32_t devIdx;							/*!< device index argument */
+	uint32_t AddrSipFMC150Ctrl;				/*!< FMC15x.CTRL address */
+	uint32_t AddrSipFMC150AdcSpi;			/*!< FMC15x ADC SPI address */
+	uint32_t AddrSipRouterS1D3;				/*!< S1D3 router address */
+	uint32_t AddrSipRouterS3D1;				/*!< S3D1 router address */
+	uint32_t AddrSipMemoryFIFO;				/*!< DDR3 memory FIFO address */
+	int32_t BurstSize;						/*!< samples per burst */
+	int32_t dualAdc;						/*!< DUAL_ADC_xxx */
+	double dacSampleRate;					/*!< DAC sample rate in Hz used to plan the waveforms */
+	uint8_t *pOutData;						/*!< waveform buffer followed by the dual ADC planes */
+	uint8_t *pPlanes;						/*!< ADC0 and ADC1 planes of a dual ADC capture */
+	const char *cardSuffix;					/*!< file name suffix telling the cards of a PC720 apart */
+	CaptureFileHeader capInfo;				/*!< board description for the capture files */
+	BurstSaver saver;						/*!< in buffers + background file writer */
+	bool ready;								/*!< buffers allocated and writer running */
+} CardState;
+
+/**
+*  Write all the queued bursts of a card and release its buffers.
+*
+*  @param st	card state, nothing is done when it is not ready
+*/
+static void Card_Release(CardState *st)
+{
+	if(!st->ready)
+		return;
+	BufferPool_Free(&g_bufferPool, st->pOutData);
+	BurstSaver_Stop(&st->saver);
+	st->ready = false;
+}
+
+/**
+*  Generate a waveform, queue it for saving as dac0/dac1 and load it in the waveform memory of a DAC.
+*
+*  @param st	ready card state
+*  @param dac	0 for DAC0, 1 for DAC1
+*  @param spec	waveform specification, see GenerateWaveformFromSpec()
+*  @param prefix	file name prefix of the saved waveform
+*  @return
+*						- -14 ( cannot configure the S1D3 router )
+*						- -15 / -18 ( cannot prepare the DAC0 / DAC1 waveform upload )
+*						- -16 / -19 ( DAC0 / DAC1 waveform upload failed )
+*						- -17 ( invalid waveform specification, the DAC is left untouched )
+*						- 0 ( Success )
+*/
+static int32_t Card_LoadDac(CardState *st, int32_t dac, const char *spec, const char *prefix)
+{
+	std::unique_lock<std::mutex> routes(g_routerLock, std::defer_lock);
+	int32_t BurstSize = st->BurstSize;
+	char saveName[64];
+
+	// The burst size is shared by the ADCs and the DACs, so the waveform planner only gets to pick the period count
+	if(GenerateWaveformFromSpec((uint16_t *)st->pOutData, BurstSize, spec, dac, st->dacSampleRate, (uint32_t)pow(2.0f,15.8f))!=0) {
+		printf("Could not generate waveform\n");
+		return -17;
+	}
+
+	// queue the waveform for saving
+	sprintf(saveName, "%sdac%d%s", prefix, dac, st->cardSuffix);
+	memcpy(BurstSaver_GetBuffer(&st->saver), st->pOutData, 2*BurstSize);
+	BurstSaver_Queue(&st->saver, BurstSize, saveName, dac == 0 ? CAPTURE_CHANNEL_DAC0 : CAPTURE_CHANNEL_DAC1);
+
+	// configure the router ( route data to the DAC's wave form memory )
+	uint64_t routerSetting = (dac == 0) ? 0xff : 0xff00;
+	routerSetting = routerSetting << (st->card * 16);
+	routerSetting = ~routerSetting;
+
+	routes.lock();
+	if(ShadowReg_ConfigureRouter(st->AddrSipRouterS1D3, routerSetting)!=SXDXROUTER_ERR_OK) {
+		printf("Could not configure S1D3 router, exiting\n");
+		return -14;
+	}
+	// prepare the firmware to receive waveform data
+	if(fmc15x_ctrl_prepare_wfm_load(st->AddrSipFMC150Ctrl, dac == 0 ? DAC0 : DAC1)!=FMC15x_CTRL_ERR_OK) {
+		printf("Could not prepare waveform upload, exiting\n");
+		return dac == 0 ? -15 : -18;
+	}
+
+	// send the data to the waveform memory
+	if(sipif_writedata(st->pOutData,  2*BurstSize)!=SIPIF_ERR_OK) {
+		printf("Could not communicate with device %d.\n", st->devIdx);
+		return dac == 0 ? -16 : -19;
+	}
+	return 0;
+}
+
+/**
+*  Capture a burst from ADC0 and ADC1, on separate triggers or on a single one ( st->dualAdc ). In pattern check
+*  mode the bursts are checked against the ADC ramp test pattern, otherwise they are queued for saving.
+*
+*  @param st	ready card state
+*  @param patternCheck	put the ADCs in ramp pattern mode and check the bursts
+*  @param prefix	file name prefix of the saved bursts
+*  @param patternResult	set to -1 when a burst fails the pattern check, may be NULL when patternCheck is false
+*  @param names	when not NULL, receives the space separated names of the queued files ( without extension )
+*  @return
+*						- -13 ( cannot set the ADC pattern mode )
+*						- -20 to -24 ( cannot configure the memory FIFO, route, enable, arm, trigger or read ADC0 )
+*						- -25 to -29 ( cannot route, enable, arm, trigger or read ADC1 )
+*						- 0 ( Success )
+*/
+static int32_t Card_Capture(CardState *st, bool patternCheck, const char *prefix, int32_t *patternResult, std::string *names)
+{
+	std::unique_lock<std::mutex> routes(g_routerLock, std::defer_lock);
+	int32_t BurstSize = st->BurstSize;
+	uint8_t *pPlanes = st->pPlanes;
+	uint8_t *pInData;
+	char saveName[64];
+
+	if (ShadowReg_AdcPatternCheck(st->AddrSipFMC150AdcSpi, patternCheck) != FMC15x_ADC_ERR_OK)
+	{
+		printf ("Could not enabled pattern check\n");
+		return -13;
+	}
+
+	if (st->dualAdc != DUAL_ADC_OFF) {
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Read a burst from ADC0 and ADC1 taken on the same trigger, the routers are held once for both reads
+		if (!patternCheck)
+			printf("Retrieve %d samples from ADC0 and ADC1 on a single trigger\n", BurstSize);
+		routes.lock();
+		if(CaptureDualAdc(st->AddrSipFMC150Ctrl, st->AddrSipRouterS3D1, st->card, BurstSize, pPlanes) != 0) {
+			printf("Could not communicate with device %d.\n", st->devIdx);
+			return -24;
+		}
+		routes.unlock();
+
+		if (patternCheck) {
+			if (verify_ramp_pattern((char *)pPlanes, BurstSize) != 0)
+				*patternResult = -1;
+			if (verify_ramp_pattern((char *)(pPlanes + 2*BurstSize), BurstSize) != 0)
+				*patternResult = -1;
+		}
+		else if (st->dualAdc == DUAL_ADC_INTERLEAVED) {
+			// one buffer of ADC0/ADC1 sample pairs
+			pInData = BurstSaver_GetBuffer(&st->saver);
+			InterleaveAdcPlanes((const uint16_t *)pPlanes, (const uint16_t *)(pPlanes + 2*BurstSize), (uint16_t *)pInData, BurstSize);
+			sprintf(saveName, "%sadc01%s", prefix, st->cardSuffix);
+			BurstSaver_Queue(&st->saver, 2*BurstSize, saveName, CAPTURE_CHANNEL_ADC01);
+			if (names)
+				names->append(" ").append(saveName);
+		}
+		else {
+			// one file per plane, named like the separate trigger captures
+			for (int32_t adc = 0; adc < 2; adc++) {
+				memcpy(BurstSaver_GetBuffer(&st->saver), pPlanes + adc*2*BurstSize, 2*BurstSize);
+				sprintf(saveName, "%sadc%d%s", prefix, adc, st->cardSuffix);
+				BurstSaver_Queue(&st->saver, BurstSize, saveName, adc == 0 ? CAPTURE_CHANNEL_ADC0 : CAPTURE_CHANNEL_ADC1);
+				if (names)
+					names->append(" ").append(saveName);
+			}
+		}
+		return 0;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Read a burst from ADC0 then from ADC1 and save them to file
+	for (int32_t adc = 0; adc < 2; adc++) {
+		// ADC0 fails with -20 to -24, ADC1 with -25 to -29
+		int32_t errBase = (adc == 0) ? -20 : -25;
+
+		// route data from the ADC's FIFO, the routers stay locked until the burst has been read
+		routes.lock();
+		// Configure the DDR3 FIFO
+		if( adc == 0 && st->constellationId == CONSTELLATION_ID_FMC151_ZC706_DDR3) {
+			// Configure and arm the FIFO
+			if(memfifo_configure(st->AddrSipMemoryFIFO, 0, NBRBURST_UNLIMITED, 2*BurstSize, 0, 0, FIFO_ARMED)!=MEMFIFO_ERR_OK) {
+				printf("Could not configure the memory FIFO\n ");
+				return -20;
+			}
+		}
+
+		// route the ADC's FIFO, enable the ADC + DAC0 + DAC1, arm the DAC and send a software trigger to the ADC block
+		SipTransaction tr;
+		SipTransaction_Begin(&tr);
+		SipTransaction_ConfigureRouter(&tr, st->AddrSipRouterS3D1, ~(uint64_t)0xFF | (uint64_t)(st->card * 2 + adc));
+		SipTransaction_EnableChannel(&tr, st->AddrSipFMC150Ctrl, adc == 0 ? ENABLED : DISABLED, adc == 1 ? ENABLED : DISABLED,
+			ENABLED, ENABLED);
+		SipTransaction_ArmDac(&tr, st->AddrSipFMC150Ctrl);
+		SipTransaction_SwTrigger(&tr, st->AddrSipFMC150Ctrl);
+		if(SipTransaction_Commit(&tr)!=0) {
+			printf("Could not trigger ADC%d, exiting\n", adc);
+			// router, enable, arm and trigger are operations 0 to 3
+			return tr.failedOp > 0 ? errBase - tr.failedOp : errBase;
+		}
+
+		// Read data from the pipe
+		if (!patternCheck)
+			printf("Retrieve %d samples from ADC%d\n", BurstSize, adc);
+		pInData = BurstSaver_GetBuffer(&st->saver);
+		if(sipif_readdata(pInData, 2*BurstSize)!=SIPIF_ERR_OK) {
+			printf("Could not communicate with device %d.\n", st->devIdx);
+			return errBase - 4;
+		}
+		routes.unlock();
+
+		if (patternCheck) {
+			if (verify_ramp_pattern((char *)pInData, BurstSize) != 0)
+				*patternResult = -1;
+		}
+		else {
+			// hand the buffer over to the file writer, the next trigger does not wait for the disk
+			sprintf(saveName, "%sadc%d%s", prefix, adc, st->cardSuffix);
+			BurstSaver_Queue(&st->saver, BurstSize, saveName, adc == 0 ? CAPTURE_CHANNEL_ADC0 : CAPTURE_CHANNEL_ADC1);
+			if (names)
+				names->append(" ").append(saveName);
+		}
+	}
+	return 0;
+}
+
+/**
+*  Capture a set of g_averageBursts bursts from ADC0 and ADC1 ( a single burst when averaging is off ) and queue
+*  them for saving. The writer averages the spectra of the whole set and only writes the files of the last burst.
+*
+*  @param st	ready card state
+*  @param prefix	file name prefix of the saved bursts
+*  @param names	when not NULL, receives the space separated names of the queued files ( without extension )
+*  @return see Card_Capture()
+*/
+static int32_t Card_Acquire(CardState *st, const char *prefix, std::string *names)
+{
+	uint32_t nbrBursts = (st->saver.averaging && g_averageBursts > 1) ? g_averageBursts : 1;
+	int32_t rc = 0;
+	for(uint32_t b = 0; b < nbrBursts && rc == 0; b++) {
+		st->saver.nextSetFlags = (b == 0 ? BURST_SET_FIRST : 0) | (b == nbrBursts - 1 ? BURST_SET_LAST : 0);
+		rc = Card_Capture(st, false, prefix, NULL, b == nbrBursts - 1 ? names : NULL);
+	}
+	st->saver.nextSetFlags = BURST_SET_FIRST | BURST_SET_LAST;
+	return rc;
+}
+
+/**
+*  Bring up one FMC card, load both DACs, run the ramp pattern check and capture a burst from both ADCs, on separate
+*  triggers or on a single one ( setup->dualAdc ).
+*  The cards of a PC720 run this concurrently: only the I2C switch ( from the switch write to the end of the
+*  diagnostics, then again around the FMC151 DC offset configuration ) and the routers ( from their configuration to
+*  the end of the matching transfer ) are held exclusively.
+*
+*  @param setup	settings shared by all the cards
+*  @param currentCard	card index, 0 for the primary card
+*  @param state	receives the card state, released on return unless setup->keepState is set and the card succeeded
+*  @return
+*						- negative value ( error, same codes as main() )
+*						- 0 ( Success )
+*/
+static int32_t RunCard(const CardSetup *setup, int32_t currentCard, CardState *state)
+{
+	// copies of the settings, the taps are adjusted for every card
+	uint16_t constellation_id = setup->constellationId;
+	uint32_t AddrSipFMC150 = setup->AddrSipFMC150;
+	uint32_t AddrSipFMC150SEC = setup->AddrSipFMC150SEC;
+	uint32_t AddrSipI2cMaster = setup->AddrSipI2cMaster;
+	uint32_t AddrSipRouterS1D3 = setup->AddrSipRouterS1D3;
+	uint32_t AddrSipRouterS3D1 = setup->AddrSipRouterS3D1;
+	uint32_t AddrSipMemoryFIFO = setup->AddrSipMemoryFIFO;
+	int32_t modeClock = setup->modeClock;
+	uint8_t tapiod_clk = setup->tapiod_clk;
+	uint8_t tapiod_data = setup->tapiod_data;
+	uint32_t odelay_tap = setup->odelay_tap;
+	uint8_t fpgatype = setup->fpgatype;
+	int32_t auto_training = setup->auto_training;
+	float fReference = setup->fReference;
+	int32_t devIdx = setup->devIdx;
+	int32_t dualAdc = setup->dualAdc;
+	state->ready = false;
+
+	// the I2C switch and the routers are shared by the cards of a PC720
+	std::unique_lock<std::mutex> i2cSwitch(g_i2cSwitchLock, std::defer_lock);
+	std::unique_lock<std::mutex> routes(g_routerLock, std::defer_lock);
+
+	// the DDR3 memory FIFO carries a single ADC stream
+	if(dualAdc != DUAL_ADC_OFF && constellation_id == CONSTELLATION_ID_FMC151_ZC706_DDR3) {
+		printf("Dual ADC capture is not available through the DDR3 memory FIFO, using separate triggers\n");
+		dualAdc = DUAL_ADC_OFF;
+	}
+
+	int32_t phase = -1;
+	int32_t cardSpan = Profile_Begin(currentCard == 0 ? "card0" : "card1");
+	Profile_Next(&phase, "i2c_switch");
+	uint32_t AddrSipFMC150Ctrl;
+	uint32_t AddrSipFMC150AdcPhy;
+	uint32_t AddrSipFMC150DacPhy;
+	uint32_t AddrSipFMC150AdcSpi;
+	uint32_t AddrSipFMC150DacSpi;
+	uint32_t AddrSipFMC150ClkSpi;
+	uint32_t AddrSipFMC150FreqCnt;
+	uint32_t AddrSipFMC150Monitor;
+
+	if (constellation_id != CONSTELLATION_ID_PC720_BOTH && constellation_id != CONSTELLATION_ID_FMC151_PC720_BOTH) {
+		// Calculate BAR of every peripheral mapped (sub mapping) to the FMC150 star's memory. This uses fixed offsets given by the FMC150 
+		// For all constellation except one with two FMC cards
+		AddrSipFMC150Ctrl    = AddrSipFMC150 + 0x000;
+		AddrSipFMC150AdcPhy  = AddrSipFMC150 + 0x010;
+		AddrSipFMC150DacPhy  = AddrSipFMC150 + 0x020;
+		AddrSipFMC150AdcSpi  = AddrSipFMC150 + 0x100;
+		AddrSipFMC150DacSpi  = AddrSipFMC150 + 0x300;
+		AddrSipFMC150ClkSpi  = AddrSipFMC150 + 0x400;
+		AddrSipFMC150FreqCnt = AddrSipFMC150 + 0x600;
+		AddrSipFMC150Monitor = AddrSipFMC150 + 0x700;
+	}
+	else {
+
+		if (currentCard == 0) {
+			// first Card on the PC720
+			AddrSipFMC150Ctrl    = AddrSipFMC150 + 0x000;
+			AddrSipFMC150AdcPhy  = AddrSipFMC150 + 0x010;
+			AddrSipFMC150DacPhy  = AddrSipFMC150 + 0x020;
+			AddrSipFMC150AdcSpi  = AddrSipFMC150 + 0x100;
+			AddrSipFMC150DacSpi  = AddrSipFMC150 + 0x300;
+			AddrSipFMC150ClkSpi  = AddrSipFMC150 + 0x400;
+			AddrSipFMC150FreqCnt = AddrSipFMC150 + 0x600;
+			AddrSipFMC150Monitor = AddrSipFMC150 + 0x700;
+
+			i2cSwitch.lock();
+			sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x01);	// I2C switch set to primary FMC
+			Sleep(10);
+		}
+		else {
+			// second Card on the PC720
+			AddrSipFMC150Ctrl    = AddrSipFMC150SEC + 0x000;
+			AddrSipFMC150AdcPhy  = AddrSipFMC150SEC+ 0x010;
+			AddrSipFMC150DacPhy  = AddrSipFMC150SEC + 0x020;
+			AddrSipFMC150AdcSpi  = AddrSipFMC150SEC + 0x100;
+			AddrSipFMC150DacSpi  = AddrSipFMC150SEC + 0x300;
+			AddrSipFMC150ClkSpi  = AddrSipFMC150SEC + 0x400;
+			AddrSipFMC150FreqCnt = AddrSipFMC150SEC + 0x600;
+			AddrSipFMC150Monitor = AddrSipFMC150SEC + 0x700;
+
+			tapiod_clk = 0;	tapiod_data = 0;					// Tap values for secondary FMC150
+			i2cSwitch.lock();
+			sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x02);	// I2C switch set to secondary FMC
+			Sleep(10);
+		}
+	}
+
+	// Configure I2C switch
+	if( constellation_id == CONSTELLATION_ID_KC705) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x02); // Switch set to LPC		
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_KC705_PCIe) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x02); // Switch set to LPC		
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_VC707) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x01); // Switch set to HPC_1	
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC1) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x02); // Switch set to HPC_1	
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC2) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x04); // Switch set to HPC_2	
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_PC720_PRIMARY) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x01);	// I2C switch set to primary FMC
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_PC720_SECONDARY) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x02);	// I2C switch set to secondary FMC
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_FMC151_PC720_PRIMARY) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x01);	// I2C switch set to primary FMC
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_FMC151_PC720_SECONDARY) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x02);	// I2C switch set to secondary FMC
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_FMC151_KC705) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x04); // Switch set to LPC		
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_FMC151_ZC706) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x40); // Switch set to LPC		
+		Sleep(10);	
+	}
+	if( constellation_id == CONSTELLATION_ID_FMC151_ZC706_DDR3) {
+		sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x40); // Switch set to LPC		
+		Sleep(10);	
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Configure the routers
+	// Setup 1-to-3 Router
+	Profile_Next(&phase, "sxdx_configurerouter");
+	routes.lock();
+#ifdef WIN32
+	if(ShadowReg_ConfigureRouter(AddrSipRouterS1D3, 0xFFFFFFFFFFFFFF00)!=SXDXROUTER_ERR_OK) {
+		printf("Could not configure S1D3 router, exiting\n");
+		return -8;
+	}
+
+	// Setup 3-to-1 Router
+	if(ShadowReg_ConfigureRouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF00)!=SXDXROUTER_ERR_OK) {
+		printf("Could not configure S3D1 router, exiting\n");
+		return -9;
+	}
+#else
+	if(ShadowReg_ConfigureRouter(AddrSipRouterS1D3, 0xFFFFFFFFFFFFFF00LLU)!=SXDXROUTER_ERR_OK) {
+		printf("Could not configure S1D3 router, exiting\n");
+		return -8;
+	}
+
+	// Setup 3-to-1 Router
+	if(ShadowReg_ConfigureRouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF00LLU)!=SXDXROUTER_ERR_OK) {
+		printf("Could not configure S3D1 router, exiting\n");
+		return -9;
+	}
+#endif
+	routes.unlock();
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Detect FMC Presence
+	Profile_Next(&phase, "fmc15x_ctrl_probefmc");
+	if(fmc15x_ctrl_probefmc(AddrSipFMC150Ctrl)!=FMC15x_ERR_OK) {
+		printf("Could not detect FMC150 hardware, exiting\n");
+		return -11;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Temperature/Voltages monitoring
+	Profile_Next(&phase, "fmc15x_monitor_getdiags");
+	printf("---  Measuring on-board voltages   ---\n");
+	if(fmc15x_monitor_getdiags(AddrSipFMC150Monitor)!=FMC15x_MON_ERR_OK) {
+		printf("An error occurred in the FMC150 diagnostics function.\n");
+		printf("An error occurred in the FMC150 diagnostics function, exiting\n");
+		return -10;
+	}
+	printf("--------------------------------------\n\n");
+	// the card is not reached through the I2C switch again before the DC offset configuration
+	if(i2cSwitch.owns_lock())
+		i2cSwitch.unlock();
+
+	/////////////////////////////////////////////////////////////////////////////////////////////
+	// Determine the VCXO type
+	// The firmware default power up divider on the DAC reference clock (frequency 6) is two;
+	// - When a 737.28MHz VCXO is assembled the frequency readout will be around 368.64MHz
+	// - When a 491.52MHz VCXO is assembled the frequency readout will be around 245.76MHz
+	// - When a 542.40MHz VCXO is assembled the frequency readout will be around 271.20MHz
+	// - When a 800.00MHz VCXO is assembled the frequency readout will be around 400.00MHz
+	// - When a 480.00MHz VCXO is assembled the frequency readout will be around 240.00MHz
+	Profile_Next(&phase, "vcxo_detect");
+	float freq ;
+	
+	
+	int32_t vcxoType = FMC150_VCXO_737_28;
+	if(fmc15x_freqcnt_getfrequency(AddrSipFMC150FreqCnt, 6, &freq, FMC15x_FREQCNT_NO_DISPLAY_CONSOLE, 0, fReference)!=FMC15x_FREQCNT_ERR_OK) {
+		printf("Could not obtain frequency id%d from FMC15x.FREQCNT\n", 6);
+		return -12;
+	}
+
+	// this check MUST happen before internal/external clock check
+	if ( freq > 395 && freq < 405 )
+		vcxoType = FMC150_VCXO_800_00;
+
+	if (freq < 300 || modeClock == 1)
+		vcxoType = FMC150_VCXO_542_40;
+
+	if (freq < 260 || modeClock == 1)
+		vcxoType = FMC150_VCXO_491_52;
+
+	if (freq < 245 || modeClock == 1)
+		vcxoType = FMC150_VCXO_480_00 ;
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Skip the IODELAY auto training when a previous run found that this card passes the ramp pattern check with
+	// the same tap arguments without it. The check runs again below and the card is trained if it fails.
+	Profile_Next(&phase, "fmc15x_init");
+	TrainingCacheEntry training;
+	memset(&training, 0, sizeof(training));
+	strncpy(training.board, setup->boardId, sizeof(training.board) - 1);
+	training.constellationId = constellation_id;
+	training.fpgatype = fpgatype;
+	training.card = currentCard;
+	training.tapiod_clk = tapiod_clk;
+	training.tapiod_data = tapiod_data;
+	training.odelay_tap = odelay_tap;
+	int32_t cardAutoTraining = auto_training;
+	bool skippingTraining = false;
+	if(setup->useTrainingCache && cardAutoTraining == 1 && TrainingCache_Lookup(&training) == 0 &&
+		training.patternResult == 0 && !training.trainingRequired) {
+		cardAutoTraining = 0;
+		skippingTraining = true;
+		printf("Skipping the IODELAY auto training of card %d, a previous run passed the pattern check without it\n", currentCard);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Init FMC150
+	if(fmc15x_init(AddrSipFMC150ClkSpi, AddrSipFMC150DacSpi, AddrSipFMC150DacPhy, AddrSipFMC150AdcSpi, AddrSipFMC150AdcPhy,
+		AddrSipFMC150Monitor, modeClock, vcxoType, tapiod_clk, tapiod_data, odelay_tap, constellation_id, cardAutoTraining)!=FMC15x_ERR_OK) {
+			printf("Could not initialize FMC150\n");
+			return -11;
+	}
+	ShadowReg_InvalidateCard();
+	printf("\n");
+
+	/////////////////////////////////////////////////////////////////////////////////////////////
+	// Measure and display all available frequencies in a loop.
+	// Note that the first frequencies (ADC clocks) are going to display erroneous values if no
+	// FMC is actually attached.
+	Profile_Next(&phase, "fmc15x_freqcnt_getfrequency");
+	printf("--------------------------------------\n\n");
+	printf("\n--- Measuring on-board frequencies ---\n");
+	for(int32_t i = 0; i < 7; i++) {
+		if(fmc15x_freqcnt_getfrequency(AddrSipFMC150FreqCnt, i, NULL, FMC15x_FREQCNT_DISPLAY_CONSOLE, vcxoType, fReference)!=FMC15x_FREQCNT_ERR_OK) {
+			printf("Could not obtain frequency id%d from FMC15x.FREQCNT\n", i);
+			return -12;
+		}
+	}
+	printf("--------------------------------------\n\n");
+
+	// DAC sample clock used to plan coherent waveforms and stored in the capture file headers, read from the DAC
+	// reference clock counter (frequency 6). Fall back to the nominal rate when it cannot be measured.
+	float dacClock;
+	double dacSampleRate = SAMPLE_RATE;
+	if(fmc15x_freqcnt_getfrequency(AddrSipFMC150FreqCnt, 6, &dacClock, FMC15x_FREQCNT_NO_DISPLAY_CONSOLE, vcxoType, fReference)==FMC15x_FREQCNT_ERR_OK
+		&& dacClock > 0) {
+		dacSampleRate = dacClock * 1e6;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Configure burst size and burst number
+	Profile_Next(&phase, "configure_burst");
+	int32_t BurstSize = 1024; // samples
+	switch( cid_getconstellationid() )
+	{
+	case CONSTELLATION_ID_FMC151_ML605:
+	case CONSTELLATION_ID_ML605:
+	case CONSTELLATION_ID_ML605_PCIe:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_KC705_PCIe:
+	case CONSTELLATION_ID_KC705:
+	case CONSTELLATION_ID_FMC151_KC705:
+		BurstSize = 16 * 1024;
+		break;
+	case CONSTELLATION_ID_FMC151_VC707_HPC1:
+	case CONSTELLATION_ID_FMC151_VC707_HPC2:
+	case CONSTELLATION_ID_VC707:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_FMC151_ZC706:
+	case CONSTELLATION_ID_FMC151_ZC706_DDR3:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_SP601:
+		BurstSize = 1024;
+		break;
+	case CONSTELLATION_ID_SP605:
+		BurstSize = 1024;
+		break;
+	case CONSTELLATION_ID_FM680:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_VP680:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_PC720_PRIMARY:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_PC720_SECONDARY:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_sFMC720:
+		BurstSize = 16*1024;
+		break;	
+	case CONSTELLATION_ID_FMC151_PC720_PRIMARY:
+		BurstSize = 4*1024;
+		break;
+	case CONSTELLATION_ID_FMC151_PC720_SECONDARY:
+		BurstSize = 4*1024;
+		break;
+	case CONSTELLATION_ID_FM780:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_PC720_BOTH:
+		BurstSize = 16*1024;
+		break;
+	case CONSTELLATION_ID_FMC151_PC720_BOTH:
+		BurstSize = 4*1024;
+		break;
+	default:
+		BurstSize = 1024;
+		break;
+	}
+	const int32_t DacNbPeriod1	= BurstSize/16;	// number of DAC periods per burst
+	state->card = currentCard;
+	state->constellationId = constellation_id;
+	state->devIdx = devIdx;
+	state->AddrSipFMC150Ctrl = AddrSipFMC150Ctrl;
+	state->AddrSipFMC150AdcSpi = AddrSipFMC150AdcSpi;
+	state->AddrSipRouterS1D3 = AddrSipRouterS1D3;
+	state->AddrSipRouterS3D1 = AddrSipRouterS3D1;
+	state->AddrSipMemoryFIFO = AddrSipMemoryFIFO;
+	state->BurstSize = BurstSize;
+	state->dualAdc = dualAdc;
+	state->dacSampleRate = dacSampleRate;
+	state->pOutData = BufferPool_Alloc(&g_bufferPool, 2*BurstSize*(dualAdc != DUAL_ADC_OFF ? 3 : 1));	// out buffer
+	state->pPlanes = state->pOutData + 2*BurstSize;						// ADC0 and ADC1 planes of a dual ADC capture, same allocation
+	CaptureFile_InitHeader(&state->capInfo, constellation_id, vcxoType, fReference, dacSampleRate, BurstSize, currentCard);
+	if(BurstSaver_Start(&state->saver, &state->capInfo, dualAdc == DUAL_ADC_INTERLEAVED ? 2 : 1) != 0) {
+		printf("Could not allocate the acquisition buffers\n");
+		BufferPool_Free(&g_bufferPool, state->pOutData);
+		return -13;
+	}
+	state->ready = true;
+
+	// file name suffix, only the constellations with two cards need to tell them apart
+	state->cardSuffix = "";
+	if ((constellation_id == CONSTELLATION_ID_PC720_BOTH) || (constellation_id == CONSTELLATION_ID_FMC151_PC720_BOTH))
+		state->cardSuffix = (currentCard == 0) ? "_primary" : "_secondary";
+
+	if(ShadowReg_ConfigureBurst(AddrSipFMC150Ctrl, 1, BurstSize)!=FMC15x_CTRL_ERR_OK) {
+		printf("Could not configure burst size/length in FMC15x.CTRL\n ");
+		Card_Release(state);
+		return -13;
+	}
+
+	// For FMC151, configure DC offset to mid point
+	if ( (constellation_id == CONSTELLATION_ID_FMC151_ML605) || (constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC1) 
+		|| (constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC2) || (constellation_id == CONSTELLATION_ID_FMC151_PC720_PRIMARY) 
+		|| (constellation_id == CONSTELLATION_ID_FMC151_PC720_SECONDARY) || (constellation_id == CONSTELLATION_ID_FMC151_PC720_BOTH) 
+		|| (constellation_id == CONSTELLATION_ID_FMC151_KC705) || (constellation_id == CONSTELLATION_ID_FMC151_ZC706)
+		|| (constellation_id == CONSTELLATION_ID_FMC151_ZC706_DDR3))
+	{
+		// 0x7fff is the mid point.   For larger values, it is between 0x0 and 0x7ffe, for lower values
+		// it is between 0x8000 and 0xffff
+		int slaveaddress = 0x1000;
+		if(constellation_id == CONSTELLATION_ID_FMC151_ML605) {
+			slaveaddress = 0x2200;
+		}
+		// the other card may have switched the I2C bus to its own FMC since the diagnostics
+		if(constellation_id == CONSTELLATION_ID_FMC151_PC720_BOTH) {
+			i2cSwitch.lock();
+			sipif_writesipreg(AddrSipI2cMaster+0x7000, (currentCard == 0) ? 0x01 : 0x02);	// I2C switch set to this FMC
+			Sleep(10);
+		}
+		if (fmc151_configure_dc_offset(AddrSipI2cMaster, 0x7fff, 0x7fff, 0x7fff, 0x7fff, slaveaddress) != 0) {
+			printf ("Could not configure DC offset.\n");
+			Card_Release(state);
+			return -13;
+		}
+		if(i2cSwitch.owns_lock())
+			i2cSwitch.unlock();
+
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Load DAC0 and DAC1, a waveform that cannot be generated leaves the DAC as it is
+	Profile_Next(&phase, "load_dac0");
+	int32_t rc = Card_LoadDac(state, 0, setup->dac0Spec, "");
+	if(rc == 0 || rc == -17) {
+		Profile_Next(&phase, "load_dac1");
+		rc = Card_LoadDac(state, 1, setup->dac1Spec, "");
+	}
+	if(rc != 0 && rc != -17) {
+		Card_Release(state);
+		return rc;
+	}
+
+	Profile_Next(&phase, "pattern_check");
+	bool pattern_check_passed = false;
+	int32_t patternResult = 0;
+	for (;;) {
+
+		if (pattern_check_passed == false)
+			printf ("Running ramp pattern check on card %d......\n", currentCard);
+		else
+			printf ("Acquiring %d samples on card %d\n", BurstSize, currentCard);
+
+		if (pattern_check_passed == false)
+			rc = Card_Capture(state, true, "", &patternResult, NULL);
+		else
+			rc = Card_Acquire(state, "", NULL);
+		if (rc != 0) {
+			Card_Release(state);
+			return rc;
+		}
+
+		if (pattern_check_passed == false) {
+			if (patternResult != 0 && skippingTraining) {
+				// this board needs the training after all, train and check again
+				printf ("Pattern check failed without IODELAY auto training, training card %d\n", currentCard);
+				skippingTraining = false;
+				cardAutoTraining = 1;
+				training.trainingRequired = 1;
+				TrainingCache_Store(&training);
+				if(fmc15x_init(AddrSipFMC150ClkSpi, AddrSipFMC150DacSpi, AddrSipFMC150DacPhy, AddrSipFMC150AdcSpi, AddrSipFMC150AdcPhy,
+					AddrSipFMC150Monitor, modeClock, vcxoType, tapiod_clk, tapiod_data, odelay_tap, constellation_id, 1)!=FMC15x_ERR_OK) {
+						printf("Could not initialize FMC150\n");
+						Card_Release(state);
+						return -11;
+				}
+				ShadowReg_InvalidateCard();
+				patternResult = 0;
+				continue;
+			}
+
+			// remember the outcome for the next start. After a trained run it is not known whether the training was
+			// needed: unless a previous run proved it was, the next start tries without it and falls back to training.
+			if (cardAutoTraining == 0)
+				training.trainingRequired = (patternResult != 0) ? 1 : 0;
+			else if (training.trainingRequired != 1)
+				training.trainingRequired = 0;
+			training.patternResult = patternResult;
+			TrainingCache_Store(&training);
+			pattern_check_passed = true;
+			Profile_Next(&phase, "acquisition");
+		}
+		else {
+			// exit the for (;;) loop
+			break;
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Continuous streaming through the DDR3 FIFO
+	Profile_Next(&phase, "streaming");
+	if(setup->streamSeconds > 0) {
+		if(constellation_id != CONSTELLATION_ID_FMC151_ZC706_DDR3) {
+			printf("Streaming mode requires the ZC706 DDR3 memory FIFO, skipped\n");
+		}
+		else if(StreamAdcToFile(AddrSipFMC150Ctrl, AddrSipRouterS3D1, AddrSipMemoryFIFO, AddrSipFMC150AdcSpi, currentCard, setup->streamAdc,
+			BurstSize, setup->streamSeconds, setup->streamCheck, &state->capInfo, setup->streamAdc == 0 ? "adc0_stream.cap" : "adc1_stream.cap") != 0) {
+			printf("Could not stream ADC%d, exiting\n", setup->streamAdc);
+			Card_Release(state);
+			return -30;
+		}
+	}
+	// in service mode the card stays ready for the commands, see ServeCommands()
+	if(!setup->keepState)
+		Card_Release(state);
+	Profile_End(phase);
+	Profile_End(cardSpan);
+	return 0;
+}
+
+#ifndef WIN32
+/**
+*  Check a file name prefix given to the service mode, the files stay in the working directory.
+*
+*  @return true when the prefix is made of letters, digits, '_', '-' and '.' only
+*/
+static bool Serve_ValidPrefix(const char *prefix)
+{
+	if(strlen(prefix) > SERVE_PREFIX_MAX)
+		return false;
+	for(const char *p = prefix; *p; p++) {
+		if(!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_' || *p == '-' || *p == '.'))
+			return false;
+	}
+	return true;
+}
+
+/**
+*  Wait until every file queued by a command has been written, so that the client can open it as soon as the
+*  reply arrives.
+*/
+static void Serve_Flush(CardState *cards, int32_t nbrCards)
+{
+	for(int32_t i = 0; i < nbrCards; i++)
+		BurstSaver_Flush(&cards[i].saver);
+}
+
+/**
+*  Execute one service mode command. The reply starts with "OK" followed by the names of the files written
+*  ( without extension ), or with "ERR <code> <reason>".
+*
+*  @param cards	ready cards
+*  @param nbrCards	number of cards
+*  @param line	command line, modified
+*  @param reply	receives the reply line
+*  @return false when the service should stop
+*/
+static bool Serve_Execute(CardState *cards, int32_t nbrCards, char *line, std::string *reply)
+{
+	char *argv[8];
+	int32_t argc = 0;
+	char msg[128];
+	int32_t rc = 0;
+	bool flush = true;
+
+	for(char *tok = strtok(line, " \t\r\n"); tok && argc < 8; tok = strtok(NULL, " \t\r\n"))
+		argv[argc++] = tok;
+	*reply = "OK";
+	if(argc == 0)
+		return true;
+
+	if(!strcmp(argv[0], "quit")) {
+		return false;
+	}
+	else if(!strcmp(argv[0], "status")) {
+		static const char *dualNames[] = { "off", "planar", "interleaved" };
+		snprintf(msg, sizeof(msg), " cards=%d burst=%d dual=%s dac_rate=%.0f", nbrCards, cards[0].BurstSize,
+			dualNames[cards[0].dualAdc], cards[0].dacSampleRate);
+		reply->append(msg);
+	}
+	else if(!strcmp(argv[0], "capture") || !strcmp(argv[0], "trigger")) {
+		// capture [prefix], trigger [prefix] replies as soon as the bursts are queued for writing
+		flush = !strcmp(argv[0], "capture");
+		const char *prefix = argc > 1 ? argv[1] : "";
+		if(!Serve_ValidPrefix(prefix)) {
+			*reply = "ERR -1 invalid prefix";
+			return true;
+		}
+		for(int32_t i = 0; i < nbrCards && rc == 0; i++)
+			rc = Card_Acquire(&cards[i], prefix, reply);
+	}
+	else if(!strcmp(argv[0], "flush")) {
+		// wait for the files of the previous trigger commands
+	}
+	else if(!strcmp(argv[0], "waveform")) {
+		// waveform <card> <dac> <spec> [prefix]
+		const char *prefix = argc > 4 ? argv[4] : "";
+		int32_t card = argc > 1 ? atoi(argv[1]) : -1;
+		int32_t dac = argc > 2 ? atoi(argv[2]) : -1;
+		if(argc < 4 || card < 0 || card >= nbrCards || (dac != 0 && dac != 1) || !Serve_ValidPrefix(prefix)) {
+			*reply = "ERR -1 usage: waveform <card> <dac> <spec> [prefix]";
+			return true;
+		}
+		rc = Card_LoadDac(&cards[card], dac, argv[3], prefix);
+		if(rc == 0) {
+			snprintf(msg, sizeof(msg), " %sdac%d%s", prefix, dac, cards[card].cardSuffix);
+			reply->append(msg);
+		}
+	}
+	else if(!strcmp(argv[0], "sweep")) {
+		// sweep <card> <dac> <start Hz> <stop Hz> <step Hz> [prefix], one sine tone and one capture per step
+		const char *prefix = argc > 6 ? argv[6] : "";
+		int32_t card = argc > 1 ? atoi(argv[1]) : -1;
+		int32_t dac = argc > 2 ? atoi(argv[2]) : -1;
+		double start = argc > 3 ? atof(argv[3]) : 0;
+		double stop = argc > 4 ? atof(argv[4]) : 0;
+		double step = argc > 5 ? atof(argv[5]) : 0;
+		int32_t nbrSteps = (step > 0 && stop >= start) ? (int32_t)floor((stop - start) / step + 1e-9) + 1 : 0;
+		if(argc < 6 || card < 0 || card >= nbrCards || (dac != 0 && dac != 1) || nbrSteps <= 0 || nbrSteps > SERVE_SWEEP_MAX_STEPS ||
+			!Serve_ValidPrefix(prefix)) {
+			*reply = "ERR -1 usage: sweep <card> <dac> <start Hz> <stop Hz> <step Hz> [prefix]";
+			return true;
+		}
+		for(int32_t i = 0; i < nbrSteps && rc == 0; i++) {
+			char spec[64], stepPrefix[SERVE_PREFIX_MAX + 16];
+			snprintf(spec, sizeof(spec), "sine:%.6f", start + i * step);
+			snprintf(stepPrefix, sizeof(stepPrefix), "%ssweep%04d_", prefix, i);
+			rc = Card_LoadDac(&cards[card], dac, spec, stepPrefix);
+			if(rc == 0)
+				rc = Card_Acquire(&cards[card], stepPrefix, reply);
+		}
+	}
+	else {
+		*reply = "ERR -1 unknown command, expected status, capture, trigger, flush, waveform, sweep or quit";
+		return true;
+	}
+
+	if(flush)
+		Serve_Flush(cards, nbrCards);
+	if(rc != 0) {
+		snprintf(msg, sizeof(msg), "ERR %d %s failed", rc, argv[0]);
+		*reply = msg;
+	}
+	return true;
+}
 
-	// mask off the overrange bit in the data received from the ADC using the appropriate mask
-	check_data = check_data & mask;
-	for (int32_t j = 1; j < burstSize; j++) {
-		if (check_data != (pattern_data[j] >> 2))
-		{
-			error_count++;
-		}
-		check_data++;
-		check_data &= mask;
+/**
+*  Service mode: keep the cards brought up by RunCard() and execute the commands received on a Unix domain socket,
+*  so that automated measurements do not pay the sipif_init()/cid_init()/fmc15x_init() sequence every time.
+*  Clients are served one at a time, each command is a line and gets a single reply line:
+*	- status								board summary
+*	- capture [prefix]						capture ADC0 and ADC1 on every card
+*	- trigger [prefix]						same as capture, but reply before the files are written
+*	- flush									wait until the files of the previous commands are written
+*	- waveform <card> <dac> <spec> [prefix]	load a waveform, see GenerateWaveformFromSpec()
+*	- sweep <card> <dac> <start> <stop> <step> [prefix]
+*											step a sine tone on a DAC and capture at every frequency
+*	- quit									stop the service
+*
+*  @param socketPath	path of the socket, replaced if it exists
+*  @param cards	ready cards
+*  @param nbrCards	number of cards
+*  @return
+*						- -1 ( cannot create the socket )
+*						- 0 ( Success, a client sent quit )
+*/
+static int32_t ServeCommands(const char *socketPath, CardState *cards, int32_t nbrCards)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(addr.sun_path)) {
+		printf("ServeCommands() -> socket path '%s' is too long\n", socketPath);
+		return -1;
 	}
+	strcpy(addr.sun_path, socketPath);
 
-	if (error_count) {
-		printf ("Pattern Check Failed with %d pattern errors\n", error_count);
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listenFd < 0) {
+		printf("ServeCommands() -> cannot create a socket\n");
 		return -1;
 	}
-	else {
-		printf ("Pattern Check Passed!\n");
-		return 0;
+	unlink(socketPath);
+	if(bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 4) != 0) {
+		printf("ServeCommands() -> cannot listen on '%s'\n", socketPath);
+		close(listenFd);
+		return -1;
+	}
+	printf("Waiting for commands on '%s'\n", socketPath);
+
+	bool running = true;
+	while(running) {
+		int fd = accept(listenFd, NULL, NULL);
+		if(fd < 0)
+			continue;
+		char line[SERVE_LINE_MAX];
+		size_t used = 0;
+		ssize_t got;
+		while(running && (got = recv(fd, line + used, sizeof(line) - 1 - used, 0)) > 0) {
+			used += got;
+			line[used] = '\0';
+			char *eol;
+			while(running && (eol = strchr(line, '\n')) != NULL) {
+				*eol = '\0';
+				std::string reply;
+				printf("Command: %s\n", line);
+				running = Serve_Execute(cards, nbrCards, line, &reply);
+				reply.append("\n");
+				send(fd, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+				used -= eol + 1 - line;
+				memmove(line, eol + 1, used + 1);
+			}
+			if(used == sizeof(line) - 1) {
+				const char *tooLong = "ERR -1 command too long\n";
+				send(fd, tooLong, strlen(tooLong), MSG_NOSIGNAL);
+				used = 0;
+			}
+		}
+		close(fd);
 	}
+	close(listenFd);
+	unlink(socketPath);
+	return 0;
 }
-
+#endif
 
 /**
 *  \brief FMC15x Reference application (main).
@@ -345,6 +5164,8 @@ int32_t verify_ramp_pattern(char *pInData, int32_t burstSize)
 *	- Generate a waveform and upload waveform to DAC1 using GenerateWaveform16(), sxdx_configurerouter(), fmc15x_ctrl_prepare_wfm_load() and WriteBlock() part of ethapi.
 *	- Grab a burst from ADC0 using 	sxdx_configurerouter(), fmc15x_ctrl_enable_channel(), fmc15x_ctrl_arm_dac(), fmc15x_ctrl_sw_trigger() and Save16BitArrayToFile().
 *	- Grab a burst from ADC1 using 	sxdx_configurerouter(), fmc15x_ctrl_enable_channel(), fmc15x_ctrl_arm_dac(), fmc15x_ctrl_sw_trigger() and Save16BitArrayToFile().
+*	- Optionally stream an ADC continuously through the DDR3 memory FIFO using StreamAdcToFile().
+*	- Optionally keep the cards up and execute the commands received on a local socket using ServeCommands().
 *
 *  @param argc the command line
 *  @param argv the number of options in the command line.
@@ -365,10 +5186,25 @@ int32_t main(int32_t argc, char* argv[])
 	uint32_t odelay_tap;
 	uint8_t fpgatype;
 	int32_t auto_training;
+	double streamSeconds = 0.0;
+	int32_t streamAdc = 0;
+	bool streamCheck = false;
+	int32_t dualAdc = DUAL_ADC_OFF;
+	bool useTrainingCache = true;
+	char boardId[96];
+	const char *dac0Spec = "sine:100e6";
+	const char *dac1Spec = "square:16";
+	const char *servePath = NULL;
+	uint32_t bufferPoolMb = BUFFER_POOL_DEFAULT_MB;
+
+	// Stand alone benchmark of the ASCII file writer, does not need any hardware
+	if(argc >= 2 && !strcmp(argv[1], "--bench-ascii"))
+		return BenchmarkAsciiFormatter();
 
 	// Parse the application arguments
-	if(argc!=6) {
-		printf("Usage: FMCxxxApp.exe {interface type} {device type} {device index} {clock mode} {auto training}\n\n");
+	if(argc<6) {
+		printf("Usage: FMCxxxApp.exe {interface type} {device type} {device index} {clock mode} {auto training} [options]\n");
+		printf("       FMCxxxApp.exe --bench-ascii\n\n");
 		printf(" {interface type} can be either 0 (PCI) or 1 (Ethernet) or 2 (TCPIP)\n");
 		printf(" {device type} is a string defining the target hardware (VP680, ML605, ...)\n");
 		printf(" {device type} is an ip address when using TCPIP interface\n");
@@ -381,6 +5217,45 @@ int32_t main(int32_t argc, char* argv[])
 		printf("    0 Auto training disabled\n");
 		printf("    1 Auto training enabled\n");
 		printf("\n");
+		printf(" Optional arguments:\n");
+		printf("   --stream=<seconds>    after the burst captures, stream an ADC continuously through the DDR3 FIFO (ZC706 DDR3 only)\n");
+		printf("   --stream-adc=<0|1>    ADC used in streaming mode (default 0)\n");
+		printf("   --stream-check        stream the ADC ramp test pattern and check every burst\n");
+		printf("   --compress            store the ADC samples of the .cap files delta coded, without loss (read with capfile.py)\n");
+		printf("   --pack                store the ADC samples of the .cap files on 14 bits, 8 samples in 14 bytes\n");
+		printf("   --write-queue=<N>     streaming file writes in flight, with O_DIRECT through io_uring or a pwrite thread pool\n");
+		printf("                         (default %d, at most %d, 0 to write through stdio)\n", WRITE_QUEUE_DEFAULT_DEPTH, NBR_STREAM_SLOTS);
+		printf("   --profile[=<file>]    print the time spent in every bring-up phase and save it as JSON (default startup_profile.json)\n");
+		printf("   --dual-adc[=planar|interleaved]\n");
+		printf("                         capture ADC0 and ADC1 on the same trigger, saved as adc0/adc1 (planar, default)\n");
+		printf("                         or as ADC0/ADC1 sample pairs in adc01 (interleaved)\n");
+		printf("   --spectrum[=<dBm>]    save the Hann windowed power spectrum of every ADC burst as <name>_spectrum.csv,\n");
+		printf("                         calibrated with the power of a full scale sine (default %.1f dBm)\n", ADC_FULL_SCALE_DBM);
+		printf("   --peaks[=<N>[:<dB>]]  report the N strongest ADC spectrum peaks of every burst with at least the given\n");
+		printf("                         prominence (default 3:%.0f), and append them to %s\n", PEAK_DEFAULT_PROMINENCE, PEAK_LOG_FILE);
+		printf("   --average=<N>[:<segment>[:<overlap %%>]]\n");
+		printf("                         capture N bursts per acquisition and save the Welch average, max hold and min hold of their\n");
+		printf("                         spectra as <name>_welch.csv, segments of a power of two samples (default burst size)\n");
+		printf("                         overlapping by %d%% by default. In streaming mode the average is saved every N bursts\n", WELCH_DEFAULT_OVERLAP);
+		printf("   --adc-cal=<offset0>:<gain0>[:<offset1>:<gain1>]\n");
+		printf("                         offset (14 bit codes) and gain correction of ADC0 and ADC1 applied before the spectra,\n");
+		printf("                         ADC1 takes the ADC0 values when they are not given\n");
+		printf("   --remove-dc           subtract the mean of every burst before the spectra instead of the calibrated offset\n");
+		printf("   --no-shadow           write every router and control register even when it already holds the value\n");
+		printf("   --retrain             always run the IODELAY auto training, even when a previous run did not need it\n");
+		printf("   --buffer-pool=<MiB>   size of the locked 2 MiB huge page pool of the sample buffers (default %d, 0 to disable)\n", BUFFER_POOL_DEFAULT_MB);
+		printf("   --serve[=<socket>]    after the first capture, keep the board up and execute the capture, trigger, flush, waveform and sweep\n");
+		printf("                         commands received on a Unix domain socket (default %s)\n", SERVE_SOCKET_PATH);
+		printf("   --dac0=<waveform>     waveform loaded in DAC0 (default sine:100e6)\n");
+		printf("   --dac1=<waveform>     waveform loaded in DAC1 (default square:16)\n");
+		printf("     <waveform> can be either:\n");
+		printf("       sine:<freq>                              coherent sine wave\n");
+		printf("       tones:<freq>[/<ampl>[/<phase>]],...      sum of up to %d coherent tones\n", WFM_MAX_TONES);
+		printf("       chirp:<start freq>:<stop freq>           linear frequency sweep over the burst\n");
+		printf("       expchirp:<start freq>:<stop freq>        exponential frequency sweep over the burst\n");
+		printf("       square:<period>                          square wave, period in samples\n");
+		printf("       iq:<file>                                I (DAC0) or Q (DAC1) column of a text file\n");
+		printf("\n");
 		printf("\n");
 		printf(" List of NDIS interfaces found in the system {device index}:\n");
 		printf(" -----------------------------------------------------------\n");
@@ -398,6 +5273,77 @@ int32_t main(int32_t argc, char* argv[])
 		modeClock = atoi(argv[4]);
 		auto_training = atoi(argv[5]);
 
+		const char *opt;
+		if((opt = GetOptionArg(argc, argv, "stream")) != NULL)
+			streamSeconds = atof(opt);
+		if((opt = GetOptionArg(argc, argv, "stream-adc")) != NULL)
+			streamAdc = atoi(opt);
+		if(GetOptionArg(argc, argv, "stream-check") != NULL)
+			streamCheck = true;
+		if(GetOptionArg(argc, argv, "compress") != NULL)
+			g_captureCompression = true;
+		if(GetOptionArg(argc, argv, "pack") != NULL)
+			g_capturePacking = true;
+		if(g_captureCompression && g_capturePacking) {
+			printf("--compress and --pack cannot be used together\n");
+			sipif_free();
+			return -1;
+		}
+		if((opt = GetOptionArg(argc, argv, "write-queue")) != NULL) {
+			g_writeQueueDepth = (uint32_t)atoi(opt);
+			if(g_writeQueueDepth > NBR_STREAM_SLOTS)
+				g_writeQueueDepth = NBR_STREAM_SLOTS;
+		}
+		if((opt = GetOptionArg(argc, argv, "profile")) != NULL)
+			g_profileFile = (*opt != '\0') ? opt : "startup_profile.json";
+		if((opt = GetOptionArg(argc, argv, "dual-adc")) != NULL)
+			dualAdc = !strcmp(opt, "interleaved") ? DUAL_ADC_INTERLEAVED : DUAL_ADC_PLANAR;
+		if((opt = GetOptionArg(argc, argv, "spectrum")) != NULL) {
+			g_spectrumEnabled = true;
+			if(*opt != '\0')
+				g_adcFullScaleDbm = atof(opt);
+		}
+		if((opt = GetOptionArg(argc, argv, "peaks")) != NULL) {
+			g_nbrPeaks = 3;
+			if(*opt != '\0')
+				sscanf(opt, "%u:%f", &g_nbrPeaks, &g_peakProminence);
+			if(g_nbrPeaks > MAX_REPORTED_PEAKS)
+				g_nbrPeaks = MAX_REPORTED_PEAKS;
+		}
+		if((opt = GetOptionArg(argc, argv, "average")) != NULL) {
+			if(sscanf(opt, "%u:%u:%u", &g_averageBursts, &g_averageSegment, &g_averageOverlap) < 1 || g_averageOverlap > 99 ||
+				(g_averageSegment != 0 && (g_averageSegment < 4 || (g_averageSegment & (g_averageSegment - 1)) != 0))) {
+				printf("Invalid --average=%s, expected <N>[:<power of two segment>[:<overlap 0-99>]]\n", opt);
+				sipif_free();
+				return -1;
+			}
+		}
+		if((opt = GetOptionArg(argc, argv, "adc-cal")) != NULL) {
+			AdcCalibration *cal = g_adcCalibration;
+			int32_t n = sscanf(opt, "%f:%f:%f:%f", &cal[0].offset, &cal[0].gain, &cal[1].offset, &cal[1].gain);
+			if(n != 2 && n != 4) {
+				printf("Invalid --adc-cal=%s, expected <offset0>:<gain0>[:<offset1>:<gain1>]\n", opt);
+				sipif_free();
+				return -1;
+			}
+			if(n == 2)
+				cal[1] = cal[0];
+		}
+		if(GetOptionArg(argc, argv, "remove-dc") != NULL)
+			g_removeDc = true;
+		if(GetOptionArg(argc, argv, "no-shadow") != NULL)
+			g_shadowEnabled = false;
+		if(GetOptionArg(argc, argv, "retrain") != NULL)
+			useTrainingCache = false;
+		if((opt = GetOptionArg(argc, argv, "dac0")) != NULL)
+			dac0Spec = opt;
+		if((opt = GetOptionArg(argc, argv, "dac1")) != NULL)
+			dac1Spec = opt;
+		if((opt = GetOptionArg(argc, argv, "serve")) != NULL)
+			servePath = *opt ? opt : SERVE_SOCKET_PATH;
+		if((opt = GetOptionArg(argc, argv, "buffer-pool")) != NULL)
+			bufferPoolMb = atoi(opt);
+
 		// translate interface type to the sipif values
 		if(ifType==0)
 			ifType = SIPIF_4FM;
@@ -405,10 +5351,25 @@ int32_t main(int32_t argc, char* argv[])
 			ifType = SIPIF_ETHAPI;	
 		else
 			ifType = SIPIF_TCPIP_V4;	
+#ifdef FMC15X_SIM
+		// every register access is a network round trip on these interfaces, send the control sequences as batches.
+		// Only the simulated link can, the 4DSP libraries have no batched entry point.
+		g_sipBatchEnabled = (ifType == SIPIF_ETHAPI || ifType == SIPIF_TCPIP_V4);
+#endif
 	}
 
+	// Time every bring-up phase, the summary is written when the application exits
+	atexit(Profile_WriteSummary);
+	int32_t runSpan = Profile_Begin("run");
+	int32_t phase = -1;
+
+	// sample buffers of every card, reserved and locked once so that no capture waits on a page fault
+	Profile_Next(&phase, "buffer_pool");
+	BufferPool_Create(&g_bufferPool, (size_t)bufferPoolMb << 20);
+
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Open one of the device from a given device ID argument	
+	Profile_Next(&phase, "sipif_init");
 	if(sipif_init(ifType, devType, devIdx, TIMEOUTDMA, SYNTH_M, SYNTH_N, fpga_device_type) != SIPIF_ERR_OK) {
 		printf("Could not open device %d\n", devIdx);
 		sipif_free();
@@ -428,6 +5389,7 @@ int32_t main(int32_t argc, char* argv[])
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Get the reference frequency (always 125MHz except 200MHz for VP680 GEN2 PCIe)
 	float fReference;
+	Profile_Next(&phase, "sipif_getsipcmdfreq");
 	if(	sipif_getsipcmdfreq(&fReference) != SIPIF_ERR_OK) {
 		printf("Could not get reference frequency %d\n", devIdx);
 		sipif_free();
@@ -441,6 +5403,7 @@ int32_t main(int32_t argc, char* argv[])
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Obtain and display the sip_cid informations to the console. This function also check that the constellation ID
 	// obtained by the firmware match the value passed as argument
+	Profile_Next(&phase, "cid_init");
 	int32_t rc  = cid_init(0);
 	if(rc<1) {
 		printf("Could obtain sipcid table (error %x), exiting\n", rc);
@@ -454,6 +5417,14 @@ int32_t main(int32_t argc, char* argv[])
 	printf("Software Build   : 0x%8.8X\n", cid_getswbuildcode());
 	printf("Firmware Build   : 0x%8.8X\n", cid_getfwbuildcode());
 	printf("Firmware Version : %d.%d\n", cid_getfirmwareversion()>>16, cid_getfirmwareversion()&0xFFFF);
+
+	// The board is identified by the way it is reached and the firmware it runs, no serial number is available
+	// through the API. Spaces are replaced so the identification is a single word in the training cache.
+	snprintf(boardId, sizeof(boardId), "%d:%s:%d:%8.8X", ifType, devType, devIdx, cid_getfwbuildcode());
+	for(char *c = boardId; *c; c++) {
+		if(*c == ' ' || *c == '\t')
+			*c = '_';
+	}
 	printf("--------------------------------------\n");
 	printf("\n");
 
@@ -621,6 +5592,7 @@ int32_t main(int32_t argc, char* argv[])
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Read Star Offsets and compute sub mapping for stars
+	Profile_Next(&phase, "cid_getstaroffset");
 	uint32_t size = 1;
 	uint32_t AddrSipRouterS1D3, AddrSipRouterS3D1, AddrSipFMC150, AddrSipFMC150SEC, AddrSipI2cMaster, AddrSipMemoryFIFO;
 
@@ -757,6 +5729,7 @@ int32_t main(int32_t argc, char* argv[])
 	}
 
 	// if we are dealing with a ML605, KC705 or a VC707 constellation
+	Profile_Next(&phase, "ctgen_configure");
 	if((constellation_id == CONSTELLATION_ID_ML605) || (constellation_id == CONSTELLATION_ID_FMC151_KC705) ||(constellation_id == CONSTELLATION_ID_KC705 ) || 
 		(constellation_id == CONSTELLATION_ID_KC705_PCIe )) {
 			uint32_t AddrCtGen;
@@ -784,711 +5757,76 @@ int32_t main(int32_t argc, char* argv[])
 			}
 	}
 
+	Profile_End(phase);
+	phase = -1;
+
+	// The cards of a PC720 are brought up and captured in parallel, RunCard() serializes the shared I2C switch and routers
+	CardSetup setup;
+	setup.constellationId = constellation_id;
+	setup.AddrSipFMC150 = AddrSipFMC150;
+	setup.AddrSipFMC150SEC = AddrSipFMC150SEC;
+	setup.AddrSipI2cMaster = AddrSipI2cMaster;
+	setup.AddrSipRouterS1D3 = AddrSipRouterS1D3;
+	setup.AddrSipRouterS3D1 = AddrSipRouterS3D1;
+	setup.AddrSipMemoryFIFO = AddrSipMemoryFIFO;
+	setup.modeClock = modeClock;
+	setup.tapiod_clk = tapiod_clk;
+	setup.tapiod_data = tapiod_data;
+	setup.odelay_tap = odelay_tap;
+	setup.fpgatype = fpgatype;
+	setup.auto_training = auto_training;
+	setup.fReference = fReference;
+	setup.devIdx = devIdx;
+	setup.boardId = boardId;
+	setup.useTrainingCache = useTrainingCache;
+	setup.dac0Spec = dac0Spec;
+	setup.dac1Spec = dac1Spec;
+	setup.streamSeconds = streamSeconds;
+	setup.streamAdc = streamAdc;
+	setup.streamCheck = streamCheck;
+	setup.dualAdc = dualAdc;
+	setup.keepState = (servePath != NULL);
+
+	int32_t cardResult[2] = { 0, 0 };
+	CardState cardState[2];
+	std::vector<std::thread> cardThreads;
+	for (int32_t currentCard = 1; currentCard < numFmcCards; currentCard++) {
+		cardThreads.push_back(std::thread([&setup, &cardResult, &cardState, currentCard, runSpan]() {
+			Profile_Adopt(runSpan);
+			cardResult[currentCard] = RunCard(&setup, currentCard, &cardState[currentCard]);
+		}));
+	}
+	cardResult[0] = RunCard(&setup, 0, &cardState[0]);
+	for (size_t i = 0; i < cardThreads.size(); i++)
+		cardThreads[i].join();
 	for (int32_t currentCard = 0; currentCard < numFmcCards; currentCard++) {
-		uint32_t AddrSipFMC150Ctrl;
-		uint32_t AddrSipFMC150AdcPhy;
-		uint32_t AddrSipFMC150DacPhy;
-		uint32_t AddrSipFMC150AdcSpi;
-		uint32_t AddrSipFMC150DacSpi;
-		uint32_t AddrSipFMC150ClkSpi;
-		uint32_t AddrSipFMC150FreqCnt;
-		uint32_t AddrSipFMC150Monitor;
-
-		if (constellation_id != CONSTELLATION_ID_PC720_BOTH && constellation_id != CONSTELLATION_ID_FMC151_PC720_BOTH) {
-			// Calculate BAR of every peripheral mapped (sub mapping) to the FMC150 star's memory. This uses fixed offsets given by the FMC150 
-			// For all constellation except one with two FMC cards
-			AddrSipFMC150Ctrl    = AddrSipFMC150 + 0x000;
-			AddrSipFMC150AdcPhy  = AddrSipFMC150 + 0x010;
-			AddrSipFMC150DacPhy  = AddrSipFMC150 + 0x020;
-			AddrSipFMC150AdcSpi  = AddrSipFMC150 + 0x100;
-			AddrSipFMC150DacSpi  = AddrSipFMC150 + 0x300;
-			AddrSipFMC150ClkSpi  = AddrSipFMC150 + 0x400;
-			AddrSipFMC150FreqCnt = AddrSipFMC150 + 0x600;
-			AddrSipFMC150Monitor = AddrSipFMC150 + 0x700;
-		}
-		else {
-
-			if (currentCard == 0) {
-				// first Card on the PC720
-				AddrSipFMC150Ctrl    = AddrSipFMC150 + 0x000;
-				AddrSipFMC150AdcPhy  = AddrSipFMC150 + 0x010;
-				AddrSipFMC150DacPhy  = AddrSipFMC150 + 0x020;
-				AddrSipFMC150AdcSpi  = AddrSipFMC150 + 0x100;
-				AddrSipFMC150DacSpi  = AddrSipFMC150 + 0x300;
-				AddrSipFMC150ClkSpi  = AddrSipFMC150 + 0x400;
-				AddrSipFMC150FreqCnt = AddrSipFMC150 + 0x600;
-				AddrSipFMC150Monitor = AddrSipFMC150 + 0x700;
-
-				sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x01);	// I2C switch set to primary FMC
-				Sleep(10);
-			}
-			else {
-				// second Card on the PC720
-				AddrSipFMC150Ctrl    = AddrSipFMC150SEC + 0x000;
-				AddrSipFMC150AdcPhy  = AddrSipFMC150SEC+ 0x010;
-				AddrSipFMC150DacPhy  = AddrSipFMC150SEC + 0x020;
-				AddrSipFMC150AdcSpi  = AddrSipFMC150SEC + 0x100;
-				AddrSipFMC150DacSpi  = AddrSipFMC150SEC + 0x300;
-				AddrSipFMC150ClkSpi  = AddrSipFMC150SEC + 0x400;
-				AddrSipFMC150FreqCnt = AddrSipFMC150SEC + 0x600;
-				AddrSipFMC150Monitor = AddrSipFMC150SEC + 0x700;
-
-				tapiod_clk = 0;	tapiod_data = 0;					// Tap values for secondary FMC150
-				sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x02);	// I2C switch set to secondary FMC
-				Sleep(10);
-			}
-		}
-
-		// Configure I2C switch
-		if( constellation_id == CONSTELLATION_ID_KC705) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x02); // Switch set to LPC		
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_KC705_PCIe) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x02); // Switch set to LPC		
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_VC707) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x01); // Switch set to HPC_1	
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC1) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x02); // Switch set to HPC_1	
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC2) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x04); // Switch set to HPC_2	
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_PC720_PRIMARY) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x01);	// I2C switch set to primary FMC
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_PC720_SECONDARY) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x02);	// I2C switch set to secondary FMC
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_FMC151_PC720_PRIMARY) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x01);	// I2C switch set to primary FMC
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_FMC151_PC720_SECONDARY) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7000, 0x02);	// I2C switch set to secondary FMC
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_FMC151_KC705) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x04); // Switch set to LPC		
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_FMC151_ZC706) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x40); // Switch set to LPC		
-			Sleep(10);	
-		}
-		if( constellation_id == CONSTELLATION_ID_FMC151_ZC706_DDR3) {
-			sipif_writesipreg(AddrSipI2cMaster+0x7400, 0x40); // Switch set to LPC		
-			Sleep(10);	
-		}
-
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Configure the routers
-		// Setup 1-to-3 Router
-#ifdef WIN32
-		if(sxdx_configurerouter(AddrSipRouterS1D3, 0xFFFFFFFFFFFFFF00)!=SXDXROUTER_ERR_OK) {
-			printf("Could not configure S1D3 router, exiting\n");
-			sipif_free();
-			return -8;
-		}
-
-		// Setup 3-to-1 Router
-		if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF00)!=SXDXROUTER_ERR_OK) {
-			printf("Could not configure S3D1 router, exiting\n");
-			sipif_free();
-			return -9;
-		}
-#else
-		if(sxdx_configurerouter(AddrSipRouterS1D3, 0xFFFFFFFFFFFFFF00LLU)!=SXDXROUTER_ERR_OK) {
-			printf("Could not configure S1D3 router, exiting\n");
-			sipif_free();
-			return -8;
-		}
-
-		// Setup 3-to-1 Router
-		if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF00LLU)!=SXDXROUTER_ERR_OK) {
-			printf("Could not configure S3D1 router, exiting\n");
-			sipif_free();
-			return -9;
-		}
-#endif
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Detect FMC Presence
-		if(fmc15x_ctrl_probefmc(AddrSipFMC150Ctrl)!=FMC15x_ERR_OK) {
-			printf("Could not detect FMC150 hardware, exiting\n");
-			sipif_free();
-			return -11;
-		}
-
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Temperature/Voltages monitoring
-		printf("---  Measuring on-board voltages   ---\n");
-		if(fmc15x_monitor_getdiags(AddrSipFMC150Monitor)!=FMC15x_MON_ERR_OK) {
-			printf("An error occurred in the FMC150 diagnostics function.\n");
-			printf("An error occurred in the FMC150 diagnostics function, exiting\n");
-			sipif_free();
-			return -10;
-		}
-		printf("--------------------------------------\n\n");
-
-		/////////////////////////////////////////////////////////////////////////////////////////////
-		// Determine the VCXO type
-		// The firmware default power up divider on the DAC reference clock (frequency 6) is two;
-		// - When a 737.28MHz VCXO is assembled the frequency readout will be around 368.64MHz
-		// - When a 491.52MHz VCXO is assembled the frequency readout will be around 245.76MHz
-		// - When a 542.40MHz VCXO is assembled the frequency readout will be around 271.20MHz
-		// - When a 800.00MHz VCXO is assembled the frequency readout will be around 400.00MHz
-		// - When a 480.00MHz VCXO is assembled the frequency readout will be around 240.00MHz
-		float freq ;
-		
-		
-		int32_t vcxoType = FMC150_VCXO_737_28;
-		if(fmc15x_freqcnt_getfrequency(AddrSipFMC150FreqCnt, 6, &freq, FMC15x_FREQCNT_NO_DISPLAY_CONSOLE, 0, fReference)!=FMC15x_FREQCNT_ERR_OK) {
-			printf("Could not obtain frequency id%d from FMC15x.FREQCNT\n", 6);
-			sipif_free();
-			return -12;
-		}
-
-		// this check MUST happen before internal/external clock check
-		if ( freq > 395 && freq < 405 )
-			vcxoType = FMC150_VCXO_800_00;
-
-		if (freq < 300 || modeClock == 1)
-			vcxoType = FMC150_VCXO_542_40;
-
-		if (freq < 260 || modeClock == 1)
-			vcxoType = FMC150_VCXO_491_52;
-
-		if (freq < 245 || modeClock == 1)
-			vcxoType = FMC150_VCXO_480_00 ;
-
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Init FMC150
-		if(fmc15x_init(AddrSipFMC150ClkSpi, AddrSipFMC150DacSpi, AddrSipFMC150DacPhy, AddrSipFMC150AdcSpi, AddrSipFMC150AdcPhy,
-			AddrSipFMC150Monitor, modeClock, vcxoType, tapiod_clk, tapiod_data, odelay_tap, constellation_id, auto_training)!=FMC15x_ERR_OK) {
-				printf("Could not initialize FMC150\n");
-				sipif_free();
-				return -11;
-		}
-		printf("\n");
-
-		/////////////////////////////////////////////////////////////////////////////////////////////
-		// Measure and display all available frequencies in a loop.
-		// Note that the first frequencies (ADC clocks) are going to display erroneous values if no
-		// FMC is actually attached.
-		printf("--------------------------------------\n\n");
-		printf("\n--- Measuring on-board frequencies ---\n");
-		for(int32_t i = 0; i < 7; i++) {
-			if(fmc15x_freqcnt_getfrequency(AddrSipFMC150FreqCnt, i, NULL, FMC15x_FREQCNT_DISPLAY_CONSOLE, vcxoType, fReference)!=FMC15x_FREQCNT_ERR_OK) {
-				printf("Could not obtain frequency id%d from FMC15x.FREQCNT\n", i);
-				sipif_free();
-				return -12;
-			}
-		}
-		printf("--------------------------------------\n\n");
-
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Configure burst size and burst number
-		int32_t BurstSize = 1024; // samples
-		switch( cid_getconstellationid() )
-		{
-		case CONSTELLATION_ID_FMC151_ML605:
-		case CONSTELLATION_ID_ML605:
-		case CONSTELLATION_ID_ML605_PCIe:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_KC705_PCIe:
-		case CONSTELLATION_ID_KC705:
-		case CONSTELLATION_ID_FMC151_KC705:
-			BurstSize = 16 * 1024;
-			break;
-		case CONSTELLATION_ID_FMC151_VC707_HPC1:
-		case CONSTELLATION_ID_FMC151_VC707_HPC2:
-		case CONSTELLATION_ID_VC707:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_FMC151_ZC706:
-		case CONSTELLATION_ID_FMC151_ZC706_DDR3:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_SP601:
-			BurstSize = 1024;
-			break;
-		case CONSTELLATION_ID_SP605:
-			BurstSize = 1024;
-			break;
-		case CONSTELLATION_ID_FM680:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_VP680:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_PC720_PRIMARY:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_PC720_SECONDARY:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_sFMC720:
-			BurstSize = 16*1024;
-			break;	
-		case CONSTELLATION_ID_FMC151_PC720_PRIMARY:
-			BurstSize = 4*1024;
-			break;
-		case CONSTELLATION_ID_FMC151_PC720_SECONDARY:
-			BurstSize = 4*1024;
-			break;
-		case CONSTELLATION_ID_FM780:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_PC720_BOTH:
-			BurstSize = 16*1024;
-			break;
-		case CONSTELLATION_ID_FMC151_PC720_BOTH:
-			BurstSize = 4*1024;
-			break;
-		default:
-			BurstSize = 1024;
-			break;
-		}
-		const int32_t DacNbPeriod0	= BurstSize/16;	// number of DAC periods per burst
-		const int32_t DacNbPeriod1	= BurstSize/16;	// number of DAC periods per burst
-		uint8_t *pOutData = (uint8_t *)_aligned_malloc(2*BurstSize, 4096);	// out buffer
-		uint8_t *pInData	= (uint8_t *)_aligned_malloc(2*BurstSize, 4096);		// in buffer
-		if(fmc15x_ctrl_configure_burst(AddrSipFMC150Ctrl, 1, BurstSize)!=FMC15x_CTRL_ERR_OK) {
-			printf("Could not configure burst size/length in FMC15x.CTRL\n ");
-			sipif_free();
-			_aligned_free(pOutData);
-			_aligned_free(pInData);
-			return -13;
-		}
-
-		// For FMC151, configure DC offset to mid point
-		if ( (constellation_id == CONSTELLATION_ID_FMC151_ML605) || (constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC1) 
-			|| (constellation_id == CONSTELLATION_ID_FMC151_VC707_HPC2) || (constellation_id == CONSTELLATION_ID_FMC151_PC720_PRIMARY) 
-			|| (constellation_id == CONSTELLATION_ID_FMC151_PC720_SECONDARY) || (constellation_id == CONSTELLATION_ID_FMC151_PC720_BOTH) 
-			|| (constellation_id == CONSTELLATION_ID_FMC151_KC705) || (constellation_id == CONSTELLATION_ID_FMC151_ZC706)
-			|| (constellation_id == CONSTELLATION_ID_FMC151_ZC706_DDR3))
-		{
-			// 0x7fff is the mid point.   For larger values, it is between 0x0 and 0x7ffe, for lower values
-			// it is between 0x8000 and 0xffff
-			int slaveaddress = 0x1000;
-			if(constellation_id == CONSTELLATION_ID_FMC151_ML605) {
-				slaveaddress = 0x2200;
-			}
-			if (fmc151_configure_dc_offset(AddrSipI2cMaster, 0x7fff, 0x7fff, 0x7fff, 0x7fff, slaveaddress) != 0) {
-				printf ("Could not configure DC offset.\n");
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -13;
-			}
-
-		}
-
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Load DAC0
-		if(GenerateWaveform16((uint16_t *)pOutData, BurstSize, (BurstSize / DacNbPeriod0), (100e6),(uint32_t)pow(2.0f,15.8f), SINE_WAVE)!=0) {
-			printf("Could not generate waveform\n");
-		}
-
-		if ((constellation_id != CONSTELLATION_ID_PC720_BOTH) && (constellation_id != CONSTELLATION_ID_FMC151_PC720_BOTH)) {
-			DeleteFile("dac0.bin"); DeleteFile("dac0.txt");
-			Save16BitArrayToFile(pOutData, BurstSize, "dac0.txt", ASCII);
-			Save16BitArrayToFile(pOutData, BurstSize, "dac0.bin", BINARY);
-		}
-		else {
-			if (currentCard == 0) {
-				DeleteFile("dac0_primary.bin"); DeleteFile("dac0_primary.txt");
-				Save16BitArrayToFile(pOutData, BurstSize, "dac0_primary.txt", ASCII);
-				Save16BitArrayToFile(pOutData, BurstSize, "dac0_primary.bin", BINARY);
-			}
-			else
-			{
-				DeleteFile("dac0_secondary.bin"); DeleteFile("dac0_secondary.txt");
-				Save16BitArrayToFile(pOutData, BurstSize, "dac0_secondary.txt", ASCII);
-				Save16BitArrayToFile(pOutData, BurstSize, "dac0_secondary.bin", BINARY);
-			}
-		}
-		// configure the router ( route data to DAC0's wave form memory )
-		uint64_t routerSetting;
-		routerSetting = 0xff;
-		routerSetting = routerSetting << (currentCard * 16);
-		routerSetting = ~routerSetting;
-
-		if(sxdx_configurerouter(AddrSipRouterS1D3, routerSetting)!=SXDXROUTER_ERR_OK) {
-			printf("Could not configure S1D3 router, exiting\n");
-			sipif_free();
-			_aligned_free(pOutData);
-			_aligned_free(pInData);
-			return -14;
-		}
-		// prepare the firmware to receive waveform data
-		if(fmc15x_ctrl_prepare_wfm_load(AddrSipFMC150Ctrl, DAC0)!=FMC15x_CTRL_ERR_OK) {
-			printf("Could not prepare waveform upload, exiting\n");
-			sipif_free();
-			_aligned_free(pOutData);
-			_aligned_free(pInData);
-			return -15;
-		}
-
-		// send the data to the waveform memory
-		if(sipif_writedata(pOutData,  2*BurstSize)!=SIPIF_ERR_OK) {
-			printf("Could not communicate with device %d.\n", devIdx);
-			sipif_free();
-			_aligned_free(pOutData);
-			_aligned_free(pInData);
-			return -16;
-		}
-
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Load DAC1
-		if(GenerateWaveform16((uint16_t *)pOutData, BurstSize, 16,(100e6), (uint32_t)pow(2.0f,15.8f), SQUARE_WAVE)!=0) {
-			printf("Could not generate waveform\n");
-		}
-
-		if ((constellation_id != CONSTELLATION_ID_PC720_BOTH) && (constellation_id != CONSTELLATION_ID_FMC151_PC720_BOTH)) {
-			// clean the files previously saved
-			DeleteFile("dac1.bin");
-			DeleteFile("dac1.txt");
-			// write to file
-			Save16BitArrayToFile(pOutData, BurstSize, "dac1.txt", ASCII);
-			Save16BitArrayToFile(pOutData, BurstSize, "dac1.bin", BINARY);
-		}
-		else {
-			if (currentCard == 0) {
-				// clean the files previously saved
-				DeleteFile("dac1_primary.bin");
-				DeleteFile("dac1_primary.txt");
-				// write to file
-				Save16BitArrayToFile(pOutData, BurstSize, "dac1_primary.txt", ASCII);
-				Save16BitArrayToFile(pOutData, BurstSize, "dac1_primary.bin", BINARY);
-			}
-			else {
-				// clean the files previously saved
-				DeleteFile("dac1_secondary.bin");
-				DeleteFile("dac1_secondary.txt");
-				// write to file
-				Save16BitArrayToFile(pOutData, BurstSize, "dac1_secondary.txt", ASCII);
-				Save16BitArrayToFile(pOutData, BurstSize, "dac1_secondary.bin", BINARY);
-			}
-		}
-		// configure the router ( route data to DAC1's wave form memory )
-		routerSetting = 0xff00;
-		routerSetting = routerSetting << (currentCard * 16);
-		routerSetting = ~routerSetting;
-
-		if(sxdx_configurerouter(AddrSipRouterS1D3, routerSetting)!=SXDXROUTER_ERR_OK) {
-			printf("Could not configure S1D3 router, exiting\n");
+		if(cardResult[currentCard] != 0) {
+			for (int32_t i = 0; i < numFmcCards; i++)
+				Card_Release(&cardState[i]);
 			sipif_free();
-			_aligned_free(pOutData);
-			_aligned_free(pInData);
-			return -14;
+			return cardResult[currentCard];
 		}
-		// prepare the firmware to receive waveform data
-		if(fmc15x_ctrl_prepare_wfm_load(AddrSipFMC150Ctrl, DAC1)!=FMC15x_CTRL_ERR_OK) {
-			printf("Could not prepare waveform upload, exiting\n");
-			sipif_free();
-			_aligned_free(pOutData);
-			_aligned_free(pInData);
-			return -18;
-		}
-
-		// send the data to the waveform memory
-		if(sipif_writedata(pOutData,  2*BurstSize)!=SIPIF_ERR_OK) {
-			printf("Could not communicate with device %d.\n", devIdx);
-			sipif_free();
-			_aligned_free(pOutData);
-			_aligned_free(pInData);
-			return -19;
-		}
-
-
-		bool pattern_check_passed = false;
-		for (;;) {
-
-			if (pattern_check_passed == false) {
-				printf ("Running ramp pattern check on card %d......\n", currentCard);
-				if (fmc15x_adc_pattern_check(AddrSipFMC150AdcSpi, true) != FMC15x_ADC_ERR_OK)
-				{
-					printf ("Could not enabled pattern check\n");
-					sipif_free();
-					_aligned_free(pInData);
-					return -13;
-				}
-			}
-			else {
-				printf ("Acquiring %d samples on card %d\n", BurstSize, currentCard);
-				if (fmc15x_adc_pattern_check(AddrSipFMC150AdcSpi, false) != FMC15x_ADC_ERR_OK)
-				{
-					printf ("Could not enabled pattern check\n");
-					sipif_free();
-					_aligned_free(pInData);
-					return -13;
-
-				}
-			}
-
-
-			/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-			// Read a burst from ADC0 and save to file
-			// route data from ADC0's FIFO
-#ifdef WIN32
-			if(currentCard == 0) {
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF00)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);
-					return -20;
-				}
-
-			} else if(currentCard == 1) {			
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF02)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);
-					return -20;
-				}
-			}
-#else
-			if (currentCard == 0) {
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF00LLU)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);
-					return -20;
-				}
-			}
-			else if (currentCard == 1) {
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF02LLU)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);
-					return -20;
-				}
-			}
-#endif
-			
-			// Configure the DDR3 FIFO
-			if( constellation_id == CONSTELLATION_ID_FMC151_ZC706_DDR3) {
-				// Configure and arm the FIFO
-				if(memfifo_configure(AddrSipMemoryFIFO, 0, NBRBURST_UNLIMITED, 2*BurstSize, 0, 0, FIFO_ARMED)!=MEMFIFO_ERR_OK) {
-					printf("Could not configure the memory FIFO\n ");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);
-					return -20;
-				}
-			}
-
-			// enable ADC0 + DAC0 + DAC1
-			if(fmc15x_ctrl_enable_channel(AddrSipFMC150Ctrl, ENABLED, DISABLED, ENABLED, ENABLED)!=FMC15x_CTRL_ERR_OK) {
-				printf("Could not enable, exiting\n");
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -21;
-			}
-
-			// arm the DAC
-			if(fmc15x_ctrl_arm_dac(AddrSipFMC150Ctrl)!=FMC15x_CTRL_ERR_OK) {
-				printf("Could not arm DAC0, exiting\n");
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -22;
-			}
-
-			// send a software trigger to the ADC block
-			if(fmc15x_ctrl_sw_trigger(AddrSipFMC150Ctrl)!=FMC15x_CTRL_ERR_OK) {
-				printf("Could not send software trigger to ADC0, exiting\n");
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				
-				return -23;
-			}
-
-			// Read data from the pipe
-			if (pattern_check_passed)
-				printf("Retrieve %d samples from ADC0\n", BurstSize);
-			if(sipif_readdata  (pInData,  2*BurstSize)!=SIPIF_ERR_OK) {
-				printf("Could not communicate with device %d.\n", devIdx);
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -24;
-			}
+	}
+	Profile_End(runSpan);
 
-			if (pattern_check_passed == false) {
-				rc = verify_ramp_pattern((char *)pInData, BurstSize);
-			}
-			else {
-				if ((constellation_id != CONSTELLATION_ID_PC720_BOTH) && (constellation_id != CONSTELLATION_ID_FMC151_PC720_BOTH)) {
-					// clean the files previously saved
-					DeleteFile("adc0.bin");
-					DeleteFile("adc0.txt");
-
-					// write to file
-					Save16BitArrayToFile(pInData, BurstSize, "adc0.txt", ASCII);
-					Save16BitArrayToFile(pInData, BurstSize, "adc0.bin", BINARY);
-				}
-				else {
-					if (currentCard == 0) {
-						// clean the files previously saved
-						DeleteFile("adc0_primary.bin");
-						DeleteFile("adc0_primary.txt");
-
-						// write to file
-						Save16BitArrayToFile(pInData, BurstSize, "adc0_primary.txt", ASCII);
-						Save16BitArrayToFile(pInData, BurstSize, "adc0_primary.bin", BINARY);
-					}
-					else {
-						// clean the files previously saved
-						DeleteFile("adc0_secondary.bin");
-						DeleteFile("adc0_secondary.txt");
-
-						// write to file
-						Save16BitArrayToFile(pInData, BurstSize, "adc0_secondary.txt", ASCII);
-						Save16BitArrayToFile(pInData, BurstSize, "adc0_secondary.bin", BINARY);
-					}
-				}
-			}
-			/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-			// Read a burst from ADC1 and save to file 
-			// route data from ADC1's FIFO
-#ifdef WIN32
-			if(currentCard == 0) {
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF01)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);;
-					return -25;
-				}
-			} else if(currentCard == 1) {
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF03)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);;
-					return -25;
-				}
-			}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Service mode, the cards stay up until a client sends quit
+	if(servePath != NULL) {
+#ifndef WIN32
+		ServeCommands(servePath, cardState, numFmcCards);
 #else
-			if (currentCard == 0) {
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF01LLU)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);;
-					return -25;
-				}
-			}
-			else if (currentCard == 1) {
-				if(sxdx_configurerouter(AddrSipRouterS3D1, 0xFFFFFFFFFFFFFF03LLU)!=SXDXROUTER_ERR_OK) {
-					printf("Could not configure S3D1 router, exiting\n");
-					sipif_free();
-					_aligned_free(pOutData);
-					_aligned_free(pInData);;
-					return -25;
-				}
-			}
+		printf("Service mode is not available on this platform\n");
 #endif
-			// enable ADC1 + DAC0 + DAC1
-			if(fmc15x_ctrl_enable_channel(AddrSipFMC150Ctrl, DISABLED, ENABLED, ENABLED, ENABLED)!=FMC15x_CTRL_ERR_OK) {
-				printf("Could not enable, exiting\n");
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -26;
-			}
-
-			// arm the DAC
-			if(fmc15x_ctrl_arm_dac(AddrSipFMC150Ctrl)!=FMC15x_CTRL_ERR_OK) {
-				printf("Could not arm DAC1, exiting\n");
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -27;
-			}
-
-			// send a software trigger to the ADC block
-			if(fmc15x_ctrl_sw_trigger(AddrSipFMC150Ctrl)!=FMC15x_CTRL_ERR_OK) {
-				printf("Could not send software trigger to DAC1, exiting\n");
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -28;
-			}
-
-			// Read from the pipe
-			if (pattern_check_passed)
-				printf("Retrieve %d samples from ADC1\n", BurstSize);
-			if(sipif_readdata(pInData,  2*BurstSize)!=SIPIF_ERR_OK) {
-				printf("Could not communicate with device %d.\n", devIdx);
-				sipif_free();
-				_aligned_free(pOutData);
-				_aligned_free(pInData);
-				return -29;
-			}
-
-			if (pattern_check_passed == false) {
-				rc = verify_ramp_pattern((char *)pInData, BurstSize);
-				pattern_check_passed = true;
-			}
-			else {
-
-				if ((constellation_id != CONSTELLATION_ID_PC720_BOTH) && (constellation_id != CONSTELLATION_ID_FMC151_PC720_BOTH)) {
-					// clean the files previously saved
-					DeleteFile("adc1.bin");
-					DeleteFile("adc1.txt");
-
-					// write to file
-					Save16BitArrayToFile(pInData, BurstSize, "adc1.txt", ASCII);
-					Save16BitArrayToFile(pInData, BurstSize, "adc1.bin", BINARY);
-				}
-				else {
-					if (currentCard == 0) {
-						// clean the files previously saved
-						DeleteFile("adc1_primary.bin");
-						DeleteFile("adc1_primary.txt");
-
-						// write to file
-						Save16BitArrayToFile(pInData, BurstSize, "adc1_primary.txt", ASCII);
-						Save16BitArrayToFile(pInData, BurstSize, "adc1_primary.bin", BINARY);
-					}
-					else {
-						// clean the files previously saved
-						DeleteFile("adc1_secondary.bin");
-						DeleteFile("adc1_secondary.txt");
-
-						// write to file
-						Save16BitArrayToFile(pInData, BurstSize, "adc1_secondary.txt", ASCII);
-						Save16BitArrayToFile(pInData, BurstSize, "adc1_secondary.bin", BINARY);
-					}
-				}
-
-				// exit the for (;;) loop
-				break;
-			}
-		}
-		_aligned_free(pOutData);
-		_aligned_free(pInData);
+		for (int32_t currentCard = 0; currentCard < numFmcCards; currentCard++)
+			Card_Release(&cardState[currentCard]);
 	}
+
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Close the device
+	ShadowReg_PrintStats();
+	SipTransaction_PrintStats();
+	BufferPool_PrintStats(&g_bufferPool);
+	BufferPool_Destroy(&g_bufferPool);
 	printf("\nEnd of program.\n\n\n");
 	sipif_free();
 #ifdef WIN32		
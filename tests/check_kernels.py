@@ -0,0 +1,187 @@
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+import numpy as np
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+sys.path.insert(0, ROOT)
+
+# SIMD paths of main.cpp, selected by the target flags ( see FMC_HAVE_AVX2/FMC_HAVE_SSE2 )
+VARIANTS = {'avx2': ['-mavx2'], 'sse2': [], 'scalar': ['-U__SSE2__']}
+
+
+# Build tests/kernel_check.cpp for one SIMD variant, returns the path of the executable
+def build(cxx, includes, variant, build_dir):
+    exe = os.path.join(build_dir, 'kernel_check_' + variant)
+    cmd = [cxx, '-std=c++11', '-O2', '-pthread', '-DFMC15X_SIM'] + ['-I' + d for d in includes] + VARIANTS[variant] + \
+          [os.path.join(HERE, 'kernel_check.cpp'), os.path.join(ROOT, 'fmc15x_sim.cpp'), '-o', exe]
+    subprocess.run(cmd, check=True)
+    return exe
+
+
+# Run one kernel_check command, its files go to a directory of their own. Returns the directory, or None when the
+# command failed ( its messages are printed )
+def run(exe, command, build_dir):
+    out = os.path.join(build_dir, os.path.basename(exe) + '_' + command)
+    os.makedirs(out, exist_ok=True)
+    result = subprocess.run([exe, command, out], stdout=subprocess.PIPE, universal_newlines=True)
+    if result.returncode != 0:
+        print(result.stdout, end='')
+        return None
+    return out
+
+
+# ComputeLinearSpectrum() against numpy: Hann window of main.cpp ( periodic ), power relative to full scale
+def check_fft(out):
+    errors = 0
+    for n in (4, 8, 64, 1024, 16384):
+        data = np.fromfile(os.path.join(out, f'fft_{n}.f32'), dtype='<f4')
+        x, power = data[:n].astype(np.float64), data[n:].astype(np.float64)
+        window = 0.5 - 0.5 * np.cos(2 * np.pi * np.arange(n) / n)
+        ref = (2 * np.abs(np.fft.rfft(x * window)) / window.sum()) ** 2
+        error = np.max(np.abs(power - ref)) / ref.max()
+        if error > 1e-5:
+            print(f"fft n={n}: relative error {error:.2e}")
+            errors += 1
+        if n >= 64 and abs(10 * np.log10(power[n // 8] / ref[n // 8])) > 1e-3:
+            print(f"fft n={n}: tone bin {10 * np.log10(power[n // 8]):.4f} dB, numpy {10 * np.log10(ref[n // 8]):.4f} dB")
+            errors += 1
+    return errors
+
+
+# FindSpectrumPeaks() against scipy.signal.find_peaks(): same bins and prominences, strongest peak first
+def check_peaks(out):
+    from scipy.signal import find_peaks
+    sequences = np.fromfile(os.path.join(out, 'peaks_seq.bin'),
+                            dtype=[('length', '<u4'), ('nbr_peaks', '<u4'), ('min_prominence', '<f4')])
+    y = np.fromfile(os.path.join(out, 'peaks_y.f32'), dtype='<f4')
+    found = np.fromfile(os.path.join(out, 'peaks_found.bin'),
+                        dtype=[('sequence', '<u4'), ('bin', '<u4'), ('prominence', '<f4'), ('height', '<f4')])
+    errors = 0
+    first = 0
+    for s, seq in enumerate(sequences):
+        values = y[first:first + seq['length']].astype(np.float64)
+        first += seq['length']
+        peaks = found[found['sequence'] == s]
+        bins, props = find_peaks(values, prominence=float(seq['min_prominence']))
+        order = np.argsort(peaks['bin'])
+        if len(peaks) != seq['nbr_peaks'] or not np.array_equal(peaks['bin'][order], bins) or \
+           not np.array_equal(peaks['prominence'][order], props['prominences']):
+            print(f"peaks sequence {s}: bins {sorted(peaks['bin'].tolist())}, scipy {bins.tolist()}")
+            errors += 1
+        elif np.any(np.diff(peaks['height']) > 0) or not np.array_equal(peaks['height'], values[peaks['bin']]):
+            print(f"peaks sequence {s}: not sorted by height")
+            errors += 1
+    return errors
+
+
+# DeltaCodec_Encode() against capfile.py: every run decodes back, blocks have the CODEC_BLOCK_SHIFTED flag exactly
+# when their low bits are unused and the smallest bit width, capture files read back as the bursts
+def check_codec(out):
+    import capfile
+    cases = np.fromfile(os.path.join(out, 'codec_cases.bin'),
+                        dtype=[('count', '<u4'), ('stride', '<u4'), ('input', '<u4'), ('output', '<u4'), ('bytes', '<u4')])
+    x = np.fromfile(os.path.join(out, 'codec_in.i16'), dtype='<i2')
+    data = np.fromfile(os.path.join(out, 'codec_out.bin'), dtype=np.uint8)
+    errors = 0
+    for c, case in enumerate(cases):
+        run = x[case['input']::case['stride']][:case['count']]
+        pos = case['output']
+        for start in range(0, case['count'], capfile.CODEC_BLOCK_SAMPLES):
+            block = run[start:start + capfile.CODEC_BLOCK_SAMPLES]
+            shifted = not np.any(block & 3)
+            values = (block >> 2 if shifted else block).astype(np.int64)
+            deltas = ((values[1:] - values[:-1]) & 0xffff).astype(np.uint16).view(np.int16).astype(np.int64)
+            width = int(np.max(((deltas << 1) ^ (deltas >> 15)) & 0xffff, initial=0)).bit_length()
+            if bool(data[pos] & capfile.CODEC_BLOCK_SHIFTED) != shifted or data[pos] & 0x1f != width:
+                print(f"codec run {c} block {start}: header 0x{data[pos]:02x}, expected width {width} shifted {shifted}")
+                errors += 1
+            decoded, pos = capfile.decode_delta(data, pos, len(block))
+            if not np.array_equal(decoded, block):
+                print(f"codec run {c} block {start}: decoded samples differ")
+                errors += 1
+        if pos != case['output'] + case['bytes']:
+            print(f"codec run {c}: {case['bytes']} bytes coded, {pos - case['output']} decoded")
+            errors += 1
+    for name, channels in (('codec_adc0', 1), ('codec_adc01', 2)):
+        header, samples = capfile.read_capture(os.path.join(out, name + '.cap'))
+        bursts = np.fromfile(os.path.join(out, name + '.i16'), dtype='<i2')
+        expected = capfile.FORMAT_DELTA_PAIRS if channels == 2 else capfile.FORMAT_DELTA
+        if header['sampleFormat'] != expected or not np.array_equal(samples.reshape(-1), bursts):
+            print(f"codec {name}.cap: format {header['sampleFormat']}, samples differ from the bursts")
+            errors += 1
+    return errors
+
+
+# Packed14_Pack() against capfile.unpack14(): runs of any length, packed capture files read back as the bursts
+# with their low bits dropped
+def check_pack(out):
+    import capfile
+    cases = np.fromfile(os.path.join(out, 'pack_cases.bin'), dtype=[('count', '<u4'), ('input', '<u4'), ('output', '<u4')])
+    x = np.fromfile(os.path.join(out, 'pack_in.i16'), dtype='<i2')
+    data = np.fromfile(os.path.join(out, 'pack_out.bin'), dtype=np.uint8)
+    errors = 0
+    for case in cases:
+        count = int(case['count'])
+        packed = data[case['output']:case['output'] + (7 * count + 3) // 4]
+        for dtype in (np.int16, np.float32):
+            samples = capfile.unpack14(packed[np.newaxis], count, dtype)[0]
+            if not np.array_equal(samples, (x[case['input']:case['input'] + count] & ~3).astype(dtype)):
+                print(f"pack {count} samples: unpack14() to {np.dtype(dtype).name} differs from the samples")
+                errors += 1
+    for name, channels in (('pack_adc0', 1), ('pack_adc01', 2)):
+        header, samples = capfile.read_capture(os.path.join(out, name + '.cap'))
+        bursts = np.fromfile(os.path.join(out, name + '.i16'), dtype='<i2')
+        expected = capfile.FORMAT_PACKED14_PAIRS if channels == 2 else capfile.FORMAT_PACKED14
+        if header['sampleFormat'] != expected or not np.array_equal(samples.reshape(-1), bursts & ~3):
+            print(f"pack {name}.cap: format {header['sampleFormat']}, samples differ from the bursts")
+            errors += 1
+    return errors
+
+
+CHECKS = {'fft': check_fft, 'peaks': check_peaks, 'codec': check_codec, 'pack': check_pack}
+# checks whose files must be the same on every SIMD variant
+EXACT = {'peaks', 'codec', 'pack'}
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Check the signal processing kernels of main.cpp')
+    parser.add_argument('-I', dest='includes', action='append', default=[], help='4DSP include directory')
+    parser.add_argument('--cxx', default=os.environ.get('CXX', 'g++'), help='C++ compiler')
+    parser.add_argument('--variants', default=','.join(VARIANTS), help='SIMD variants to build and check')
+    parser.add_argument('--build-dir', help='directory of the executables and their files ( default temporary )')
+    parser.add_argument('checks', nargs='*', default=list(CHECKS), help='checks to run')
+    args = parser.parse_args()
+
+    build_dir = args.build_dir or tempfile.mkdtemp(prefix='kernel_check_')
+    os.makedirs(build_dir, exist_ok=True)
+    failed = 0
+    outputs = {}
+    for variant in args.variants.split(','):
+        exe = build(args.cxx, args.includes, variant, build_dir)
+        for name in args.checks:
+            outputs[variant, name] = run(exe, name, build_dir)
+            errors = CHECKS[name](outputs[variant, name]) if outputs[variant, name] else 1
+            print(f"{variant:6} {name:8} {'ok' if errors == 0 else 'FAILED'}")
+            failed += errors != 0
+    # the SIMD paths must produce the bytes of the first variant, capture file headers aside ( time stamps )
+    variants = args.variants.split(',')
+    for name in EXACT.intersection(args.checks):
+        reference = outputs[variants[0], name]
+        for variant in variants[1:] if reference else []:
+            if not outputs[variant, name]:
+                continue
+            for filename in sorted(os.listdir(reference)):
+                with open(os.path.join(reference, filename), 'rb') as f:
+                    a = f.read()
+                with open(os.path.join(outputs[variant, name], filename), 'rb') as f:
+                    b = f.read()
+                skip = 4096 if filename.endswith('.cap') else 0
+                if a[skip:] != b[skip:]:
+                    print(f"{variant:6} {name:8} {filename} differs from {variants[0]}")
+                    failed += 1
+    sys.exit(1 if failed else 0)
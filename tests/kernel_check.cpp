@@ -0,0 +1,434 @@
+/**
+@file kernel_check.cpp
+@brief Runs the signal processing kernels of main.cpp on generated data, for check_kernels.py
+
+main.cpp is included with its main() renamed, so the kernels are checked exactly as the application builds them
+( the SSE2/AVX2 paths follow the target flags ). Built and run by check_kernels.py:
+
+	g++ -std=c++11 -O2 -pthread -DFMC15X_SIM -I<4DSP include directories> tests/kernel_check.cpp fmc15x_sim.cpp
+
+Every command writes its inputs and outputs as raw little endian files in the given directory, check_kernels.py
+compares them with numpy/scipy and across the SIMD builds.
+
+	kernel_check fft <dir>		ComputeLinearSpectrum() of random bursts, fft_<n>.f32: n samples then n/2+1 bins
+	kernel_check peaks <dir>	FindSpectrumPeaks() of random sequences, peaks_seq.bin: length and minimum
+					prominence of every sequence, peaks_y.f32: the sequences, peaks_found.bin: sequence,
+					bin, prominence and height of every peak in the order FindSpectrumPeaks() returns them
+	kernel_check codec <dir>	DeltaCodec_Encode() of random and edge case runs, decoded back in C++ too,
+					codec_cases.bin: one record per run, codec_in.i16: the samples, codec_out.bin: the
+					coded runs, codec_adc0.cap/codec_adc01.cap: delta coded capture files of the
+					bursts in codec_adc0.i16/codec_adc01.i16
+	kernel_check pack <dir>		Packed14_Pack()/Packed14_Unpack() of runs of any length, out of place and in place,
+					checked in C++ against a bit by bit packing, pack_cases.bin: one record per run,
+					pack_in.i16: the samples, pack_out.bin: the packed runs, pack_adc0.cap/pack_adc01.cap:
+					packed capture files of the bursts in pack_adc0.i16/pack_adc01.i16
+*************************************************************************/
+
+#define main fmc15x_main
+#include "../main.cpp"
+#undef main
+
+/**
+*  Deterministic generator of the test data, the same on every build.
+*/
+static uint32_t g_checkSeed = 12345;
+
+static uint32_t Check_Random(void)
+{
+	g_checkSeed = g_checkSeed * 1664525u + 1013904223u;
+	return g_checkSeed >> 8;
+}
+
+/**
+*  Uniform random float in [-1, 1).
+*/
+static float Check_RandomFloat(void)
+{
+	return (float)Check_Random() / (float)(1u << 23) - 1.0f;
+}
+
+/**
+*  Write a buffer to <dir>/<name>.
+*
+*  @return
+*						- -1 ( cannot create the file )
+*						- 0 ( Success )
+*/
+static int32_t Check_WriteFile(const char *dir, const char *name, const void *data, size_t bytes)
+{
+	char filename[256];
+	snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+	FILE *f = fopen(filename, "wb");
+	if(!f) {
+		printf("Check_WriteFile() -> cannot create '%s'\n", filename);
+		return -1;
+	}
+	size_t written = fwrite(data, 1, bytes, f);
+	fclose(f);
+	return written == bytes ? 0 : -1;
+}
+
+/**
+*  Spectra of random bursts and of a sine centred on a bin, see ComputeLinearSpectrum().
+*/
+static int32_t Check_Fft(const char *dir)
+{
+	static const uint32_t sizes[] = { 4, 8, 64, 1024, 16384 };
+	for(uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		uint32_t n = sizes[s];
+		const FftPlan *plan = FftPlan_Get(n);
+		std::vector<float> data(n + n / 2 + 1), work(n);
+		for(uint32_t i = 0; i < n; i++)
+			data[i] = Check_RandomFloat();
+		if(n >= 64) {
+			const double pi = 3.14159265358979323846;
+			// full scale sine on bin n/8 on top of the noise, reads about 1 in its bin
+			for(uint32_t i = 0; i < n; i++)
+				data[i] = (float)(0.9 * sin(2 * pi * i / 8)) + 0.1f * data[i];
+		}
+		ComputeLinearSpectrum(&data[0], plan, &work[0], &work[n / 2], &data[n]);
+		char name[32];
+		snprintf(name, sizeof(name), "fft_%u.f32", n);
+		if(Check_WriteFile(dir, name, &data[0], data.size() * sizeof(float)) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+*  Record of peaks_seq.bin, one per sequence.
+*/
+typedef struct {
+	uint32_t length;						/*!< number of values in peaks_y.f32 */
+	uint32_t nbrPeaks;						/*!< number of records in peaks_found.bin */
+	float minProminence;					/*!< minimum prominence passed to FindSpectrumPeaks() */
+} CheckPeakSequence;
+
+/**
+*  Record of peaks_found.bin, one per peak.
+*/
+typedef struct {
+	uint32_t sequence;
+	uint32_t bin;
+	float prominence;
+	float height;
+} CheckPeak;
+
+/**
+*  Peaks of random sequences, see FindSpectrumPeaks(). The values are multiples of 1/8 so the prominences are exact
+*  in float, a narrow range gives plateaus and equal bases, a wide one isolated peaks.
+*/
+static int32_t Check_Peaks(const char *dir)
+{
+	static const uint32_t nbrSequences = 300;
+	std::vector<CheckPeakSequence> sequences(nbrSequences);
+	std::vector<CheckPeak> found;
+	std::vector<float> y;
+	std::vector<SpectrumPeak> peaks;
+	for(uint32_t s = 0; s < nbrSequences; s++) {
+		CheckPeakSequence &seq = sequences[s];
+		uint32_t range = (s % 3 == 0) ? 4 : (s % 3 == 1) ? 32 : 1024;
+		seq.length = 3 + Check_Random() % 254;
+		seq.minProminence = (float)(Check_Random() % 17) / 8.0f;
+		size_t first = y.size();
+		for(uint32_t i = 0; i < seq.length; i++)
+			y.push_back((float)(Check_Random() % range) / 8.0f - 10.0f);
+		peaks.resize(seq.length);
+		seq.nbrPeaks = FindSpectrumPeaks(&y[first], seq.length, 1.0, seq.minProminence, &peaks[0], seq.length);
+		for(uint32_t p = 0; p < seq.nbrPeaks; p++) {
+			CheckPeak peak = { s, peaks[p].bin, peaks[p].prominence, peaks[p].height };
+			found.push_back(peak);
+		}
+	}
+	if(Check_WriteFile(dir, "peaks_seq.bin", &sequences[0], sequences.size() * sizeof(CheckPeakSequence)) != 0 ||
+	   Check_WriteFile(dir, "peaks_y.f32", &y[0], y.size() * sizeof(float)) != 0)
+		return -1;
+	return Check_WriteFile(dir, "peaks_found.bin", found.empty() ? NULL : &found[0], found.size() * sizeof(CheckPeak));
+}
+
+/**
+*  Reference decoder of DeltaCodec_Encode(), one sample at a time.
+*
+*  @param in	coded run
+*  @param count	number of samples
+*  @param out	receives count samples
+*  @return number of bytes read
+*/
+static uint32_t Check_DecodeDelta(const uint8_t *in, uint32_t count, int16_t *out)
+{
+	const uint8_t *p = in;
+	for(uint32_t start = 0; start < count; start += CODEC_BLOCK_SAMPLES) {
+		uint32_t n = std::min(count - start, (uint32_t)CODEC_BLOCK_SAMPLES);
+		uint32_t width = p[0] & 0x1f;
+		int shift = (p[0] & CODEC_BLOCK_SHIFTED) ? 2 : 0;
+		uint16_t value = (uint16_t)(p[1] | p[2] << 8);
+		p += 3;
+		out[start] = (int16_t)(uint16_t)(value << shift);
+		for(uint32_t i = 1, bit = 0; i < n; i++) {
+			uint32_t code = 0;
+			for(uint32_t b = 0; b < width; b++, bit++)
+				code |= (uint32_t)((p[bit / 8] >> (bit % 8)) & 1) << b;
+			value = (uint16_t)(value + ((code >> 1) ^ (0u - (code & 1))));
+			out[start + i] = (int16_t)(uint16_t)(value << shift);
+		}
+		p += ((n - 1) * width + 7) / 8;
+	}
+	return (uint32_t)(p - in);
+}
+
+/**
+*  Record of codec_cases.bin, one per coded run.
+*/
+typedef struct {
+	uint32_t count;							/*!< number of samples of the run */
+	uint32_t stride;						/*!< distance between two samples in codec_in.i16 */
+	uint32_t input;							/*!< offset of the first sample in codec_in.i16, in samples */
+	uint32_t output;						/*!< offset of the coded run in codec_out.bin, in bytes */
+	uint32_t bytes;							/*!< size of the coded run */
+} CheckCodecCase;
+
+/**
+*  Fill a run of the codec check.
+*
+*  @param kind	0 random int16, 1 random left justified 14 bit, 2 constant, 3 full scale jumps, 4 14 bit samples with
+*				the low bits of a single one set, 5 ramp wrapping around on 16 bits
+*  @param x	receives count samples
+*/
+static void Check_CodecRun(uint32_t kind, int16_t *x, uint32_t count)
+{
+	int16_t constant = (int16_t)Check_Random();
+	for(uint32_t i = 0; i < count; i++) {
+		switch(kind) {
+		case 0: x[i] = (int16_t)Check_Random(); break;
+		case 1: x[i] = (int16_t)(Check_Random() & 0xfffc); break;
+		case 2: x[i] = constant; break;
+		case 3: x[i] = (i & 1) ? 32767 : -32768; break;
+		case 4: x[i] = (int16_t)((Check_Random() & 0xfffc) | (i == count / 2 ? 1 : 0)); break;
+		default: x[i] = (int16_t)(uint16_t)(0x7ff0 + i * 4); break;
+		}
+	}
+}
+
+/**
+*  Delta codec of random and edge case runs, single channel and ADC0/ADC1 pairs, checked against
+*  Check_DecodeDelta(), and of capture files.
+*/
+static int32_t Check_Codec(const char *dir)
+{
+	static const uint32_t counts[] = { 1, 2, 7, 8, 9, 16, 17, 127, 128, 129, 256, 1000 };
+	std::vector<CheckCodecCase> cases;
+	std::vector<int16_t> in, decoded;
+	std::vector<uint8_t> out;
+	int32_t errors = 0;
+	for(uint32_t kind = 0; kind < 6; kind++) {
+		for(uint32_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+			for(uint32_t stride = 1; stride <= 2; stride++) {
+				uint32_t count = counts[c];
+				size_t input = in.size();
+				in.resize(input + (size_t)count * stride);
+				for(uint32_t ch = 0; ch < stride; ch++) {
+					std::vector<int16_t> run(count);
+					Check_CodecRun(kind, &run[0], count);
+					for(uint32_t i = 0; i < count; i++)
+						in[input + (size_t)i * stride + ch] = run[i];
+				}
+				for(uint32_t ch = 0; ch < stride; ch++) {
+					CheckCodecCase cc = { count, stride, (uint32_t)(input + ch), (uint32_t)out.size(), 0 };
+					out.resize(cc.output + DeltaCodec_MaxBytes(count));
+					cc.bytes = DeltaCodec_Encode(&in[cc.input], count, stride, &out[cc.output]);
+					out.resize(cc.output + cc.bytes);
+					decoded.resize(count);
+					uint32_t bytes = Check_DecodeDelta(&out[cc.output], count, &decoded[0]);
+					for(uint32_t i = 0; i < count && bytes == cc.bytes; i++) {
+						if(decoded[i] != in[cc.input + (size_t)i * stride])
+							bytes = 0;
+					}
+					if(bytes != cc.bytes) {
+						printf("Check_Codec() -> run %u ( kind %u, %u samples, stride %u ) does not decode back\n",
+							   (uint32_t)cases.size(), kind, count, stride);
+						errors++;
+					}
+					cases.push_back(cc);
+				}
+			}
+		}
+	}
+	if(Check_WriteFile(dir, "codec_cases.bin", &cases[0], cases.size() * sizeof(CheckCodecCase)) != 0 ||
+	   Check_WriteFile(dir, "codec_in.i16", &in[0], in.size() * sizeof(int16_t)) != 0 ||
+	   Check_WriteFile(dir, "codec_out.bin", &out[0], out.size()) != 0)
+		return -1;
+
+	// capture files, bursts of a partial last block appended in two chunks
+	static const uint32_t burstSize = 1000, nbrBursts = 5;
+	CaptureFileHeader header;
+	CaptureFile_InitHeader(&header, 0, 0, 100.0f, SAMPLE_RATE, burstSize, 0);
+	g_captureCompression = true;
+	for(uint32_t pairs = 0; pairs < 2; pairs++) {
+		std::vector<int16_t> bursts((size_t)nbrBursts * burstSize * (pairs + 1));
+		for(uint32_t b = 0; b < nbrBursts * (pairs + 1); b++)
+			Check_CodecRun(b % 6, &bursts[(size_t)b * burstSize], burstSize);
+		const char *name = pairs ? "codec_adc01" : "codec_adc0";
+		char filename[256];
+		snprintf(filename, sizeof(filename), "%s/%s.cap", dir, name);
+		CaptureFile cap;
+		int32_t rc = CaptureFile_Open(&cap, filename, &header, pairs ? CAPTURE_CHANNEL_ADC01 : CAPTURE_CHANNEL_ADC0);
+		if(rc != 0)
+			return rc;
+		rc = CaptureFile_AppendBursts(&cap, &bursts[0], 2);
+		if(rc == 0)
+			rc = CaptureFile_AppendBursts(&cap, &bursts[(size_t)2 * burstSize * (pairs + 1)], nbrBursts - 2);
+		if(CaptureFile_Close(&cap) != 0 || rc != 0)
+			return -1;
+		snprintf(filename, sizeof(filename), "%s.i16", name);
+		if(Check_WriteFile(dir, filename, &bursts[0], bursts.size() * sizeof(int16_t)) != 0)
+			return -1;
+	}
+	g_captureCompression = false;
+	return errors == 0 ? 0 : -1;
+}
+
+/**
+*  Reference packing of Packed14_Pack(), one bit at a time.
+*
+*  @param in	samples
+*  @param count	number of samples
+*  @param out	receives Packed14_Bytes(count) bytes
+*/
+static void Check_Pack14(const int16_t *in, uint32_t count, uint8_t *out)
+{
+	memset(out, 0, Packed14_Bytes(count));
+	for(uint32_t i = 0, bit = 0; i < count; i++) {
+		uint32_t code = (uint16_t)in[i] >> 2;
+		for(uint32_t b = 0; b < 14; b++, bit++)
+			out[bit / 8] |= (uint8_t)(((code >> b) & 1) << (bit % 8));
+	}
+}
+
+/**
+*  Record of pack_cases.bin, one per packed run.
+*/
+typedef struct {
+	uint32_t count;							/*!< number of samples of the run */
+	uint32_t input;							/*!< offset of the first sample in pack_in.i16, in samples */
+	uint32_t output;						/*!< offset of the packed run in pack_out.bin, in bytes */
+} CheckPackCase;
+
+/**
+*  Check one run of Packed14_Pack() and Packed14_Unpack(): out of place with guard bytes after the output, in place,
+*  and back to the samples.
+*
+*  @param in	samples
+*  @param count	number of samples
+*  @param packed	receives Packed14_Bytes(count) bytes
+*  @return number of errors
+*/
+static int32_t Check_PackRun(const int16_t *in, uint32_t count, uint8_t *packed)
+{
+	static const uint32_t guard = 32;
+	const uint32_t bytes = Packed14_Bytes(count);
+	int32_t errors = 0;
+	std::vector<uint8_t> reference(bytes + 1), out(bytes + guard, 0xa5);
+	Check_Pack14(in, count, &reference[0]);
+	Packed14_Pack(in, count, &out[0]);
+	if(memcmp(&out[0], &reference[0], bytes) != 0)
+		errors++;
+	for(uint32_t i = bytes; i < bytes + guard; i++)
+		errors += (out[i] != 0xa5);
+
+	std::vector<int16_t> inPlace(in, in + count);
+	Packed14_Pack(&inPlace[0], count, (uint8_t *)&inPlace[0]);
+	if(memcmp(&inPlace[0], &reference[0], bytes) != 0)
+		errors++;
+
+	std::vector<int16_t> unpacked(count + guard, 0x5a5a);
+	Packed14_Unpack(&out[0], count, &unpacked[0]);
+	for(uint32_t i = 0; i < count; i++)
+		errors += (unpacked[i] != (int16_t)(in[i] & ~3));
+	for(uint32_t i = count; i < count + guard; i++)
+		errors += (unpacked[i] != 0x5a5a);
+	memcpy(packed, &out[0], bytes);
+	return errors;
+}
+
+/**
+*  14 bit packing of runs of any length, and of capture files with bursts that are not a multiple of 8 samples.
+*/
+static int32_t Check_Pack(const char *dir)
+{
+	static const uint32_t counts[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 11, 13, 15, 16, 17, 19, 23, 25, 31, 32, 33, 35, 63, 100, 1001, 4099 };
+	static const int16_t edges[] = { -32768, 32767, 0, -1, -4, 1, 0x2000, -0x2000 };
+	std::vector<CheckPackCase> cases;
+	std::vector<int16_t> in;
+	std::vector<uint8_t> out;
+	int32_t errors = 0;
+	for(uint32_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		CheckPackCase pc = { counts[c], (uint32_t)in.size(), (uint32_t)out.size() };
+		for(uint32_t i = 0; i < pc.count; i++)
+			in.push_back((Check_Random() % 4 == 0) ? edges[Check_Random() % 8] : (int16_t)Check_Random());
+		out.resize(pc.output + Packed14_Bytes(pc.count));
+		int32_t runErrors = Check_PackRun(&in[pc.input], pc.count, &out[pc.output]);
+		if(runErrors != 0) {
+			printf("Check_Pack() -> %d errors on %u samples\n", runErrors, pc.count);
+			errors += runErrors;
+		}
+		cases.push_back(pc);
+	}
+	if(Check_WriteFile(dir, "pack_cases.bin", &cases[0], cases.size() * sizeof(CheckPackCase)) != 0 ||
+	   Check_WriteFile(dir, "pack_in.i16", &in[0], in.size() * sizeof(int16_t)) != 0 ||
+	   Check_WriteFile(dir, "pack_out.bin", &out[0], out.size()) != 0)
+		return -1;
+
+	// capture files packed in place like StreamAdcToFile() does, 2339 samples and 1169 pairs per burst still fit
+	// their packed block in the burst
+	static const uint32_t nbrBursts = 4;
+	g_capturePacking = true;
+	for(uint32_t pairs = 0; pairs < 2; pairs++) {
+		const uint32_t burstSize = pairs ? 1169 : 2339, burstSamples = burstSize * (pairs + 1);
+		std::vector<int16_t> bursts((size_t)nbrBursts * burstSamples);
+		for(size_t i = 0; i < bursts.size(); i++)
+			bursts[i] = (int16_t)Check_Random();
+		const char *name = pairs ? "pack_adc01" : "pack_adc0";
+		char filename[256];
+		snprintf(filename, sizeof(filename), "%s.i16", name);
+		if(Check_WriteFile(dir, filename, &bursts[0], bursts.size() * sizeof(int16_t)) != 0)
+			return -1;
+		CaptureFileHeader header;
+		CaptureFile_InitHeader(&header, 0, 0, 100.0f, SAMPLE_RATE, burstSize, 0);
+		snprintf(filename, sizeof(filename), "%s/%s.cap", dir, name);
+		CaptureFile cap;
+		int32_t rc = CaptureFile_Open(&cap, filename, &header, pairs ? CAPTURE_CHANNEL_ADC01 : CAPTURE_CHANNEL_ADC0);
+		if(rc != 0)
+			return rc;
+		if(!CaptureFile_IsPacked(&cap)) {
+			printf("Check_Pack() -> %u samples per burst are not packed\n", burstSamples);
+			errors++;
+		}
+		Packed14_PackBursts(&bursts[0], burstSamples, nbrBursts, (uint8_t *)&bursts[0], cap.header.blockSize);
+		rc = CaptureFile_AppendBursts(&cap, &bursts[0], nbrBursts);
+		if(CaptureFile_Close(&cap) != 0 || rc != 0)
+			return -1;
+	}
+	g_capturePacking = false;
+	return errors == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc != 3) {
+		printf("usage: kernel_check fft|peaks|codec|pack <dir>\n");
+		return 1;
+	}
+	const char *dir = argv[2];
+	int32_t rc = -1;
+	if(!strcmp(argv[1], "fft"))
+		rc = Check_Fft(dir);
+	else if(!strcmp(argv[1], "peaks"))
+		rc = Check_Peaks(dir);
+	else if(!strcmp(argv[1], "codec"))
+		rc = Check_Codec(dir);
+	else if(!strcmp(argv[1], "pack"))
+		rc = Check_Pack(dir);
+	else
+		printf("kernel_check: unknown command '%s'\n", argv[1]);
+	return rc == 0 ? 0 : 1;
+}